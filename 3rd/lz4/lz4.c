@@ -0,0 +1,254 @@
+#include "lz4.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+	block = sequence*
+	sequence :
+		BYTE token	; high 4 bits : literal length, low 4 bits : match length - 4 (15 means more bytes follow)
+		BYTE* literal length - 15 (if >= 15, 255 means more)
+		literals
+		WORD offset (little endian)	; not in the last sequence
+		BYTE* match length - 19 (if >= 15, 255 means more)
+	The last 5 bytes are always literals, and the last match starts at least 12 bytes before the end.
+ */
+
+#define MINMATCH 4
+#define LASTLITERALS 5
+#define MFLIMIT 12
+#define MAX_DISTANCE 65535
+#define HASH_LOG 12
+#define SKIP_TRIGGER 6	// search faster in incompressible data
+
+static inline uint32_t
+read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t
+read64(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// copy 8 bytes at a time, it may write up to 7 bytes after dst + len
+static inline void
+wild_copy(uint8_t *dst, const uint8_t *src, size_t len) {
+	uint8_t *end = dst + len;
+	do {
+		memcpy(dst, src, 8);
+		dst += 8;
+		src += 8;
+	} while (dst < end);
+}
+
+static inline uint32_t
+hash_sequence(uint32_t v) {
+	return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+// count the common bytes of p and m, p can't reach limit
+static inline size_t
+count_match(const uint8_t *p, const uint8_t *m, const uint8_t *limit) {
+	const uint8_t *start = p;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (p + 8 <= limit) {
+		uint64_t diff = read64(p) ^ read64(m);
+		if (diff) {
+			return (size_t)(p - start) + (__builtin_ctzll(diff) >> 3);
+		}
+		p += 8;
+		m += 8;
+	}
+#endif
+	while (p < limit && *p == *m) {
+		++p;
+		++m;
+	}
+	return (size_t)(p - start);
+}
+
+static inline uint8_t *
+write_length(uint8_t *op, size_t len) {
+	for (; len >= 255; len -= 255) {
+		*op++ = 255;
+	}
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+int
+LZ4_compressBound(int isize) {
+	if (isize < 0 || isize > 0x7E000000)
+		return 0;
+	return LZ4_COMPRESSBOUND(isize);
+}
+
+int
+LZ4_compress_default(const char *source, char *dest, int isize, int capacity) {
+	const uint8_t *src = (const uint8_t *)source;
+	const uint8_t *ip = src;
+	const uint8_t *anchor = src;
+	const uint8_t *iend = src + isize;
+	const uint8_t *mflimit = iend - MFLIMIT;
+	const uint8_t *matchlimit = iend - LASTLITERALS;
+	uint8_t *op = (uint8_t *)dest;
+	uint8_t *oend = op + capacity;
+	uint32_t table[1 << HASH_LOG];	// offset of the sequence in src
+	size_t len;
+
+	if (isize < 0 || capacity <= 0)
+		return 0;
+	if (isize < MFLIMIT + 1)
+		goto last_literals;
+
+	memset(table, 0, sizeof(table));
+	table[hash_sequence(read32(ip))] = 0;
+	++ip;
+	for (;;) {
+		const uint8_t *match;
+		unsigned search = 1 << SKIP_TRIGGER;
+		// find a match
+		for (;;) {
+			unsigned step = search++ >> SKIP_TRIGGER;
+			if (ip > mflimit)
+				goto last_literals;
+			uint32_t h = hash_sequence(read32(ip));
+			match = src + table[h];
+			table[h] = (uint32_t)(ip - src);
+			if (match < ip && ip - match <= MAX_DISTANCE && read32(match) == read32(ip))
+				break;
+			ip += step;
+		}
+		// extend the match backward
+		while (ip > anchor && match > src && ip[-1] == match[-1]) {
+			--ip;
+			--match;
+		}
+		size_t literal = (size_t)(ip - anchor);
+		// token + literal length + literals + offset + match length, and the last literals
+		if ((size_t)(oend - op) < 1 + literal / 255 + 1 + literal + 2 + LASTLITERALS + 1)
+			return 0;
+		uint8_t *token = op++;
+		if (literal >= 15) {
+			*token = 15 << 4;
+			op = write_length(op, literal - 15);
+		} else {
+			*token = (uint8_t)(literal << 4);
+		}
+		memcpy(op, anchor, literal);
+		op += literal;
+
+		size_t offset = (size_t)(ip - match);
+		*op++ = (uint8_t)(offset & 0xff);
+		*op++ = (uint8_t)(offset >> 8);
+
+		len = count_match(ip + MINMATCH, match + MINMATCH, matchlimit);
+		ip += MINMATCH + len;
+		if ((size_t)(oend - op) < len / 255 + 1 + LASTLITERALS + 1)
+			return 0;
+		if (len >= 15) {
+			*token += 15;
+			op = write_length(op, len - 15);
+		} else {
+			*token += (uint8_t)len;
+		}
+		anchor = ip;
+		if (ip > mflimit)
+			break;
+		// the position before ip may be a good candidate
+		table[hash_sequence(read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+	}
+
+last_literals:
+	len = (size_t)(iend - anchor);
+	if ((size_t)(oend - op) < 1 + (len + 255 - 15) / 255 + len)
+		return 0;
+	if (len >= 15) {
+		*op++ = 15 << 4;
+		op = write_length(op, len - 15);
+	} else {
+		*op++ = (uint8_t)(len << 4);
+	}
+	memcpy(op, anchor, len);
+	op += len;
+	return (int)(op - (uint8_t *)dest);
+}
+
+// read the extra bytes of length, returns 0 if the source is malformed
+static inline int
+read_length(const uint8_t **pip, const uint8_t *iend, size_t *len) {
+	const uint8_t *ip = *pip;
+	unsigned s;
+	do {
+		if (ip >= iend)
+			return 0;
+		s = *ip++;
+		*len += s;
+	} while (s == 255);
+	*pip = ip;
+	return 1;
+}
+
+int
+LZ4_decompress_safe(const char *source, char *dest, int isize, int capacity) {
+	const uint8_t *ip = (const uint8_t *)source;
+	const uint8_t *iend = ip + isize;
+	uint8_t *op = (uint8_t *)dest;
+	uint8_t *ostart = op;
+	uint8_t *oend = op + capacity;
+
+	if (isize <= 0 || capacity < 0)
+		return -1;
+	for (;;) {
+		unsigned token = *ip++;
+		size_t len = token >> 4;
+		if (len == 15 && !read_length(&ip, iend, &len))
+			return -1;
+		if ((size_t)(iend - ip) < len || (size_t)(oend - op) < len)
+			return -1;
+		if ((size_t)(iend - ip) >= len + 8 && (size_t)(oend - op) >= len + 8) {
+			wild_copy(op, ip, len);
+		} else {
+			memcpy(op, ip, len);
+		}
+		op += len;
+		ip += len;
+		if (ip == iend)
+			break;	// the last sequence has no match
+
+		if (iend - ip < 2)
+			return -1;
+		size_t offset = ip[0] | (size_t)ip[1] << 8;
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - ostart))
+			return -1;
+		len = token & 15;
+		if (len == 15 && !read_length(&ip, iend, &len))
+			return -1;
+		len += MINMATCH;
+		if ((size_t)(oend - op) < len)
+			return -1;
+		const uint8_t *match = op - offset;
+		if (offset >= 8 && (size_t)(oend - op) >= len + 8) {
+			wild_copy(op, match, len);
+			op += len;
+		} else if (offset >= len) {
+			memcpy(op, match, len);
+			op += len;
+		} else {
+			// overlapped copy, repeat the last offset bytes
+			uint8_t *cpy = op + len;
+			while (op < cpy) {
+				*op++ = *match++;
+			}
+		}
+		if (ip >= iend)
+			return -1;
+	}
+	return (int)(op - ostart);
+}
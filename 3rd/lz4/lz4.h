@@ -0,0 +1,21 @@
+#ifndef SKYNET_LZ4_H
+#define SKYNET_LZ4_H
+
+/*
+	LZ4 block format compressor and decompressor.
+	The functions have the same names and semantics as the ones in lz4.h of https://github.com/lz4/lz4 ,
+	so the blocks are compatible with the reference implementation.
+ */
+
+// max size of compressed data in worst case
+#define LZ4_COMPRESSBOUND(isize) ((isize) + ((isize) / 255) + 16)
+
+int LZ4_compressBound(int inputSize);
+
+// returns the size of compressed data in dst, or 0 if dstCapacity is not enough.
+int LZ4_compress_default(const char* src, char* dst, int srcSize, int dstCapacity);
+
+// returns the size of decompressed data in dst, or a negative value if the source is malformed or dstCapacity is not enough.
+int LZ4_decompress_safe(const char* src, char* dst, int compressedSize, int dstCapacity);
+
+#endif
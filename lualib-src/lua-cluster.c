@@ -3,9 +3,12 @@
 #include <lua.h>
 #include <lauxlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 
 #include "skynet.h"
+#include "skynet_timer.h"
+#include "lz4.h"
 
 /*
 	uint32_t/string addr 
@@ -21,6 +24,56 @@
 #define TEMP_LENGTH 0x8200
 #define MULTI_PART 0x8000
 
+#define LARGE_BUFFER "CLUSTER_LARGE_BUFFER"
+#define LARGE_LIMIT (64 * 1024 * 1024)	// default limit of the large buffer
+#define LARGE_MESSAGE "CLUSTER_LARGE_MESSAGE"
+
+// the request type is ored with it if the message is compressed : [DWORD raw size] [lz4 block]
+#define TYPE_COMPRESSED 0x20
+// ok and multi begin of compressed response
+#define RESPONSE_COMPRESSED 5
+#define RESPONSE_MULTI_COMPRESSED 6
+#define CLUSTER_FLAG_LZ4 1
+// the name queried to negotiate the flags after connected, an old node responds "name not found"
+#define CLUSTER_HELLO "$cluster.hello"
+
+// a large (multi part) request or response in reassembly
+struct large_message {
+	struct large_message * next;
+	uint32_t session;
+	uint32_t size;	// declared by the peer, the buffer grows as the parts arrive
+	uint32_t offset;
+	uint32_t cap;
+	char * buffer;	// NULL if the message is discarded (too large or invalid)
+	int is_push;
+	int compressed;
+	uint32_t addr;
+	int namelen;	// addr is a name if namelen > 0
+	char name[256];
+};
+
+struct link_stat {
+	uint64_t raw;	// message bytes before compression
+	uint64_t wire;	// message bytes on the link
+	uint64_t time;	// cpu time of (de)compression in microsecond
+};
+
+// the large messages of a connection, and the compression of it
+struct large_buffer {
+	size_t limit;	// max bytes of all the large messages in reassembly (LARGE_LIMIT by default), 0 is unlimited
+	size_t pending;
+	struct large_message * list;
+	uint32_t compress;	// compress the messages not smaller than it, 0 is off
+	struct link_stat send;
+	struct link_stat recv;
+};
+
+// the reassembled response, owns the buffer until cluster.take
+struct large_result {
+	void * buffer;
+	uint32_t size;
+};
+
 static void
 fill_uint32(uint8_t * buf, uint32_t n) {
 	buf[0] = n & 0xff;
@@ -29,6 +82,11 @@ fill_uint32(uint8_t * buf, uint32_t n) {
 	buf[3] = (n >> 24) & 0xff;
 }
 
+static inline uint32_t
+unpack_uint32(const uint8_t * buf) {
+	return buf[0] | buf[1]<<8 | buf[2]<<16 | buf[3]<<24;
+}
+
 static void
 fill_header(lua_State *L, uint8_t *buf, int sz) {
 	assert(sz < 0x10000);
@@ -36,6 +94,53 @@ fill_header(lua_State *L, uint8_t *buf, int sz) {
 	buf[1] = sz & 0xff;
 }
 
+// returns the compressed message [DWORD raw size] [lz4 block], or NULL if it's not compressed
+static void *
+compress_message(struct large_buffer *lb, const void *msg, uint32_t sz, uint32_t *csz) {
+	lb->send.raw += sz;
+	if (lb->compress == 0 || sz < lb->compress || sz <= 16 || sz > 0x7E000000) {
+		lb->send.wire += sz;
+		return NULL;
+	}
+	uint64_t t = skynet_thread_time();
+	uint8_t * buf = skynet_malloc(sz);
+	// use the compressed message only if it's smaller
+	int n = LZ4_compress_default(msg, (char *)buf+4, (int)sz, (int)sz-5);
+	lb->send.time += skynet_thread_time() - t;
+	if (n <= 0) {
+		skynet_free(buf);
+		lb->send.wire += sz;
+		return NULL;
+	}
+	fill_uint32(buf, sz);
+	*csz = (uint32_t)n + 4;
+	lb->send.wire += *csz;
+	return buf;
+}
+
+// returns the decompressed message, or NULL if it's malformed (or larger than the limit)
+static void *
+decompress_message(struct large_buffer *lb, const uint8_t *buf, uint32_t sz, uint32_t *rawsz) {
+	if (sz < 5)
+		return NULL;
+	uint32_t size = unpack_uint32(buf);
+	// lz4 can't compress more than 255 times
+	if (size > 0x7E000000 || (uint64_t)size > (uint64_t)(sz-4) * 255 || (lb->limit > 0 && size > lb->limit))
+		return NULL;
+	uint64_t t = skynet_thread_time();
+	void * msg = skynet_malloc(size);
+	int n = LZ4_decompress_safe((const char *)buf+4, msg, (int)sz-4, (int)size);
+	lb->recv.time += skynet_thread_time() - t;
+	if (n != (int)size) {
+		skynet_free(msg);
+		return NULL;
+	}
+	lb->recv.raw += size;
+	lb->recv.wire += sz;
+	*rawsz = size;
+	return msg;
+}
+
 /*
 	The request package : 
 		first WORD is size of the package with big-endian
@@ -73,14 +178,16 @@ fill_header(lua_State *L, uint8_t *buf, int sz) {
 		BYTE 2/3 ; 2:multipart, 3:multipart end
 		DWORD SESSION
 		PADDING msgpart(sz)
+
+	The type (0/1/0x41/0x80/0x81/0xc1) is ored with TYPE_COMPRESSED if msg is compressed.
  */
 static int
-packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int is_push) {
+packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int is_push, int compressed) {
 	uint32_t addr = (uint32_t)lua_tointeger(L,1);
 	uint8_t buf[TEMP_LENGTH];
 	if (sz < MULTI_PART) {
 		fill_header(L, buf, sz+9);
-		buf[2] = 0;
+		buf[2] = compressed;
 		fill_uint32(buf+3, addr);
 		fill_uint32(buf+7, is_push ? 0 : (uint32_t)session);
 		memcpy(buf+11,msg,sz);
@@ -90,7 +197,7 @@ packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int is_push)
 	} else {
 		int part = (sz - 1) / MULTI_PART + 1;
 		fill_header(L, buf, 13);
-		buf[2] = is_push ? 0x41 : 1;	// multi push or request
+		buf[2] = (is_push ? 0x41 : 1) | compressed;	// multi push or request
 		fill_uint32(buf+3, addr);
 		fill_uint32(buf+7, (uint32_t)session);
 		fill_uint32(buf+11, sz);
@@ -100,7 +207,7 @@ packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int is_push)
 }
 
 static int
-packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int is_push) {
+packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int is_push, int compressed) {
 	size_t namelen = 0;
 	const char *name = lua_tolstring(L, 1, &namelen);
 	if (name == NULL || namelen < 1 || namelen > 255) {
@@ -111,7 +218,7 @@ packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int is_push)
 	uint8_t buf[TEMP_LENGTH];
 	if (sz < MULTI_PART) {
 		fill_header(L, buf, sz+6+namelen);
-		buf[2] = 0x80;
+		buf[2] = 0x80 | compressed;
 		buf[3] = (uint8_t)namelen;
 		memcpy(buf+4, name, namelen);
 		fill_uint32(buf+4+namelen, is_push ? 0 : (uint32_t)session);
@@ -122,7 +229,7 @@ packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int is_push)
 	} else {
 		int part = (sz - 1) / MULTI_PART + 1;
 		fill_header(L, buf, 10+namelen);
-		buf[2] = is_push ? 0xc1 : 0x81;	// multi push or request
+		buf[2] = (is_push ? 0xc1 : 0x81) | compressed;	// multi push or request
 		buf[3] = (uint8_t)namelen;
 		memcpy(buf+4, name, namelen);
 		fill_uint32(buf+4+namelen, (uint32_t)session);
@@ -170,12 +277,24 @@ packrequest(lua_State *L, int is_push) {
 		skynet_free(msg);
 		return luaL_error(L, "Invalid request session %d", session);
 	}
+	int compressed = 0;
+	if (!lua_isnoneornil(L, 5)) {
+		struct large_buffer *lb = luaL_checkudata(L, 5, LARGE_BUFFER);
+		uint32_t csz;
+		void * cmsg = compress_message(lb, msg, sz, &csz);
+		if (cmsg) {
+			skynet_free(msg);
+			msg = cmsg;
+			sz = csz;
+			compressed = TYPE_COMPRESSED;
+		}
+	}
 	int addr_type = lua_type(L,1);
 	int multipak;
 	if (addr_type == LUA_TNUMBER) {
-		multipak = packreq_number(L, session, msg, sz, is_push);
+		multipak = packreq_number(L, session, msg, sz, is_push, compressed);
 	} else {
-		multipak = packreq_string(L, session, msg, sz, is_push);
+		multipak = packreq_string(L, session, msg, sz, is_push, compressed);
 	}
 	int current_session = session;
 	if (++session < 0) {
@@ -203,6 +322,340 @@ lpackpush(lua_State *L) {
 	return packrequest(L, 1);
 }
 
+static void
+large_free(struct large_buffer *lb, struct large_message *m) {
+	if (m->buffer) {
+		skynet_free(m->buffer);
+		lb->pending -= m->cap;
+	}
+	skynet_free(m);
+}
+
+// unlink the message of session, returns NULL if not found
+static struct large_message *
+large_remove(struct large_buffer *lb, uint32_t session) {
+	struct large_message **pm = &lb->list;
+	while (*pm) {
+		struct large_message *m = *pm;
+		if (m->session == session) {
+			*pm = m->next;
+			return m;
+		}
+		pm = &m->next;
+	}
+	return NULL;
+}
+
+static struct large_message *
+large_open(struct large_buffer *lb, uint32_t session, uint32_t size) {
+	struct large_message *m = large_remove(lb, session);
+	if (m) {
+		// the last message of the session is not finished
+		large_free(lb, m);
+	}
+	m = skynet_malloc(sizeof(*m));
+	m->session = session;
+	m->size = size;
+	m->offset = 0;
+	m->is_push = 0;
+	m->compressed = 0;
+	m->addr = 0;
+	m->namelen = 0;
+	// don't trust the size, allocate the first part only
+	m->cap = size < MULTI_PART ? size : MULTI_PART;
+	if (lb->limit > 0 && (size > lb->limit || lb->pending + m->cap > lb->limit)) {
+		m->buffer = NULL;
+	} else {
+		m->buffer = skynet_malloc(m->cap);
+		lb->pending += m->cap;
+	}
+	m->next = lb->list;
+	lb->list = m;
+	return m;
+}
+
+static void
+large_discard(struct large_buffer *lb, struct large_message *m) {
+	skynet_free(m->buffer);
+	m->buffer = NULL;
+	lb->pending -= m->cap;
+}
+
+static void
+large_append(struct large_buffer *lb, struct large_message *m, const void *data, uint32_t sz) {
+	if (m->buffer == NULL)
+		return;
+	if (sz > m->size - m->offset) {
+		large_discard(lb, m);
+		return;
+	}
+	if (sz > m->cap - m->offset) {
+		// double the buffer, no more than the size
+		uint32_t cap = m->cap;
+		do {
+			cap = cap > m->size / 2 ? m->size : cap * 2;
+		} while (sz > cap - m->offset);
+		if (lb->limit > 0 && lb->pending + (cap - m->cap) > lb->limit) {
+			large_discard(lb, m);
+			return;
+		}
+		m->buffer = skynet_realloc(m->buffer, cap);
+		lb->pending += cap - m->cap;
+		m->cap = cap;
+	}
+	memcpy(m->buffer + m->offset, data, sz);
+	m->offset += sz;
+}
+
+// take the buffer of a finished message and free the message, returns NULL if the message is discarded or incomplete
+static void *
+large_close(struct large_buffer *lb, struct large_message *m) {
+	void * buffer = NULL;
+	if (m->buffer && m->offset == m->size) {
+		buffer = m->buffer;
+		m->buffer = NULL;
+		lb->pending -= m->cap;
+	}
+	large_free(lb, m);
+	return buffer;
+}
+
+static int
+llargebuffer_gc(lua_State *L) {
+	struct large_buffer *lb = lua_touserdata(L, 1);
+	while (lb->list) {
+		struct large_message *m = lb->list;
+		lb->list = m->next;
+		large_free(lb, m);
+	}
+	return 0;
+}
+
+/*
+	integer limit (optional) : max bytes of the large messages in reassembly, LARGE_LIMIT by default, 0 is unlimited
+	return userdata large buffer of a connection
+ */
+static int
+llargebuffer(lua_State *L) {
+	size_t limit = (size_t)luaL_optinteger(L, 1, LARGE_LIMIT);
+	struct large_buffer *lb = lua_newuserdata(L, sizeof(*lb));
+	lb->limit = limit;
+	lb->pending = 0;
+	lb->list = NULL;
+	lb->compress = 0;
+	memset(&lb->send, 0, sizeof(lb->send));
+	memset(&lb->recv, 0, sizeof(lb->recv));
+	if (luaL_newmetatable(L, LARGE_BUFFER)) {
+		lua_pushcfunction(L, llargebuffer_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+static int
+llargeresult_gc(lua_State *L) {
+	struct large_result *r = lua_touserdata(L, 1);
+	skynet_free(r->buffer);
+	r->buffer = NULL;
+	return 0;
+}
+
+static void
+push_result(lua_State *L, void *buffer, uint32_t size) {
+	struct large_result *r = lua_newuserdata(L, sizeof(*r));
+	r->buffer = buffer;
+	r->size = size;
+	if (luaL_newmetatable(L, LARGE_MESSAGE)) {
+		lua_pushcfunction(L, llargeresult_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+}
+
+/*
+	userdata large response (see lunpackresponse)
+	return lightuserdata msg, integer sz
+ */
+static int
+ltake(lua_State *L) {
+	struct large_result *r = luaL_checkudata(L, 1, LARGE_MESSAGE);
+	if (r->buffer == NULL) {
+		return luaL_error(L, "The large response is taken");
+	}
+	lua_pushlightuserdata(L, r->buffer);
+	lua_pushinteger(L, r->size);
+	r->buffer = NULL;
+	return 2;
+}
+
+static void *
+copy_message(const uint8_t *buf, int sz) {
+	void * msg = skynet_malloc(sz);
+	memcpy(msg, buf, sz);
+	return msg;
+}
+
+// push the message (copy or decompress it), returns 0 if it's malformed
+static int
+push_message(lua_State *L, struct large_buffer *lb, const uint8_t *buf, uint32_t sz, int compressed) {
+	if (compressed) {
+		uint32_t rawsz;
+		void * msg = decompress_message(lb, buf, sz, &rawsz);
+		if (msg == NULL)
+			return 0;
+		lua_pushlightuserdata(L, msg);
+		lua_pushinteger(L, rawsz);
+	} else {
+		lb->recv.raw += sz;
+		lb->recv.wire += sz;
+		lua_pushlightuserdata(L, copy_message(buf, sz));
+		lua_pushinteger(L, sz);
+	}
+	return 1;
+}
+
+static int
+invalid_message(lua_State *L, uint32_t session, int is_push, const char * err) {
+	lua_settop(L, 0);
+	lua_pushboolean(L, 0);
+	lua_pushinteger(L, session);
+	lua_pushstring(L, err);
+	lua_pushnil(L);
+	lua_pushboolean(L, is_push);
+	return 5;
+}
+
+/*
+	userdata large buffer
+	lightuserdata msg (the package, not free)
+	integer sz
+	return
+		nil : a part of the large request is saved
+		uint32_t/string addr, int session, lightuserdata msg, int sz, boolean is_push : the request, msg should be free
+		false, int session, string error, nil, boolean is_push : the invalid (or too large) request
+ */
+static int
+lunpackmessage(lua_State *L) {
+	struct large_buffer *lb = luaL_checkudata(L, 1, LARGE_BUFFER);
+	const uint8_t *buf = lua_touserdata(L, 2);
+	int sz = (int)luaL_checkinteger(L, 3);
+	if (buf == NULL || sz < 1) {
+		return luaL_error(L, "Invalid cluster message");
+	}
+	int type = buf[0];
+	int compressed = 0;
+	if (type != 2 && type != 3) {
+		compressed = type & TYPE_COMPRESSED;
+		type &= ~TYPE_COMPRESSED;
+	}
+	switch (type) {
+	case 0: {
+		if (sz < 9) {
+			return luaL_error(L, "Invalid cluster message (size=%d)", sz);
+		}
+		uint32_t session = unpack_uint32(buf+5);
+		lua_pushinteger(L, unpack_uint32(buf+1));
+		lua_pushinteger(L, session);
+		if (!push_message(L, lb, buf+9, sz-9, compressed)) {
+			return invalid_message(L, session, session == 0, "Invalid compressed req");
+		}
+		lua_pushboolean(L, session == 0);	// is_push, no reponse
+		return 5;
+	}
+	case 0x80: {
+		size_t namesz = sz < 2 ? 0 : buf[1];
+		if (sz < 2 || sz < namesz + 6) {
+			return luaL_error(L, "Invalid cluster message (size=%d)", sz);
+		}
+		uint32_t session = unpack_uint32(buf + namesz + 2);
+		lua_pushlstring(L, (const char *)buf+2, namesz);
+		lua_pushinteger(L, session);
+		if (!push_message(L, lb, buf+namesz+6, sz-namesz-6, compressed)) {
+			return invalid_message(L, session, session == 0, "Invalid compressed req");
+		}
+		lua_pushboolean(L, session == 0);
+		return 5;
+	}
+	case 1:
+	case 0x41: {
+		if (sz != 13) {
+			return luaL_error(L, "Invalid cluster message size %d (multi req must be 13)", sz);
+		}
+		struct large_message *m = large_open(lb, unpack_uint32(buf+5), unpack_uint32(buf+9));
+		m->addr = unpack_uint32(buf+1);
+		m->is_push = type == 0x41;
+		m->compressed = compressed;
+		return 0;
+	}
+	case 0x81:
+	case 0xc1: {
+		size_t namesz = sz < 2 ? 0 : buf[1];
+		if (sz < 2 || namesz < 1 || sz < namesz + 10) {
+			return luaL_error(L, "Invalid cluster message (size=%d)", sz);
+		}
+		struct large_message *m = large_open(lb, unpack_uint32(buf+namesz+2), unpack_uint32(buf+namesz+6));
+		memcpy(m->name, buf+2, namesz);
+		m->namelen = (int)namesz;
+		m->is_push = type == 0xc1;
+		m->compressed = compressed;
+		return 0;
+	}
+	case 2:
+	case 3: {
+		if (sz < 5) {
+			return luaL_error(L, "Invalid cluster multi part message");
+		}
+		uint32_t session = unpack_uint32(buf+1);
+		struct large_message *m = large_remove(lb, session);
+		if (m == NULL) {
+			if (buf[0] == 2)
+				return 0;
+			lua_pushboolean(L, 0);
+			lua_pushinteger(L, session);
+			lua_pushliteral(L, "Invalid large req");
+			return 3;
+		}
+		large_append(lb, m, buf+5, sz-5);
+		if (buf[0] == 2) {
+			// put it back, the list is short
+			m->next = lb->list;
+			lb->list = m;
+			return 0;
+		}
+		int is_push = m->is_push;
+		uint32_t size = m->size;
+		compressed = m->compressed;
+		if (m->namelen > 0) {
+			lua_pushlstring(L, m->name, m->namelen);
+		} else {
+			lua_pushinteger(L, m->addr);
+		}
+		void * msg = large_close(lb, m);
+		if (msg == NULL) {
+			return invalid_message(L, session, is_push, "Invalid large req (too large or size mismatch)");
+		}
+		lua_pushinteger(L, session);
+		if (compressed) {
+			int ok = push_message(L, lb, msg, size, compressed);
+			skynet_free(msg);
+			if (!ok) {
+				return invalid_message(L, session, is_push, "Invalid compressed req");
+			}
+		} else {
+			lb->recv.raw += size;
+			lb->recv.wire += size;
+			lua_pushlightuserdata(L, msg);
+			lua_pushinteger(L, size);
+		}
+		lua_pushboolean(L, is_push);
+		return 5;
+	}
+	default:
+		return luaL_error(L, "Invalid req package type %d", buf[0]);
+	}
+}
+
 /*
 	string packed message
 	return 	
@@ -212,11 +665,6 @@ lpackpush(lua_State *L) {
 		boolean padding
  */
 
-static inline uint32_t
-unpack_uint32(const uint8_t * buf) {
-	return buf[0] | buf[1]<<8 | buf[2]<<16 | buf[3]<<24;
-}
-
 static int
 unpackreq_number(lua_State *L, const uint8_t * buf, int sz) {
 	if (sz < 9) {
@@ -346,10 +794,12 @@ lunpackrequest(lua_State *L) {
 		2: multi begin
 		3: multi part
 		4: multi end
+		5: ok (compressed msg)
+		6: multi begin (compressed msg)
 	PADDING msg
 		type = 0, error msg
-		type = 1, msg
-		type = 2, DWORD size
+		type = 1/5, msg
+		type = 2/6, DWORD size
 		type = 3/4, msg
  */
 /*
@@ -357,6 +807,7 @@ lunpackrequest(lua_State *L) {
 	boolean ok
 	lightuserdata msg
 	int sz
+	userdata large buffer (optional) : compress the msg if it's negotiated
 	return string response
  */
 static int
@@ -375,12 +826,23 @@ lpackresponse(lua_State *L) {
 		sz = (size_t)luaL_checkinteger(L, 4);
 	}
 
+	void * cmsg = NULL;
 	if (!ok) {
 		if (sz > MULTI_PART) {
 			// truncate the error msg if too long
 			sz = MULTI_PART;
 		}
 	} else {
+		if (!lua_isnoneornil(L, 5)) {
+			struct large_buffer *lb = luaL_checkudata(L, 5, LARGE_BUFFER);
+			uint32_t csz;
+			cmsg = compress_message(lb, msg, (uint32_t)sz, &csz);
+			if (cmsg) {
+				msg = cmsg;
+				sz = csz;
+				ok = RESPONSE_COMPRESSED;
+			}
+		}
 		if (sz > MULTI_PART) {
 			// return 
 			int part = (sz - 1) / MULTI_PART + 1;
@@ -390,7 +852,7 @@ lpackresponse(lua_State *L) {
 			// multi part begin
 			fill_header(L, buf, 9);
 			fill_uint32(buf+2, session);
-			buf[6] = 2;
+			buf[6] = cmsg ? RESPONSE_MULTI_COMPRESSED : 2;
 			fill_uint32(buf+7, (uint32_t)sz);
 			lua_pushlstring(L, (const char *)buf, 11);
 			lua_rawseti(L, -2, 1);
@@ -414,6 +876,7 @@ lpackresponse(lua_State *L) {
 				sz -= s;
 				ptr += s;
 			}
+			skynet_free(cmsg);
 			return 1;
 		}
 	}
@@ -423,14 +886,80 @@ lpackresponse(lua_State *L) {
 	fill_uint32(buf+2, session);
 	buf[6] = ok;
 	memcpy(buf+7,msg,sz);
+	skynet_free(cmsg);
 
 	lua_pushlstring(L, (const char *)buf, sz+7);
 
 	return 1;
 }
 
+/*
+	The multi part response is reassembled in the large buffer (if it's given),
+	padding is true (and msg is nil) until the last part, and then msg is a userdata (see ltake).
+ */
+static int
+unpackresponse_large(lua_State *L, struct large_buffer *lb, uint32_t session, const char *buf, size_t sz) {
+	struct large_message *m;
+	switch(buf[4]) {
+	case 2:	// multi begin
+	case RESPONSE_MULTI_COMPRESSED:
+		if (sz != 9) {
+			return 0;
+		}
+		m = large_open(lb, session, unpack_uint32((const uint8_t *)buf+5));
+		m->compressed = buf[4] == RESPONSE_MULTI_COMPRESSED;
+		break;
+	case 3:	// multi part
+		m = large_remove(lb, session);
+		if (m) {
+			large_append(lb, m, buf+5, (uint32_t)(sz-5));
+			m->next = lb->list;
+			lb->list = m;
+		}
+		break;
+	default: {	// multi end
+		m = large_remove(lb, session);
+		if (m == NULL) {
+			lua_pushboolean(L, 0);
+			lua_pushliteral(L, "Invalid large response");
+			return 3;
+		}
+		large_append(lb, m, buf+5, (uint32_t)(sz-5));
+		uint32_t size = m->size;
+		int compressed = m->compressed;
+		void * msg = large_close(lb, m);
+		if (msg == NULL) {
+			lua_pushboolean(L, 0);
+			lua_pushliteral(L, "Invalid large response (too large or size mismatch)");
+			return 3;
+		}
+		if (compressed) {
+			void * raw = decompress_message(lb, msg, size, &size);
+			skynet_free(msg);
+			if (raw == NULL) {
+				lua_pushboolean(L, 0);
+				lua_pushliteral(L, "Invalid compressed response");
+				return 3;
+			}
+			msg = raw;
+		} else {
+			lb->recv.raw += size;
+			lb->recv.wire += size;
+		}
+		lua_pushboolean(L, 1);
+		push_result(L, msg, size);
+		return 3;
+	}
+	}
+	lua_pushboolean(L, 1);
+	lua_pushnil(L);
+	lua_pushboolean(L, 1);
+	return 4;
+}
+
 /*
 	string packed response
+	userdata large buffer (optional)
 	return integer session
 		boolean ok
 		string msg
@@ -444,17 +973,41 @@ lunpackresponse(lua_State *L) {
 		return 0;
 	}
 	uint32_t session = unpack_uint32((const uint8_t *)buf);
+	struct large_buffer *lb = lua_isnoneornil(L, 2) ? NULL : luaL_checkudata(L, 2, LARGE_BUFFER);
 	lua_pushinteger(L, (lua_Integer)session);
+	if (lb && ((buf[4] >= 2 && buf[4] <= 4) || buf[4] == RESPONSE_MULTI_COMPRESSED)) {
+		return unpackresponse_large(L, lb, session, buf, sz);
+	}
 	switch(buf[4]) {
 	case 0:	// error
 		lua_pushboolean(L, 0);
 		lua_pushlstring(L, buf+5, sz-5);
 		return 3;
 	case 1:	// ok
+		if (lb) {
+			lb->recv.raw += sz-5;
+			lb->recv.wire += sz-5;
+		}
+		lua_pushboolean(L, 1);
+		lua_pushlstring(L, buf+5, sz-5);
+		return 3;
 	case 4:	// multi end
 		lua_pushboolean(L, 1);
 		lua_pushlstring(L, buf+5, sz-5);
 		return 3;
+	case RESPONSE_COMPRESSED: {
+		uint32_t rawsz;
+		void * msg = lb ? decompress_message(lb, (const uint8_t *)buf+5, (uint32_t)(sz-5), &rawsz) : NULL;
+		if (msg == NULL) {
+			lua_pushboolean(L, 0);
+			lua_pushliteral(L, "Invalid compressed response");
+			return 3;
+		}
+		lua_pushboolean(L, 1);
+		lua_pushlstring(L, msg, rawsz);
+		skynet_free(msg);
+		return 3;
+	}
 	case 2:	// multi begin
 		if (sz != 9) {
 			return 0;
@@ -507,6 +1060,50 @@ lconcat(lua_State *L) {
 	return 2;
 }
 
+/*
+	userdata large buffer
+	integer flags of the remote node
+	integer threshold (optional) : compress the messages not smaller than it, 0 is off
+	return integer flags of this node
+ */
+static int
+lnegotiate(lua_State *L) {
+	struct large_buffer *lb = luaL_checkudata(L, 1, LARGE_BUFFER);
+	lua_Integer flags = luaL_optinteger(L, 2, 0);
+	lua_Integer threshold = luaL_optinteger(L, 3, 0);
+	if ((flags & CLUSTER_FLAG_LZ4) && threshold > 0) {
+		lb->compress = threshold > UINT32_MAX ? UINT32_MAX : (uint32_t)threshold;
+	} else {
+		lb->compress = 0;
+	}
+	lua_pushinteger(L, CLUSTER_FLAG_LZ4);
+	return 1;
+}
+
+static void
+push_stat(lua_State *L, const char * name, uint64_t v) {
+	lua_pushinteger(L, (lua_Integer)v);
+	lua_setfield(L, -2, name);
+}
+
+/*
+	userdata large buffer
+	return table : bytes before compression (raw), bytes on the link (wire), and cpu time in microsecond
+ */
+static int
+llinkstat(lua_State *L) {
+	struct large_buffer *lb = luaL_checkudata(L, 1, LARGE_BUFFER);
+	lua_createtable(L, 0, 7);
+	push_stat(L, "compress", lb->compress);
+	push_stat(L, "send_raw", lb->send.raw);
+	push_stat(L, "send_wire", lb->send.wire);
+	push_stat(L, "send_time", lb->send.time);
+	push_stat(L, "recv_raw", lb->recv.raw);
+	push_stat(L, "recv_wire", lb->recv.wire);
+	push_stat(L, "recv_time", lb->recv.time);
+	return 1;
+}
+
 LUAMOD_API int
 luaopen_skynet_cluster_core(lua_State *L) {
 	luaL_Reg l[] = {
@@ -516,10 +1113,17 @@ luaopen_skynet_cluster_core(lua_State *L) {
 		{ "packresponse", lpackresponse },
 		{ "unpackresponse", lunpackresponse },
 		{ "concat", lconcat },
+		{ "largebuffer", llargebuffer },
+		{ "unpackmessage", lunpackmessage },
+		{ "take", ltake },
+		{ "negotiate", lnegotiate },
+		{ "linkstat", llinkstat },
 		{ NULL, NULL },
 	};
 	luaL_checkversion(L);
 	luaL_newlib(L,l);
+	lua_pushliteral(L, CLUSTER_HELLO);
+	lua_setfield(L, -2, "hello");
 
 	return 1;
 }
@@ -2,7 +2,9 @@
 
 #include "skynet_malloc.h"
 
+#include "skynet.h"
 #include "skynet_socket.h"
+#include "frameheader.h"
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -12,8 +14,8 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define QUEUESIZE 1024
-#define HASHSIZE 4096
+#define CHUNKSIZE 1024
+#define HASHSIZE 64	// initial size of uncomplete table, power of 2
 #define SMALLSTRING 2048
 
 #define TYPE_DATA 1
@@ -23,8 +25,12 @@
 #define TYPE_CLOSE 5
 #define TYPE_WARNING 6
 
+// the upvalue of filter after types, the upvalue of the other functions is 1
+#define FILTER_HEADER 7
+
 /*
-	Each package is uint16 + data , uint16 (serialized in big-endian) is the number of bytes comprising the data .
+	Each package is header + data, the header is uint16 (serialized in big-endian) by default, it can be
+	changed by netpack.header (see frameheader.h).
  */
 
 struct netpack {
@@ -35,28 +41,29 @@ struct netpack {
 
 struct uncomplete {
 	struct netpack pack;
-	struct uncomplete * next;
-	int read;
-	int header;
+	int read;	// -1 : header is uncomplete, -2 : invalid frame, discard the data
+	int header_n;
+	uint8_t header[FRAME_HEADER_MAX];
 };
 
-struct queue {
-	int cap;
-	int head;
-	int tail;
-	struct uncomplete * hash[HASHSIZE];
-	struct netpack queue[QUEUESIZE];
+struct chunk {
+	struct chunk * next;
+	struct netpack pack[CHUNKSIZE];
 };
 
-static void
-clear_list(struct uncomplete * uc) {
-	while (uc) {
-		skynet_free(uc->pack.buffer);
-		void * tmp = uc;
-		uc = uc->next;
-		skynet_free(tmp);
-	}
-}
+// The queue userdata never moves, so the packages and uncomplete records are kept in it.
+struct queue {
+	// open addressing (linear probing) table of uncomplete, keyed by socket id
+	int hash_cap;
+	int hash_n;
+	struct uncomplete ** hash;
+	// packages in a list of chunks, pop from head, push to tail
+	struct chunk * head;
+	struct chunk * tail;
+	struct chunk * freechunk;	// cache one chunk
+	int head_idx;
+	int tail_idx;
+};
 
 static int
 lclear(lua_State *L) {
@@ -65,52 +72,112 @@ lclear(lua_State *L) {
 		return 0;
 	}
 	int i;
-	for (i=0;i<HASHSIZE;i++) {
-		clear_list(q->hash[i]);
-		q->hash[i] = NULL;
-	}
-	if (q->head > q->tail) {
-		q->tail += q->cap;
+	for (i=0;i<q->hash_cap;i++) {
+		struct uncomplete * uc = q->hash[i];
+		if (uc) {
+			skynet_free(uc->pack.buffer);
+			skynet_free(uc);
+		}
 	}
-	for (i=q->head;i<q->tail;i++) {
-		struct netpack *np = &q->queue[i % q->cap];
-		skynet_free(np->buffer);
+	skynet_free(q->hash);
+	q->hash = NULL;
+	q->hash_cap = 0;
+	q->hash_n = 0;
+	while (q->head) {
+		struct chunk * c = q->head;
+		int n = c == q->tail ? q->tail_idx : CHUNKSIZE;
+		for (i=q->head_idx;i<n;i++) {
+			skynet_free(c->pack[i].buffer);
+		}
+		q->head = c->next;
+		q->head_idx = 0;
+		skynet_free(c);
 	}
-	q->head = q->tail = 0;
+	q->tail = NULL;
+	q->tail_idx = 0;
+	skynet_free(q->freechunk);
+	q->freechunk = NULL;
 
 	return 0;
 }
 
 static inline int
-hash_fd(int fd) {
-	int a = fd >> 24;
-	int b = fd >> 12;
-	int c = fd;
-	return (int)(((uint32_t)(a + b + c)) % HASHSIZE);
+hash_fd(struct queue *q, int fd) {
+	return (int)(((uint32_t)fd * 2654435761u) & (q->hash_cap - 1));
+}
+
+static void
+insert_hash(struct queue *q, struct uncomplete *uc) {
+	int mask = q->hash_cap - 1;
+	int h = hash_fd(q, uc->pack.id);
+	while (q->hash[h]) {
+		h = (h + 1) & mask;
+	}
+	q->hash[h] = uc;
+}
+
+static void
+resize_hash(struct queue *q, int cap) {
+	struct uncomplete ** old = q->hash;
+	int old_cap = q->hash_cap;
+	q->hash = skynet_malloc(cap * sizeof(struct uncomplete *));
+	memset(q->hash, 0, cap * sizeof(struct uncomplete *));
+	q->hash_cap = cap;
+	int i;
+	for (i=0;i<old_cap;i++) {
+		if (old[i]) {
+			insert_hash(q, old[i]);
+		}
+	}
+	skynet_free(old);
 }
 
+static void
+insert_uncomplete(struct queue *q, struct uncomplete *uc) {
+	// keep load factor <= 1/2
+	if (q->hash_n >= q->hash_cap / 2) {
+		resize_hash(q, q->hash_cap ? q->hash_cap * 2 : HASHSIZE);
+	}
+	insert_hash(q, uc);
+	++q->hash_n;
+}
+
+// find and remove the uncomplete of fd
 static struct uncomplete *
 find_uncomplete(struct queue *q, int fd) {
-	if (q == NULL)
-		return NULL;
-	int h = hash_fd(fd);
-	struct uncomplete * uc = q->hash[h];
-	if (uc == NULL)
+	if (q == NULL || q->hash_n == 0)
 		return NULL;
-	if (uc->pack.id == fd) {
-		q->hash[h] = uc->next;
-		return uc;
+	int mask = q->hash_cap - 1;
+	int h = hash_fd(q, fd);
+	struct uncomplete * uc;
+	for (;;) {
+		uc = q->hash[h];
+		if (uc == NULL)
+			return NULL;
+		if (uc->pack.id == fd)
+			break;
+		h = (h + 1) & mask;
 	}
-	struct uncomplete * last = uc;
-	while (last->next) {
-		uc = last->next;
-		if (uc->pack.id == fd) {
-			last->next = uc->next;
-			return uc;
+	// backward shift deletion, no tombstone
+	int hole = h;
+	for (;;) {
+		h = (h + 1) & mask;
+		struct uncomplete * next = q->hash[h];
+		if (next == NULL)
+			break;
+		int home = hash_fd(q, next->pack.id);
+		// move next to the hole if its home is not in (hole, h]
+		if (((h - home) & mask) >= ((h - hole) & mask)) {
+			q->hash[hole] = next;
+			hole = h;
 		}
-		last = uc;
 	}
-	return NULL;
+	q->hash[hole] = NULL;
+	--q->hash_n;
+	if (q->hash_cap > HASHSIZE && q->hash_n < q->hash_cap / 8) {
+		resize_hash(q, q->hash_cap / 2);
+	}
+	return uc;
 }
 
 static struct queue *
@@ -118,35 +185,17 @@ get_queue(lua_State *L) {
 	struct queue *q = lua_touserdata(L,1);
 	if (q == NULL) {
 		q = lua_newuserdata(L, sizeof(struct queue));
-		q->cap = QUEUESIZE;
-		q->head = 0;
-		q->tail = 0;
-		int i;
-		for (i=0;i<HASHSIZE;i++) {
-			q->hash[i] = NULL;
+		memset(q, 0, sizeof(*q));
+		if (luaL_newmetatable(L, "netpack_queue")) {
+			lua_pushcfunction(L, lclear);
+			lua_setfield(L, -2, "__gc");
 		}
+		lua_setmetatable(L, -2);
 		lua_replace(L, 1);
 	}
 	return q;
 }
 
-static void
-expand_queue(lua_State *L, struct queue *q) {
-	struct queue *nq = lua_newuserdata(L, sizeof(struct queue) + q->cap * sizeof(struct netpack));
-	nq->cap = q->cap + QUEUESIZE;
-	nq->head = 0;
-	nq->tail = q->cap;
-	memcpy(nq->hash, q->hash, sizeof(nq->hash));
-	memset(q->hash, 0, sizeof(q->hash));
-	int i;
-	for (i=0;i<q->cap;i++) {
-		int idx = (q->head + i) % q->cap;
-		nq->queue[i] = q->queue[idx];
-	}
-	q->head = q->tail = 0;
-	lua_replace(L,1);
-}
-
 static void
 push_data(lua_State *L, int fd, void *buffer, int size, int clone) {
 	if (clone) {
@@ -155,63 +204,95 @@ push_data(lua_State *L, int fd, void *buffer, int size, int clone) {
 		buffer = tmp;
 	}
 	struct queue *q = get_queue(L);
-	struct netpack *np = &q->queue[q->tail];
-	if (++q->tail >= q->cap)
-		q->tail -= q->cap;
+	if (q->tail == NULL || q->tail_idx == CHUNKSIZE) {
+		struct chunk * c = q->freechunk;
+		if (c) {
+			q->freechunk = NULL;
+		} else {
+			c = skynet_malloc(sizeof(*c));
+		}
+		c->next = NULL;
+		if (q->tail) {
+			q->tail->next = c;
+		} else {
+			q->head = c;
+			q->head_idx = 0;
+		}
+		q->tail = c;
+		q->tail_idx = 0;
+	}
+	struct netpack *np = &q->tail->pack[q->tail_idx++];
 	np->id = fd;
 	np->buffer = buffer;
 	np->size = size;
-	if (q->head == q->tail) {
-		expand_queue(L, q);
-	}
 }
 
 static struct uncomplete *
 save_uncomplete(lua_State *L, int fd) {
 	struct queue *q = get_queue(L);
-	int h = hash_fd(fd);
 	struct uncomplete * uc = skynet_malloc(sizeof(struct uncomplete));
 	memset(uc, 0, sizeof(*uc));
-	uc->next = q->hash[h];
 	uc->pack.id = fd;
-	q->hash[h] = uc;
+	insert_uncomplete(q, uc);
 
 	return uc;
 }
 
-static inline int
-read_size(uint8_t * buffer) {
-	int r = (int)buffer[0] << 8 | (int)buffer[1];
-	return r;
+static void
+invalid_frame(lua_State *L, const struct frame_header *h, int fd, struct uncomplete *uc) {
+	if (uc == NULL) {
+		uc = save_uncomplete(L, fd);
+	} else {
+		insert_uncomplete(lua_touserdata(L,1), uc);
+	}
+	uc->read = -2;
+	lua_getfield(L, LUA_REGISTRYINDEX, "skynet_context");
+	struct skynet_context * ctx = lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	skynet_error(ctx, "Invalid frame header or frame size > %d from fd (%d), close it", h->max, fd);
+	skynet_socket_close(ctx, fd);
 }
 
 static void
-push_more(lua_State *L, int fd, uint8_t *buffer, int size) {
-	if (size == 1) {
-		struct uncomplete * uc = save_uncomplete(L, fd);
-		uc->read = -1;
-		uc->header = *buffer;
-		return;
-	}
-	int pack_size = read_size(buffer);
-	buffer += 2;
-	size -= 2;
-
-	if (size < pack_size) {
-		struct uncomplete * uc = save_uncomplete(L, fd);
-		uc->read = size;
-		uc->pack.size = pack_size;
-		uc->pack.buffer = skynet_malloc(pack_size);
-		memcpy(uc->pack.buffer, buffer, size);
-		return;
-	}
-	push_data(L, fd, buffer, pack_size, 1);
+save_header(lua_State *L, int fd, uint8_t *buffer, int size) {
+	struct uncomplete * uc = save_uncomplete(L, fd);
+	uc->read = -1;
+	uc->header_n = size;
+	memcpy(uc->header, buffer, size);
+}
+
+static void
+save_pack(lua_State *L, int fd, uint8_t *buffer, int size, int pack_size) {
+	struct uncomplete * uc = save_uncomplete(L, fd);
+	uc->read = size;
+	uc->pack.size = pack_size;
+	uc->pack.buffer = skynet_malloc(pack_size);
+	memcpy(uc->pack.buffer, buffer, size);
+}
 
-	buffer += pack_size;
-	size -= pack_size;
-	if (size > 0) {
-		push_more(L, fd, buffer, size);
+// returns 0 if succ, or 1 if the frame is invalid
+static int
+push_more(lua_State *L, const struct frame_header *h, int fd, uint8_t *buffer, int size) {
+	while (size > 0) {
+		int pack_size;
+		int header = frame_header_read(h, buffer, size, &pack_size);
+		if (header == FRAME_INVALID)
+			return 1;
+		if (header == FRAME_MORE) {
+			save_header(L, fd, buffer, size);
+			return 0;
+		}
+		buffer += header;
+		size -= header;
+		if (size < pack_size) {
+			save_pack(L, fd, buffer, size, pack_size);
+			return 0;
+		}
+		push_data(L, fd, buffer, pack_size, 1);
+		buffer += pack_size;
+		size -= pack_size;
 	}
+	return 0;
 }
 
 static void
@@ -226,17 +307,37 @@ close_uncomplete(lua_State *L, int fd) {
 
 static int
 filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
+	const struct frame_header *h = lua_touserdata(L, lua_upvalueindex(FILTER_HEADER));
 	struct queue *q = lua_touserdata(L,1);
 	struct uncomplete * uc = find_uncomplete(q, fd);
 	if (uc) {
 		// fill uncomplete
+		if (uc->read == -2) {
+			// discard
+			insert_uncomplete(q, uc);
+			return 1;
+		}
 		if (uc->read < 0) {
-			// read size
+			// read header
 			assert(uc->read == -1);
-			int pack_size = *buffer;
-			pack_size |= uc->header << 8 ;
-			++buffer;
-			--size;
+			int n = uc->header_n;
+			int fill = FRAME_HEADER_MAX - n;
+			if (fill > size)
+				fill = size;
+			memcpy(uc->header + n, buffer, fill);
+			int pack_size;
+			int header = frame_header_read(h, uc->header, n + fill, &pack_size);
+			if (header == FRAME_MORE) {
+				uc->header_n += fill;
+				insert_uncomplete(q, uc);
+				return 1;
+			}
+			if (header == FRAME_INVALID) {
+				invalid_frame(L, h, fd, uc);
+				return 1;
+			}
+			buffer += header - n;
+			size -= header - n;
 			uc->pack.size = pack_size;
 			uc->pack.buffer = skynet_malloc(pack_size);
 			uc->read = 0;
@@ -245,9 +346,7 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 		if (size < need) {
 			memcpy(uc->pack.buffer + uc->read, buffer, size);
 			uc->read += size;
-			int h = hash_fd(fd);
-			uc->next = q->hash[h];
-			q->hash[h] = uc;
+			insert_uncomplete(q, uc);
 			return 1;
 		}
 		memcpy(uc->pack.buffer + uc->read, buffer, need);
@@ -264,26 +363,27 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 		// more data
 		push_data(L, fd, uc->pack.buffer, uc->pack.size, 0);
 		skynet_free(uc);
-		push_more(L, fd, buffer, size);
+		if (push_more(L, h, fd, buffer, size)) {
+			invalid_frame(L, h, fd, NULL);
+		}
 		lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
 		return 2;
 	} else {
-		if (size == 1) {
-			struct uncomplete * uc = save_uncomplete(L, fd);
-			uc->read = -1;
-			uc->header = *buffer;
+		int pack_size;
+		int header = frame_header_read(h, buffer, size, &pack_size);
+		if (header == FRAME_MORE) {
+			save_header(L, fd, buffer, size);
+			return 1;
+		}
+		if (header == FRAME_INVALID) {
+			invalid_frame(L, h, fd, NULL);
 			return 1;
 		}
-		int pack_size = read_size(buffer);
-		buffer+=2;
-		size-=2;
+		buffer += header;
+		size -= header;
 
 		if (size < pack_size) {
-			struct uncomplete * uc = save_uncomplete(L, fd);
-			uc->read = size;
-			uc->pack.size = pack_size;
-			uc->pack.buffer = skynet_malloc(pack_size);
-			memcpy(uc->pack.buffer, buffer, size);
+			save_pack(L, fd, buffer, size, pack_size);
 			return 1;
 		}
 		if (size == pack_size) {
@@ -300,7 +400,9 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 		push_data(L, fd, buffer, pack_size, 1);
 		buffer += pack_size;
 		size -= pack_size;
-		push_more(L, fd, buffer, size);
+		if (push_more(L, h, fd, buffer, size)) {
+			invalid_frame(L, h, fd, NULL);
+		}
 		lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
 		return 2;
 	}
@@ -396,15 +498,28 @@ lfilter(lua_State *L) {
 static int
 lpop(lua_State *L) {
 	struct queue * q = lua_touserdata(L, 1);
-	if (q == NULL || q->head == q->tail)
+	if (q == NULL || q->head == NULL)
 		return 0;
-	struct netpack *np = &q->queue[q->head];
-	if (++q->head >= q->cap) {
-		q->head = 0;
+	struct chunk * c = q->head;
+	if (c == q->tail && q->head_idx == q->tail_idx)
+		return 0;
+	struct netpack np = c->pack[q->head_idx];
+	if (++q->head_idx == CHUNKSIZE) {
+		// c is not tail, because tail_idx < CHUNKSIZE if head_idx < tail_idx
+		q->head = c->next;
+		q->head_idx = 0;
+		if (q->head == NULL) {
+			q->tail = NULL;
+		}
+		if (q->freechunk == NULL) {
+			q->freechunk = c;
+		} else {
+			skynet_free(c);
+		}
 	}
-	lua_pushinteger(L, np->id);
-	lua_pushlightuserdata(L, np->buffer);
-	lua_pushinteger(L, np->size);
+	lua_pushinteger(L, np.id);
+	lua_pushlightuserdata(L, np.buffer);
+	lua_pushinteger(L, np.size);
 
 	return 3;
 }
@@ -427,26 +542,22 @@ tolstring(lua_State *L, size_t *sz, int index) {
 	return ptr;
 }
 
-static inline void
-write_size(uint8_t * buffer, int len) {
-	buffer[0] = (len >> 8) & 0xff;
-	buffer[1] = len & 0xff;
-}
-
 static int
 lpack(lua_State *L) {
+	const struct frame_header *h = lua_touserdata(L, lua_upvalueindex(1));
 	size_t len;
 	const char * ptr = tolstring(L, &len, 1);
-	if (len >= 0x10000) {
+	if (len > (size_t)h->max) {
 		return luaL_error(L, "Invalid size (too long) of data : %d", (int)len);
 	}
 
-	uint8_t * buffer = skynet_malloc(len + 2);
-	write_size(buffer, len);
-	memcpy(buffer+2, ptr, len);
+	int header = frame_header_size(h, (int)len);
+	uint8_t * buffer = skynet_malloc(len + header);
+	frame_header_write(h, buffer, (int)len);
+	memcpy(buffer+header, ptr, len);
 
 	lua_pushlightuserdata(L, buffer);
-	lua_pushinteger(L, len + 2);
+	lua_pushinteger(L, len + header);
 
 	return 2;
 }
@@ -464,6 +575,52 @@ ltostring(lua_State *L) {
 	return 1;
 }
 
+/*
+	lightuserdata msg
+	integer size
+	return strings
+
+	Split the message from gate of batch mode (a sequence of frames with headers).
+ */
+static int
+lframes(lua_State *L) {
+	const struct frame_header *h = lua_touserdata(L, lua_upvalueindex(1));
+	const uint8_t * ptr = lua_touserdata(L, 1);
+	int size = luaL_checkinteger(L, 2);
+	int n = 0;
+	int offset = 0;
+	while (offset < size) {
+		int len;
+		int header = frame_header_read(h, ptr + offset, size - offset, &len);
+		if (header <= 0 || len > size - offset - header) {
+			return luaL_error(L, "Invalid frame at %d", offset);
+		}
+		offset += header;
+		if (len > 0) {
+			luaL_checkstack(L, 1, NULL);
+			lua_pushlstring(L, (const char *)ptr + offset, len);
+			++n;
+		}
+		offset += len;
+	}
+	return n;
+}
+
+/*
+	string spec (see frameheader.h)
+
+	Set the frame header for filter/pack/frames of this service.
+ */
+static int
+lheader(lua_State *L) {
+	struct frame_header *h = lua_touserdata(L, lua_upvalueindex(1));
+	const char * spec = luaL_checkstring(L, 1);
+	if (frame_header_parse(h, spec)) {
+		return luaL_error(L, "Invalid frame header : %s", spec);
+	}
+	return 0;
+}
+
 LUAMOD_API int
 luaopen_skynet_netpack(lua_State *L) {
 	luaL_checkversion(L);
@@ -472,9 +629,15 @@ luaopen_skynet_netpack(lua_State *L) {
 		{ "pack", lpack },
 		{ "clear", lclear },
 		{ "tostring", ltostring },
+		{ "frames", lframes },
+		{ "header", lheader },
 		{ NULL, NULL },
 	};
-	luaL_newlib(L,l);
+	struct frame_header * h = lua_newuserdata(L, sizeof(*h));
+	frame_header_init(h);
+	luaL_newlibtable(L,l);
+	lua_pushvalue(L, -2);
+	luaL_setfuncs(L,l,1);
 
 	// the order is same with macros : TYPE_* (defined top)
 	lua_pushliteral(L, "data");
@@ -483,8 +646,9 @@ luaopen_skynet_netpack(lua_State *L) {
 	lua_pushliteral(L, "open");
 	lua_pushliteral(L, "close");
 	lua_pushliteral(L, "warning");
+	lua_pushvalue(L, -8);	// frame header
 
-	lua_pushcclosure(L, lfilter, 6);
+	lua_pushcclosure(L, lfilter, FILTER_HEADER);
 	lua_setfield(L, -2, "filter");
 
 	return 1;
@@ -30,81 +30,89 @@
 // hibits 0~31 : len
 #define TYPE_LONG_STRING 5
 #define TYPE_TABLE 6
+#define TYPE_EXTEND 7
+// hibits 0 : table with hash size hint, BYTE hint (hash size is 1 << (hint-1), 0 is none) and then TYPE_TABLE
+// hibits 1~30 : reference of short string (index 0~29), 31 : BYTE index follows
+#define EXTEND_TABLE 0
+#define EXTEND_STRING_REF 1
+#define EXTEND_STRING_REF_LONG 31
 
 #define MAX_COOKIE 32
 #define COMBINE_TYPE(t,v) ((t) | (v) << 3)
 
-#define BLOCK_SIZE 128
+#define WRITE_BUFFER_SIZE 128
 #define MAX_DEPTH 32
-
-struct block {
-	struct block * next;
-	char buffer[BLOCK_SIZE];
+// The short strings (2 <= len < MAX_COOKIE) get an index in order of their first occurrence in a message,
+// and the later ones are written as references. Such strings are interned by lua, so the pointer is the identity.
+#define MAX_STRING_REF 256
+#define STRING_REF_LINEAR 8	// search the first ones linearly, and then build the map
+#define STRING_MAP_SIZE 512	// power of 2, larger than MAX_STRING_REF
+
+struct string_map {
+	const char * key[STRING_MAP_SIZE];
+	uint8_t index[STRING_MAP_SIZE];
 };
 
 struct write_block {
-	struct block * head;
-	struct block * current;
+	char * buffer;	// handed off to the caller of luaseri_pack
+	int len;
+	int cap;
+	int compat;	// the old encoding, without TYPE_EXTEND
+	int nref;
+	int noref;	// the strings (from __pairs) may be temporary, don't reference them
+	const char * ref[STRING_REF_LINEAR];
+	struct string_map * map;
+};
+
+struct string_ref {
+	const char * str;
 	int len;
-	int ptr;
 };
 
 struct read_block {
 	char * buffer;
 	int len;
 	int ptr;
+	int nref;
+	struct string_ref ref[MAX_STRING_REF];
 };
 
-inline static struct block *
-blk_alloc(void) {
-	struct block *b = skynet_malloc(sizeof(struct block));
-	b->next = NULL;
-	return b;
+static void
+wb_expand(struct write_block *b, int sz) {
+	int cap = b->cap * 2;
+	while (cap < b->len + sz) {
+		cap *= 2;
+	}
+	b->buffer = skynet_realloc(b->buffer, cap);
+	b->cap = cap;
 }
 
 inline static void
 wb_push(struct write_block *b, const void *buf, int sz) {
-	const char * buffer = buf;
-	if (b->ptr == BLOCK_SIZE) {
-_again:
-		b->current = b->current->next = blk_alloc();
-		b->ptr = 0;
-	}
-	if (b->ptr <= BLOCK_SIZE - sz) {
-		memcpy(b->current->buffer + b->ptr, buffer, sz);
-		b->ptr+=sz;
-		b->len+=sz;
-	} else {
-		int copy = BLOCK_SIZE - b->ptr;
-		memcpy(b->current->buffer + b->ptr, buffer, copy);
-		buffer += copy;
-		b->len += copy;
-		sz -= copy;
-		goto _again;
+	if (b->len + sz > b->cap) {
+		wb_expand(b, sz);
 	}
+	memcpy(b->buffer + b->len, buf, sz);
+	b->len += sz;
 }
 
 static void
-wb_init(struct write_block *wb , struct block *b) {
-	wb->head = b;
-	assert(b->next == NULL);
+wb_init(struct write_block *wb, int compat) {
+	wb->buffer = skynet_malloc(WRITE_BUFFER_SIZE);
 	wb->len = 0;
-	wb->current = wb->head;
-	wb->ptr = 0;
+	wb->cap = WRITE_BUFFER_SIZE;
+	wb->compat = compat;
+	wb->nref = 0;
+	wb->noref = 0;
+	wb->map = NULL;
 }
 
 static void
 wb_free(struct write_block *wb) {
-	struct block *blk = wb->head;
-	blk = blk->next;	// the first block is on stack
-	while (blk) {
-		struct block * next = blk->next;
-		skynet_free(blk);
-		blk = next;
-	}
-	wb->head = NULL;
-	wb->current = NULL;
-	wb->ptr = 0;
+	skynet_free(wb->buffer);
+	skynet_free(wb->map);
+	wb->buffer = NULL;
+	wb->map = NULL;
 	wb->len = 0;
 }
 
@@ -113,6 +121,7 @@ rball_init(struct read_block * rb, char * buffer, int size) {
 	rb->buffer = buffer;
 	rb->len = size;
 	rb->ptr = 0;
+	rb->nref = 0;
 }
 
 static void *
@@ -187,9 +196,79 @@ wb_pointer(struct write_block *wb, void *v) {
 	wb_push(wb, &v, sizeof(v));
 }
 
+static inline uint32_t
+string_map_slot(const char *str) {
+	uintptr_t h = (uintptr_t)str;
+	return (uint32_t)((h >> 3) ^ (h >> 12)) & (STRING_MAP_SIZE - 1);
+}
+
+static void
+string_map_insert(struct string_map *m, const char *str, int index) {
+	uint32_t slot = string_map_slot(str);
+	while (m->key[slot]) {
+		slot = (slot + 1) & (STRING_MAP_SIZE - 1);
+	}
+	m->key[slot] = str;
+	m->index[slot] = (uint8_t)index;
+}
+
+// returns the index of the short string, or -1 if it's the first occurrence (and it gets a new index)
+static int
+wb_string_ref(struct write_block *wb, const char *str) {
+	if (wb->map) {
+		uint32_t slot = string_map_slot(str);
+		while (wb->map->key[slot]) {
+			if (wb->map->key[slot] == str)
+				return wb->map->index[slot];
+			slot = (slot + 1) & (STRING_MAP_SIZE - 1);
+		}
+	} else {
+		int i;
+		int n = wb->nref < STRING_REF_LINEAR ? wb->nref : STRING_REF_LINEAR;
+		for (i=0;i<n;i++) {
+			if (wb->ref[i] == str)
+				return i;
+		}
+	}
+	if (wb->nref >= MAX_STRING_REF)
+		return -1;
+	int index = wb->nref++;
+	if (wb->noref)
+		str = NULL;
+	if (index < STRING_REF_LINEAR) {
+		wb->ref[index] = str;
+	} else {
+		if (wb->map == NULL) {
+			wb->map = skynet_malloc(sizeof(struct string_map));
+			memset(wb->map->key, 0, sizeof(wb->map->key));
+			int i;
+			for (i=0;i<STRING_REF_LINEAR;i++) {
+				if (wb->ref[i])
+					string_map_insert(wb->map, wb->ref[i], i);
+			}
+		}
+		if (str)
+			string_map_insert(wb->map, str, index);
+	}
+	return -1;
+}
+
 static inline void
 wb_string(struct write_block *wb, const char *str, int len) {
 	if (len < MAX_COOKIE) {
+		if (len >= 2 && !wb->compat) {
+			int index = wb_string_ref(wb, str);
+			if (index >= 0) {
+				if (index < EXTEND_STRING_REF_LONG - EXTEND_STRING_REF) {
+					uint8_t n = COMBINE_TYPE(TYPE_EXTEND, EXTEND_STRING_REF + index);
+					wb_push(wb, &n, 1);
+				} else {
+					uint8_t n[2] = { COMBINE_TYPE(TYPE_EXTEND, EXTEND_STRING_REF_LONG), (uint8_t)index };
+					wb_push(wb, n, 2);
+				}
+				return;
+			}
+		}
 		uint8_t n = COMBINE_TYPE(TYPE_SHORT_STRING, len);
 		wb_push(wb, &n, 1);
 		if (len > 0) {
@@ -214,9 +293,32 @@ wb_string(struct write_block *wb, const char *str, int len) {
 
 static void pack_one(lua_State *L, struct write_block *b, int index, int depth);
 
+// Is there any key after the array part ? lua_next from the last array key is O(1) for a plain list.
+// It may miss the keys when the array is in the hash part of lua table, then the table is written without the hint.
+static int
+has_hash(lua_State *L, int index, int array_size) {
+	if (array_size > 0) {
+		lua_pushinteger(L, array_size);
+	} else {
+		lua_pushnil(L);
+	}
+	if (lua_next(L, index) == 0)
+		return 0;
+	lua_pop(L, 2);
+	return 1;
+}
+
+// *hint is the position of the hash size hint, or -1 if there is no hint
 static int
-wb_table_array(lua_State *L, struct write_block * wb, int index, int depth) {
+wb_table_array(lua_State *L, struct write_block * wb, int index, int depth, int *hint) {
 	int array_size = lua_rawlen(L,index);
+	*hint = -1;
+	if (!wb->compat && has_hash(L, index, array_size)) {
+		// reserve the hash size hint, see wb_table_hash
+		uint8_t n[2] = { COMBINE_TYPE(TYPE_EXTEND, EXTEND_TABLE), 0 };
+		*hint = wb->len + 1;
+		wb_push(wb, n, 2);
+	}
 	if (array_size >= MAX_COOKIE-1) {
 		uint8_t n = COMBINE_TYPE(TYPE_TABLE, MAX_COOKIE-1);
 		wb_push(wb, &n, 1);
@@ -237,7 +339,8 @@ wb_table_array(lua_State *L, struct write_block * wb, int index, int depth) {
 }
 
 static void
-wb_table_hash(lua_State *L, struct write_block * wb, int index, int depth, int array_size) {
+wb_table_hash(lua_State *L, struct write_block * wb, int index, int depth, int array_size, int hint) {
+	int hash_size = 0;
 	lua_pushnil(L);
 	while (lua_next(L, index) != 0) {
 		if (lua_type(L,-2) == LUA_TNUMBER) {
@@ -252,14 +355,25 @@ wb_table_hash(lua_State *L, struct write_block * wb, int index, int depth, int a
 		pack_one(L,wb,-2,depth);
 		pack_one(L,wb,-1,depth);
 		lua_pop(L, 1);
+		++hash_size;
 	}
 	wb_nil(wb);
+	if (hint >= 0 && hash_size > 0) {
+		// ceil(log2(hash_size)) + 1, keep 0 (none) if the keys are all in the array
+		uint8_t n = 1;
+		while ((1 << (n-1)) < hash_size && n < 31) {
+			++n;
+		}
+		wb->buffer[hint] = n;
+	}
 }
 
 static void
 wb_table_metapairs(lua_State *L, struct write_block *wb, int index, int depth) {
 	uint8_t n = COMBINE_TYPE(TYPE_TABLE, 0);
 	wb_push(wb, &n, 1);
+	int noref = wb->noref;
+	wb->noref = 1;
 	lua_pushvalue(L, index);
 	lua_call(L, 1, 3);
 	for(;;) {
@@ -277,6 +391,7 @@ wb_table_metapairs(lua_State *L, struct write_block *wb, int index, int depth) {
 		lua_pop(L, 1);
 	}
 	wb_nil(wb);
+	wb->noref = noref;
 }
 
 static void
@@ -288,8 +403,9 @@ wb_table(lua_State *L, struct write_block *wb, int index, int depth) {
 	if (luaL_getmetafield(L, index, "__pairs") != LUA_TNIL) {
 		wb_table_metapairs(L, wb, index, depth);
 	} else {
-		int array_size = wb_table_array(L, wb, index, depth);
-		wb_table_hash(L, wb, index, depth, array_size);
+		int hint;
+		int array_size = wb_table_array(L, wb, index, depth, &hint);
+		wb_table_hash(L, wb, index, depth, array_size, hint);
 	}
 }
 
@@ -432,7 +548,7 @@ get_buffer(lua_State *L, struct read_block *rb, int len) {
 static void unpack_one(lua_State *L, struct read_block *rb);
 
 static void
-unpack_table(lua_State *L, struct read_block *rb, int array_size) {
+unpack_table(lua_State *L, struct read_block *rb, int array_size, int hash_size) {
 	if (array_size == MAX_COOKIE-1) {
 		uint8_t type;
 		uint8_t *t = rb_read(rb, sizeof(type));
@@ -447,7 +563,7 @@ unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 		array_size = get_integer(L,rb,cookie);
 	}
 	luaL_checkstack(L,LUA_MINSTACK,NULL);
-	lua_createtable(L,array_size,0);
+	lua_createtable(L,array_size,hash_size);
 	int i;
 	for (i=1;i<=array_size;i++) {
 		unpack_one(L,rb);
@@ -464,6 +580,35 @@ unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 	}
 }
 
+static void
+push_extend(lua_State *L, struct read_block *rb, int cookie) {
+	if (cookie == EXTEND_TABLE) {
+		uint8_t *t = rb_read(rb, 2);
+		if (t == NULL || t[0] >= 32 || (t[1] & 7) != TYPE_TABLE) {
+			invalid_stream(L,rb);
+		}
+		int hash_size = t[0] ? 1 << (t[0]-1) : 0;
+		// each key-value pair needs 2 bytes at least
+		if (hash_size > rb->len / 2) {
+			hash_size = rb->len / 2;
+		}
+		unpack_table(L,rb,t[1]>>3,hash_size);
+		return;
+	}
+	int index = cookie - EXTEND_STRING_REF;
+	if (cookie == EXTEND_STRING_REF_LONG) {
+		uint8_t *t = rb_read(rb, 1);
+		if (t == NULL) {
+			invalid_stream(L,rb);
+		}
+		index = *t;
+	}
+	if (index >= rb->nref) {
+		invalid_stream(L,rb);
+	}
+	lua_pushlstring(L, rb->ref[index].str, rb->ref[index].len);
+}
+
 static void
 push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 	switch(type) {
@@ -484,6 +629,11 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		lua_pushlightuserdata(L,get_pointer(L,rb));
 		break;
 	case TYPE_SHORT_STRING:
+		if (cookie >= 2 && rb->nref < MAX_STRING_REF) {
+			struct string_ref *r = &rb->ref[rb->nref++];
+			r->str = rb->buffer + rb->ptr;
+			r->len = cookie;
+		}
 		get_buffer(L,rb,cookie);
 		break;
 	case TYPE_LONG_STRING: {
@@ -510,9 +660,12 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		break;
 	}
 	case TYPE_TABLE: {
-		unpack_table(L,rb,cookie);
+		unpack_table(L,rb,cookie,0);
 		break;
 	}
+	case TYPE_EXTEND:
+		push_extend(L,rb,cookie);
+		break;
 	default: {
 		invalid_stream(L,rb);
 		break;
@@ -531,27 +684,6 @@ unpack_one(lua_State *L, struct read_block *rb) {
 	push_value(L, rb, type & 0x7, type>>3);
 }
 
-static void
-seri(lua_State *L, struct block *b, int len) {
-	uint8_t * buffer = skynet_malloc(len);
-	uint8_t * ptr = buffer;
-	int sz = len;
-	while(len>0) {
-		if (len >= BLOCK_SIZE) {
-			memcpy(ptr, b->buffer, BLOCK_SIZE);
-			ptr += BLOCK_SIZE;
-			len -= BLOCK_SIZE;
-			b = b->next;
-		} else {
-			memcpy(ptr, b->buffer, len);
-			break;
-		}
-	}
-	
-	lua_pushlightuserdata(L, buffer);
-	lua_pushinteger(L, sz);
-}
-
 int
 luaseri_unpack(lua_State *L) {
 	if (lua_isnoneornil(L,1)) {
@@ -596,17 +728,28 @@ luaseri_unpack(lua_State *L) {
 	return lua_gettop(L) - 1;
 }
 
-LUAMOD_API int
-luaseri_pack(lua_State *L) {
-	struct block temp;
-	temp.next = NULL;
+static int
+pack(lua_State *L, int compat) {
 	struct write_block wb;
-	wb_init(&wb, &temp);
+	wb_init(&wb, compat);
 	pack_from(L,&wb,0);
-	assert(wb.head == &temp);
-	seri(L, &temp, wb.len);
-
+	// hand off the buffer
+	lua_pushlightuserdata(L, wb.buffer);
+	lua_pushinteger(L, wb.len);
+	wb.buffer = NULL;
 	wb_free(&wb);
 
 	return 2;
 }
+
+// the old encoding (without TYPE_EXTEND), which all the versions can unpack
+LUAMOD_API int
+luaseri_pack(lua_State *L) {
+	return pack(L, 1);
+}
+
+// with table hash size hints and string references (TYPE_EXTEND), only the new version can unpack
+LUAMOD_API int
+luaseri_pack_fast(lua_State *L) {
+	return pack(L, 0);
+}
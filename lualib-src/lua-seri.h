@@ -4,6 +4,7 @@
 #include <lua.h>
 
 int luaseri_pack(lua_State *L);
+int luaseri_pack_fast(lua_State *L);
 int luaseri_unpack(lua_State *L);
 
 #endif
@@ -0,0 +1,656 @@
+#define LUA_LIB
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "skynet_malloc.h"
+#include "atomic.h"
+
+/*
+	An immutable table packed in one refcounted buffer, it's delivered to the local services by pointer
+	(like mc_package of multicast), and read through the proxies (like sharedata) which decode a field on access.
+
+	value :
+		BYTE VALUE_NIL / VALUE_FALSE / VALUE_TRUE
+		BYTE VALUE_INTEGER	lua_Integer
+		BYTE VALUE_REAL	lua_Number
+		BYTE VALUE_STRING	DWORD len	bytes
+		BYTE VALUE_STRINGREF	DWORD offset	; the same string packed before
+		BYTE VALUE_TABLE	DWORD sizearray	DWORD sizehash	DWORD array[sizearray]	DWORD hash[sizehash]	values and entries
+	The array and hash are the offsets of the values and the entries (0 is empty slot), the offset 0 is the root table.
+	entry : key (VALUE_INTEGER, VALUE_STRING or VALUE_STRINGREF) and value, the entries are found by open addressing (sizehash is power of 2).
+ */
+
+#define VALUE_NIL 0
+#define VALUE_FALSE 1
+#define VALUE_TRUE 2
+#define VALUE_INTEGER 3
+#define VALUE_REAL 4
+#define VALUE_STRING 5
+#define VALUE_TABLE 6
+#define VALUE_STRINGREF 7
+
+#define TABLE_HEADER 9
+#define MAX_DEPTH 32
+#define WRITE_BUFFER_SIZE 1024
+
+#define SHAREDPACK "SHAREDPACK"
+
+struct sp_object {
+	int reference;
+	uint32_t size;
+	uint8_t data[1];
+};
+
+struct sp_proxy {
+	struct sp_object * obj;
+	uint32_t offset;	// the table
+};
+
+struct sp_writer {
+	uint8_t * buffer;
+	uint32_t len;
+	uint32_t cap;
+	int strings;	// index of the table : string -> offset
+};
+
+static inline uint32_t
+read_uint32(const uint8_t * p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline void
+write_uint32(uint8_t * p, uint32_t v) {
+	memcpy(p, &v, sizeof(v));
+}
+
+// the same as lua-sharedata.c
+static uint32_t
+hash_string(const char * str, size_t l) {
+	uint32_t h = (uint32_t)l;
+	size_t l1;
+	size_t step = (l >> 5) + 1;
+	for (l1 = l; l1 >= step; l1 -= step) {
+		h = h ^ ((h<<5) + (h>>2) + (uint8_t)(str[l1 - 1]));
+	}
+	return h;
+}
+
+static uint32_t
+hash_integer(lua_Integer key) {
+	uint64_t x = (uint64_t)key;
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return (uint32_t)x;
+}
+
+// writer
+
+static void
+writer_error(lua_State *L, struct sp_writer *w, const char * msg) {
+	skynet_free(w->buffer);
+	w->buffer = NULL;
+	luaL_error(L, "%s", msg);
+}
+
+// returns the offset of sz bytes reserved
+static uint32_t
+writer_reserve(lua_State *L, struct sp_writer *w, size_t sz) {
+	if (w->len + sz > 0x7fffffff) {
+		writer_error(L, w, "sharedpack object is too large");
+	}
+	uint32_t offset = w->len;
+	if (w->len + sz > w->cap) {
+		uint32_t cap = w->cap * 2;
+		while (cap < w->len + sz) {
+			cap *= 2;
+		}
+		w->buffer = skynet_realloc(w->buffer, cap);
+		w->cap = cap;
+	}
+	w->len += (uint32_t)sz;
+	return offset;
+}
+
+static void
+write_tag(lua_State *L, struct sp_writer *w, uint8_t tag, const void * data, size_t sz) {
+	uint32_t offset = writer_reserve(L, w, 1 + sz);
+	w->buffer[offset] = tag;
+	if (sz > 0) {
+		memcpy(w->buffer + offset + 1, data, sz);
+	}
+}
+
+// the string at index, the same strings (keys of the records, for example) are packed once
+static void
+write_string(lua_State *L, struct sp_writer *w, int index) {
+	size_t sz;
+	const char * str = lua_tolstring(L, index, &sz);
+	if (sz > 0x7fffffff) {
+		writer_error(L, w, "string is too long");
+	}
+	lua_pushvalue(L, index);
+	if (lua_rawget(L, w->strings) == LUA_TNUMBER) {
+		uint32_t ref = (uint32_t)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		uint32_t offset = writer_reserve(L, w, 5);
+		w->buffer[offset] = VALUE_STRINGREF;
+		write_uint32(w->buffer + offset + 1, ref);
+		return;
+	}
+	lua_pop(L, 1);
+	uint32_t offset = writer_reserve(L, w, 5 + sz);
+	w->buffer[offset] = VALUE_STRING;
+	write_uint32(w->buffer + offset + 1, (uint32_t)sz);
+	memcpy(w->buffer + offset + 5, str, sz);
+	if (sz > 4) {
+		lua_pushvalue(L, index);
+		lua_pushinteger(L, offset);
+		lua_rawset(L, w->strings);
+	}
+}
+
+static void write_table(lua_State *L, struct sp_writer *w, int index, int depth);
+
+static void
+write_value(lua_State *L, struct sp_writer *w, int index, int depth) {
+	switch (lua_type(L, index)) {
+	case LUA_TNIL:
+		write_tag(L, w, VALUE_NIL, NULL, 0);
+		break;
+	case LUA_TBOOLEAN:
+		write_tag(L, w, lua_toboolean(L, index) ? VALUE_TRUE : VALUE_FALSE, NULL, 0);
+		break;
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, index)) {
+			lua_Integer v = lua_tointeger(L, index);
+			write_tag(L, w, VALUE_INTEGER, &v, sizeof(v));
+		} else {
+			lua_Number v = lua_tonumber(L, index);
+			write_tag(L, w, VALUE_REAL, &v, sizeof(v));
+		}
+		break;
+	case LUA_TSTRING:
+		write_string(L, w, index);
+		break;
+	case LUA_TTABLE:
+		write_table(L, w, index, depth + 1);
+		break;
+	default:
+		writer_error(L, w, "sharedpack only supports nil, boolean, number, string and table");
+	}
+}
+
+// returns 1 if the key is in the hash part
+static int
+hash_key(lua_State *L, struct sp_writer *w, int index, lua_Integer sizearray) {
+	int t = lua_type(L, index);
+	if (t == LUA_TNUMBER) {
+		if (!lua_isinteger(L, index)) {
+			writer_error(L, w, "sharedpack key should be integer or string");
+		}
+		lua_Integer k = lua_tointeger(L, index);
+		return k <= 0 || k > sizearray;
+	}
+	if (t != LUA_TSTRING) {
+		writer_error(L, w, "sharedpack key should be integer or string");
+	}
+	return 1;
+}
+
+static void
+insert_entry(struct sp_writer *w, uint32_t table, uint32_t sizearray, uint32_t sizehash, uint32_t hash, uint32_t entry) {
+	uint32_t slots = table + TABLE_HEADER + sizearray * 4;
+	uint32_t mask = sizehash - 1;
+	uint32_t slot = hash & mask;
+	while (read_uint32(w->buffer + slots + slot * 4)) {
+		slot = (slot + 1) & mask;
+	}
+	write_uint32(w->buffer + slots + slot * 4, entry);
+}
+
+static void
+write_table(lua_State *L, struct sp_writer *w, int index, int depth) {
+	if (depth > MAX_DEPTH) {
+		writer_error(L, w, "sharedpack can't pack too depth table");
+	}
+	luaL_checkstack(L, LUA_MINSTACK, NULL);
+	if (index < 0) {
+		index = lua_gettop(L) + index + 1;
+	}
+	lua_Integer sizearray = lua_rawlen(L, index);
+	uint32_t count = 0;
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		lua_pop(L, 1);
+		count += hash_key(L, w, -1, sizearray);
+	}
+	uint32_t sizehash = 0;
+	if (count > 0) {
+		// load factor <= 0.75
+		sizehash = 2;
+		while (sizehash * 3 < count * 4) {
+			sizehash *= 2;
+		}
+	}
+	size_t header = TABLE_HEADER + ((size_t)sizearray + sizehash) * 4;
+	uint32_t table = writer_reserve(L, w, header);
+	w->buffer[table] = VALUE_TABLE;
+	write_uint32(w->buffer + table + 1, (uint32_t)sizearray);
+	write_uint32(w->buffer + table + 5, sizehash);
+	memset(w->buffer + table + TABLE_HEADER + sizearray * 4, 0, sizehash * 4);
+
+	lua_Integer i;
+	for (i=1;i<=sizearray;i++) {
+		write_uint32(w->buffer + table + TABLE_HEADER + (i-1) * 4, w->len);
+		lua_rawgeti(L, index, i);
+		write_value(L, w, -1, depth);
+		lua_pop(L, 1);
+	}
+	if (count == 0)
+		return;
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		if (hash_key(L, w, -2, sizearray)) {
+			uint32_t entry = w->len;
+			uint32_t hash;
+			if (lua_type(L, -2) == LUA_TNUMBER) {
+				lua_Integer k = lua_tointeger(L, -2);
+				write_tag(L, w, VALUE_INTEGER, &k, sizeof(k));
+				hash = hash_integer(k);
+			} else {
+				size_t sz;
+				const char * str = lua_tolstring(L, -2, &sz);
+				write_string(L, w, lua_gettop(L) - 1);
+				hash = hash_string(str, sz);
+			}
+			write_value(L, w, -1, depth);
+			insert_entry(w, table, (uint32_t)sizearray, sizehash, hash, entry);
+		}
+		lua_pop(L, 1);
+	}
+}
+
+// reader
+
+static struct sp_proxy *
+new_proxy(lua_State *L, struct sp_object *obj, uint32_t offset) {
+	struct sp_proxy * p = lua_newuserdata(L, sizeof(*p));
+	p->obj = obj;
+	p->offset = offset;
+	luaL_setmetatable(L, SHAREDPACK);
+	return p;
+}
+
+// the string (VALUE_STRING or VALUE_STRINGREF) at offset, returns the bytes of the encoded string
+static uint32_t
+read_string(const uint8_t * data, uint32_t offset, const char ** str, uint32_t *sz) {
+	const uint8_t * s = data + offset;
+	if (s[0] == VALUE_STRINGREF) {
+		read_string(data, read_uint32(s + 1), str, sz);
+		return 5;
+	}
+	*sz = read_uint32(s + 1);
+	*str = (const char *)s + 5;
+	return 5 + *sz;
+}
+
+// returns the offset of the value of key (at index), or 0 if not found. *pslot is the hash slot of the entry
+static uint32_t
+lookup(lua_State *L, struct sp_proxy *p, int index, uint32_t *pslot) {
+	const uint8_t * data = p->obj->data;
+	const uint8_t * tbl = data + p->offset;
+	uint32_t sizearray = read_uint32(tbl + 1);
+	uint32_t sizehash = read_uint32(tbl + 5);
+	lua_Integer ikey = 0;
+	const char * skey = NULL;
+	size_t sz = 0;
+	uint32_t hash;
+	switch (lua_type(L, index)) {
+	case LUA_TNUMBER: {
+		int isnum;
+		ikey = lua_tointegerx(L, index, &isnum);
+		if (!isnum)
+			return 0;
+		if (ikey > 0 && ikey <= sizearray) {
+			return read_uint32(tbl + TABLE_HEADER + (ikey-1) * 4);
+		}
+		hash = hash_integer(ikey);
+		break;
+	}
+	case LUA_TSTRING:
+		skey = lua_tolstring(L, index, &sz);
+		hash = hash_string(skey, sz);
+		break;
+	default:
+		return 0;
+	}
+	if (sizehash == 0)
+		return 0;
+	const uint8_t * slots = tbl + TABLE_HEADER + sizearray * 4;
+	uint32_t mask = sizehash - 1;
+	uint32_t slot = hash & mask;
+	uint32_t entry;
+	while ((entry = read_uint32(slots + slot * 4))) {
+		const uint8_t * k = data + entry;
+		if (skey) {
+			if (k[0] != VALUE_INTEGER) {
+				const char * str;
+				uint32_t len;
+				uint32_t ksz = read_string(data, entry, &str, &len);
+				if (len == sz && memcmp(str, skey, sz) == 0) {
+					*pslot = slot;
+					return entry + ksz;
+				}
+			}
+		} else if (k[0] == VALUE_INTEGER) {
+			lua_Integer v;
+			memcpy(&v, k + 1, sizeof(v));
+			if (v == ikey) {
+				*pslot = slot;
+				return entry + 1 + sizeof(v);
+			}
+		}
+		slot = (slot + 1) & mask;
+	}
+	return 0;
+}
+
+// push the value at offset, returns 1 if it should be cached (string or table)
+static int
+push_value(lua_State *L, struct sp_object *obj, uint32_t offset) {
+	const uint8_t * v = obj->data + offset;
+	switch (v[0]) {
+	case VALUE_FALSE:
+		lua_pushboolean(L, 0);
+		return 0;
+	case VALUE_TRUE:
+		lua_pushboolean(L, 1);
+		return 0;
+	case VALUE_INTEGER: {
+		lua_Integer n;
+		memcpy(&n, v + 1, sizeof(n));
+		lua_pushinteger(L, n);
+		return 0;
+	}
+	case VALUE_REAL: {
+		lua_Number n;
+		memcpy(&n, v + 1, sizeof(n));
+		lua_pushnumber(L, n);
+		return 0;
+	}
+	case VALUE_STRING:
+	case VALUE_STRINGREF: {
+		const char * str;
+		uint32_t sz;
+		read_string(obj->data, offset, &str, &sz);
+		lua_pushlstring(L, str, sz);
+		return 1;
+	}
+	case VALUE_TABLE:
+		ATOM_INC(&obj->reference);
+		new_proxy(L, obj, offset);
+		return 1;
+	default:
+		lua_pushnil(L);
+		return 0;
+	}
+}
+
+// push the field (key at index) of proxy at 1, the strings and tables are cached in the uservalue
+static void
+push_field(lua_State *L, struct sp_proxy *p, int index, uint32_t offset) {
+	if (lua_getuservalue(L, 1) == LUA_TTABLE) {
+		lua_pushvalue(L, index);
+		if (lua_rawget(L, -2) != LUA_TNIL) {
+			lua_replace(L, -2);
+			return;
+		}
+		lua_pop(L, 1);
+	} else {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushvalue(L, -1);
+		lua_setuservalue(L, 1);
+	}
+	// cache table
+	if (offset == 0) {
+		uint32_t slot;
+		offset = lookup(L, p, index, &slot);
+		if (offset == 0) {
+			lua_pop(L, 1);
+			lua_pushnil(L);
+			return;
+		}
+	}
+	if (push_value(L, p->obj, offset)) {
+		lua_pushvalue(L, index);
+		lua_pushvalue(L, -2);
+		lua_rawset(L, -4);
+	}
+	lua_replace(L, -2);
+}
+
+static int
+lindex(lua_State *L) {
+	struct sp_proxy * p = luaL_checkudata(L, 1, SHAREDPACK);
+	push_field(L, p, 2, 0);
+	return 1;
+}
+
+static int
+lnewindex(lua_State *L) {
+	return luaL_error(L, "sharedpack object is read only");
+}
+
+static int
+llen(lua_State *L) {
+	struct sp_proxy * p = luaL_checkudata(L, 1, SHAREDPACK);
+	lua_pushinteger(L, read_uint32(p->obj->data + p->offset + 1));
+	return 1;
+}
+
+/*
+	userdata proxy
+	key
+	return next key, value
+ */
+static int
+lnext(lua_State *L) {
+	struct sp_proxy * p = luaL_checkudata(L, 1, SHAREDPACK);
+	lua_settop(L, 2);
+	const uint8_t * data = p->obj->data;
+	const uint8_t * tbl = data + p->offset;
+	uint32_t sizearray = read_uint32(tbl + 1);
+	uint32_t sizehash = read_uint32(tbl + 5);
+	const uint8_t * slots = tbl + TABLE_HEADER + sizearray * 4;
+	uint32_t i = 0;	// next array index
+	uint32_t slot = 0;	// next hash slot
+	if (!lua_isnil(L, 2)) {
+		int isnum;
+		lua_Integer k = lua_tointegerx(L, 2, &isnum);
+		if (isnum && k > 0 && k <= sizearray) {
+			i = (uint32_t)k;
+		} else {
+			if (lookup(L, p, 2, &slot) == 0) {
+				return luaL_error(L, "Invalid key to 'next'");
+			}
+			i = sizearray;
+			++slot;
+		}
+	}
+	for (; i < sizearray; i++) {
+		uint32_t offset = read_uint32(tbl + TABLE_HEADER + i * 4);
+		if (data[offset] != VALUE_NIL) {
+			lua_pushinteger(L, i + 1);
+			push_field(L, p, 3, offset);
+			return 2;
+		}
+	}
+	for (; slot < sizehash; slot++) {
+		uint32_t entry = read_uint32(slots + slot * 4);
+		if (entry) {
+			const uint8_t * e = data + entry;
+			uint32_t ksz;
+			if (e[0] != VALUE_INTEGER) {
+				const char * str;
+				uint32_t sz;
+				ksz = read_string(data, entry, &str, &sz);
+				lua_pushlstring(L, str, sz);
+			} else {
+				lua_Integer k;
+				memcpy(&k, e + 1, sizeof(k));
+				ksz = 1 + sizeof(k);
+				lua_pushinteger(L, k);
+			}
+			push_field(L, p, 3, entry + ksz);
+			return 2;
+		}
+	}
+	lua_pushnil(L);
+	return 1;
+}
+
+static int
+lpairs(lua_State *L) {
+	luaL_checkudata(L, 1, SHAREDPACK);
+	lua_pushcfunction(L, lnext);
+	lua_pushvalue(L, 1);
+	lua_pushnil(L);
+	return 3;
+}
+
+static void
+release(struct sp_object *obj) {
+	if (ATOM_DEC(&obj->reference) == 0) {
+		skynet_free(obj);
+	}
+}
+
+static int
+lgc(lua_State *L) {
+	struct sp_proxy * p = luaL_checkudata(L, 1, SHAREDPACK);
+	if (p->obj) {
+		release(p->obj);
+		p->obj = NULL;
+	}
+	return 0;
+}
+
+static int
+ltostring(lua_State *L) {
+	struct sp_proxy * p = luaL_checkudata(L, 1, SHAREDPACK);
+	lua_pushfstring(L, "[sharedpack %p:%d]", p->obj, (int)p->offset);
+	return 1;
+}
+
+/*
+	table
+	return userdata proxy of the root
+ */
+static int
+lnew(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	struct sp_writer w;
+	w.buffer = skynet_malloc(WRITE_BUFFER_SIZE);
+	w.cap = WRITE_BUFFER_SIZE;
+	w.len = 0;
+	lua_settop(L, 1);
+	lua_newtable(L);
+	w.strings = 2;
+	write_table(L, &w, 1, 0);
+	struct sp_object * obj = skynet_malloc(sizeof(*obj) + w.len);
+	obj->reference = 1;
+	obj->size = w.len;
+	memcpy(obj->data, w.buffer, w.len);
+	skynet_free(w.buffer);
+	new_proxy(L, obj, 0);
+	return 1;
+}
+
+/*
+	userdata proxy
+	return lightuserdata object (a new reference), integer offset
+ */
+static int
+lshare(lua_State *L) {
+	struct sp_proxy * p = luaL_checkudata(L, 1, SHAREDPACK);
+	ATOM_INC(&p->obj->reference);
+	lua_pushlightuserdata(L, p->obj);
+	lua_pushinteger(L, p->offset);
+	return 2;
+}
+
+/*
+	lightuserdata object (the reference is taken by the proxy)
+	integer offset
+	return userdata proxy
+ */
+static int
+lopen(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	struct sp_object * obj = lua_touserdata(L, 1);
+	lua_Integer offset = luaL_optinteger(L, 2, 0);
+	if (offset < 0 || offset >= obj->size || obj->data[offset] != VALUE_TABLE) {
+		return luaL_error(L, "Invalid sharedpack offset %d", (int)offset);
+	}
+	new_proxy(L, obj, (uint32_t)offset);
+	return 1;
+}
+
+/*
+	lightuserdata object
+	release the reference which is not opened
+ */
+static int
+lrelease(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	release(lua_touserdata(L, 1));
+	return 0;
+}
+
+/*
+	userdata proxy
+	return integer bytes of the object, integer reference
+ */
+static int
+lsize(lua_State *L) {
+	struct sp_proxy * p = luaL_checkudata(L, 1, SHAREDPACK);
+	lua_pushinteger(L, p->obj->size);
+	lua_pushinteger(L, p->obj->reference);
+	return 2;
+}
+
+LUAMOD_API int
+luaopen_skynet_sharedpack_core(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg meta[] = {
+		{ "__index", lindex },
+		{ "__newindex", lnewindex },
+		{ "__len", llen },
+		{ "__pairs", lpairs },
+		{ "__gc", lgc },
+		{ "__tostring", ltostring },
+		{ NULL, NULL },
+	};
+	luaL_newmetatable(L, SHAREDPACK);
+	luaL_setfuncs(L, meta, 0);
+	lua_pop(L, 1);
+
+	luaL_Reg l[] = {
+		{ "new", lnew },
+		{ "share", lshare },
+		{ "open", lopen },
+		{ "release", lrelease },
+		{ "size", lsize },
+		{ "next", lnext },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L, l);
+	return 1;
+}
@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
 struct snlua {
 	lua_State * L;
@@ -346,6 +347,15 @@ lnow(lua_State *L) {
 	return 1;
 }
 
+// monotonic clock in nanosecond, for profiling
+static int
+lhpc(lua_State *L) {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	lua_pushinteger(L, (int64_t)ti.tv_sec * 1000000000 + ti.tv_nsec);
+	return 1;
+}
+
 LUAMOD_API int
 luaopen_skynet_core(lua_State *L) {
 	luaL_checkversion(L);
@@ -360,11 +370,13 @@ luaopen_skynet_core(lua_State *L) {
 		{ "tostring", ltostring },
 		{ "harbor", lharbor },
 		{ "pack", luaseri_pack },
+		{ "packfast", luaseri_pack_fast },
 		{ "unpack", luaseri_unpack },
 		{ "packstring", lpackstring },
 		{ "trash" , ltrash },
 		{ "callback", lcallback },
 		{ "now", lnow },
+		{ "hpc", lhpc },
 		{ NULL, NULL },
 	};
 
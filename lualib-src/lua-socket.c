@@ -680,6 +680,26 @@ ludp_address(lua_State *L) {
 	return 2;
 }
 
+static int
+lstat(lua_State *L) {
+	struct skynet_socket_stat stat;
+	skynet_socket_stat(&stat);
+	lua_createtable(L, 0, 6);
+	lua_pushinteger(L, stat.rbuffer_pool);
+	lua_setfield(L, -2, "rbuffer_pool");
+	lua_pushinteger(L, stat.rbuffer_malloc);
+	lua_setfield(L, -2, "rbuffer_malloc");
+	lua_pushinteger(L, stat.rbuffer_wrapper);
+	lua_setfield(L, -2, "rbuffer_wrapper");
+	lua_pushinteger(L, stat.cputime);
+	lua_setfield(L, -2, "cputime");
+	lua_pushinteger(L, stat.poll_syscall);
+	lua_setfield(L, -2, "poll_syscall");
+	lua_pushboolean(L, stat.uring);
+	lua_setfield(L, -2, "uring");
+	return 1;
+}
+
 LUAMOD_API int
 luaopen_skynet_socketdriver(lua_State *L) {
 	luaL_checkversion(L);
@@ -693,6 +713,7 @@ luaopen_skynet_socketdriver(lua_State *L) {
 		{ "readline", lreadline },
 		{ "str2p", lstr2p },
 		{ "header", lheader },
+		{ "stat", lstat },
 
 		{ "unpack", lunpack },
 		{ NULL, NULL },
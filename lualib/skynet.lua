@@ -122,7 +122,12 @@ local function dispatch_wakeup()
 	if co then
 		local session = sleep_session[co]
 		if session then
-			session_id_coroutine[session] = "BREAK"
+			if c.intcommand("TIMEOUT_CANCEL", session) == 1 then
+				session_id_coroutine[session] = nil
+			else
+				-- timer expired already (or skynet.wait), drop the response later
+				session_id_coroutine[session] = "BREAK"
+			end
 			return suspend(co, coroutine_resume(co, false, "BREAK"))
 		end
 	end
@@ -260,16 +265,35 @@ function suspend(co, result, command, param, size)
 	dispatch_error_queue()
 end
 
-function skynet.timeout(ti, func)
-	local session = c.intcommand("TIMEOUT",ti)
+local function timeout(cmd, ti, func)
+	local session = c.intcommand(cmd,ti)
 	assert(session)
 	local co = co_create(func)
 	assert(session_id_coroutine[session] == nil)
 	session_id_coroutine[session] = co
+	return session
 end
 
-function skynet.sleep(ti)
-	local session = c.intcommand("TIMEOUT",ti)
+function skynet.timeout(ti, func)
+	return timeout("TIMEOUT", ti, func)
+end
+
+-- ti is in millisecond, the precision depends on timer_tick in config
+function skynet.mtimeout(ti, func)
+	return timeout("TIMEOUT_MS", ti, func)
+end
+
+-- cancel the timer created by skynet.timeout, return true if it's canceled before it expires
+function skynet.canceltimeout(session)
+	if session_id_coroutine[session] and c.intcommand("TIMEOUT_CANCEL", session) == 1 then
+		session_id_coroutine[session] = nil
+		return true
+	end
+	return false
+end
+
+local function sleep(cmd, ti)
+	local session = c.intcommand(cmd,ti)
 	assert(session)
 	local succ, ret = coroutine_yield("SLEEP", session)
 	sleep_session[coroutine.running()] = nil
@@ -283,8 +307,16 @@ function skynet.sleep(ti)
 	end
 end
 
+function skynet.sleep(ti)
+	return sleep("TIMEOUT", ti)
+end
+
+function skynet.msleep(ti)
+	return sleep("TIMEOUT_MS", ti)
+end
+
 function skynet.yield()
-	return skynet.sleep(0)
+	return sleep("TIMEOUT", 0)
 end
 
 function skynet.wait(co)
@@ -312,6 +344,7 @@ function skynet.localname(name)
 end
 
 skynet.now = c.now
+skynet.hpc = c.hpc
 
 local starttime
 
@@ -379,6 +412,10 @@ end
 
 skynet.pack = assert(c.pack)
 skynet.packstring = assert(c.packstring)
+skynet.packfast = assert(c.packfast)	-- with the string references and table hints, the old version can't unpack
+if skynet.getenv "packfast" == "true" then
+	skynet.pack = skynet.packfast
+end
 skynet.unpack = assert(c.unpack)
 skynet.tostring = assert(c.tostring)
 skynet.trash = assert(c.trash)
@@ -471,17 +508,31 @@ function skynet.fork(func,...)
 	return co
 end
 
+local function dispatch_response(session, source, msg, sz)
+	local co = session_id_coroutine[session]
+	if co == "BREAK" then
+		session_id_coroutine[session] = nil
+	elseif co == nil then
+		unknown_response(session, source, msg, sz)
+	else
+		session_id_coroutine[session] = nil
+		suspend(co, coroutine_resume(co, true, msg, sz))
+	end
+end
+
 local function raw_dispatch_message(prototype, msg, sz, session, source)
 	-- skynet.PTYPE_RESPONSE = 1, read skynet.h
 	if prototype == 1 then
-		local co = session_id_coroutine[session]
-		if co == "BREAK" then
-			session_id_coroutine[session] = nil
-		elseif co == nil then
-			unknown_response(session, source, msg, sz)
+		if session == 0 and source == 0 then
+			-- expired timers in one tick, msg is an array of sessions. read skynet_timer.h
+			local sessions = c.tostring(msg, sz)
+			local pos = 1
+			while pos <= sz do
+				session, pos = string.unpack("=i", sessions, pos)
+				dispatch_response(session, source, nil, 0)
+			end
 		else
-			session_id_coroutine[session] = nil
-			suspend(co, coroutine_resume(co, true, msg, sz))
+			dispatch_response(session, source, msg, sz)
 		end
 	else
 		local p = proto[prototype]
@@ -2,15 +2,43 @@ local skynet = require "skynet"
 
 local clusterd
 local cluster = {}
+local sender = {}	-- node -> { clustersender }
+
+local function get_sender(node)
+	local s = sender[node]
+	if s == nil then
+		s = skynet.call(clusterd, "lua", "sender", node)
+		sender[node] = s
+	end
+	return s
+end
+
+local function hash_address(address)
+	if type(address) == "number" then
+		return address
+	end
+	local h = #address
+	for i = 1, #address do
+		h = (h * 31 + address:byte(i)) & 0x7fffffff
+	end
+	return h
+end
+
+-- The messages are spread over the channels by address,
+-- the messages to the same address use the same channel to keep the order.
+function cluster.sender(node, address)
+	local s = get_sender(node)
+	return s[hash_address(address) % #s + 1]
+end
 
 function cluster.call(node, address, ...)
 	-- skynet.pack(...) will free by cluster.core.packrequest
-	return skynet.call(clusterd, "lua", "req", node, address, skynet.pack(...))
+	return skynet.call(cluster.sender(node, address), "lua", "req", address, skynet.pack(...))
 end
 
 function cluster.send(node, address, ...)
 	-- push is the same with req, but no response
-	skynet.send(clusterd, "lua", "push", node, address, skynet.pack(...))
+	skynet.send(cluster.sender(node, address), "lua", "push", address, skynet.pack(...))
 end
 
 function cluster.open(port)
@@ -45,7 +73,7 @@ function cluster.register(name, addr)
 end
 
 function cluster.query(node, name)
-	return skynet.call(clusterd, "lua", "req", node, 0, skynet.pack(name))
+	return skynet.call(cluster.sender(node, name), "lua", "req", 0, skynet.pack(name))
 end
 
 skynet.init(function()
@@ -0,0 +1,30 @@
+local core = require "skynet.sharedpack.core"
+
+-- An immutable table packed once and shared by the local services : sharedpack.share returns a reference
+-- (lightuserdata, offset) to send, and the receiver must sharedpack.open (or sharedpack.release) it.
+-- The fields are decoded on access, so a reader only pays for the fields it reads.
+-- The reference can't be sent to a remote node, and it leaks if the receiver never opens it.
+
+local sharedpack = {}
+
+sharedpack.new = core.new	-- table -> proxy
+sharedpack.share = core.share	-- proxy -> ptr, offset (a new reference)
+sharedpack.open = core.open	-- ptr, offset -> proxy (takes the reference)
+sharedpack.release = core.release	-- ptr (drop the reference without opening)
+sharedpack.size = core.size	-- proxy -> bytes, references
+
+local function copy(proxy)
+	local t = {}
+	for k, v in pairs(proxy) do
+		if type(v) == "userdata" then
+			v = copy(v)
+		end
+		t[k] = v
+	end
+	return t
+end
+
+-- returns a lua table (deep copy) of the proxy
+sharedpack.copy = copy
+
+return sharedpack
@@ -37,6 +37,10 @@ function gateserver.start(handler)
 		local port = assert(conf.port)
 		maxclient = conf.maxclient or 1024
 		nodelay = conf.nodelay
+		if conf.header then
+			-- frame header, see service-src/frameheader.h
+			netpack.header(conf.header)
+		end
 		skynet.error(string.format("Listen on %s:%d", address, port))
 		socket = socketdriver.listen(address, port)
 		socketdriver.start(socket)
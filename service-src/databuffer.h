@@ -5,7 +5,11 @@
 #include <string.h>
 #include <assert.h>
 
+#include "frameheader.h"
+
 #define MESSAGEPOOL 1023
+#define DATABUFFER_MORE -1
+#define DATABUFFER_INVALID -2
 
 struct message {
 	char * buffer;
@@ -122,24 +126,45 @@ databuffer_push(struct databuffer *db, struct messagepool *mp, void *data, int s
 	}
 }
 
+// copy at most sz bytes without reading, returns the bytes copied
+static int
+databuffer_peek(struct databuffer *db, void * buffer, int sz) {
+	if (sz > db->size)
+		sz = db->size;
+	int n = 0;
+	int offset = db->offset;
+	struct message *current = db->head;
+	while (n < sz) {
+		int bsz = current->size - offset;
+		if (bsz > sz - n)
+			bsz = sz - n;
+		memcpy((char *)buffer + n, current->buffer + offset, bsz);
+		n += bsz;
+		offset = 0;
+		current = current->next;
+	}
+	return n;
+}
+
+// returns the size of frame, DATABUFFER_MORE or DATABUFFER_INVALID
 static int
-databuffer_readheader(struct databuffer *db, struct messagepool *mp, int header_size) {
+databuffer_readheader(struct databuffer *db, struct messagepool *mp, const struct frame_header *h) {
 	if (db->header == 0) {
-		// parser header (2 or 4)
-		if (db->size < header_size) {
-			return -1;
+		uint8_t plen[FRAME_HEADER_MAX];
+		int n = databuffer_peek(db, plen, FRAME_HEADER_MAX);
+		int size;
+		int header = frame_header_read(h, plen, n, &size);
+		if (header == FRAME_MORE) {
+			return DATABUFFER_MORE;
 		}
-		uint8_t plen[4];
-		databuffer_read(db,mp,(char *)plen,header_size);
-		// big-endian
-		if (header_size == 2) {
-			db->header = plen[0] << 8 | plen[1];
-		} else {
-			db->header = plen[0] << 24 | plen[1] << 16 | plen[2] << 8 | plen[3];
+		if (header == FRAME_INVALID) {
+			return DATABUFFER_INVALID;
 		}
+		databuffer_read(db,mp,(char *)plen,header);
+		db->header = size;
 	}
 	if (db->size < db->header)
-		return -1;
+		return DATABUFFER_MORE;
 	return db->header;
 }
 
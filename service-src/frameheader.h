@@ -0,0 +1,186 @@
+#ifndef skynet_frame_header_h
+#define skynet_frame_header_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The length header of client frames, shared by gate (service_gate.c) and netpack (lua-netpack.c).
+// spec : type[:max]
+//	type : S/be16 (default), L/be32, le16, le32, varint (LEB128)
+//	max : max frame size, default 16M-1 (64K-1 for 16bit header)
+
+#define FRAME_HEADER_MAX 5
+#define FRAME_DEFAULT_MAX 0xffffff
+
+#define FRAME_BE16 0
+#define FRAME_BE32 1
+#define FRAME_LE16 2
+#define FRAME_LE32 3
+#define FRAME_VARINT 4
+
+// frame_header_read returns
+#define FRAME_MORE 0	// need more bytes
+#define FRAME_INVALID -1	// invalid header or frame is too large
+
+struct frame_header {
+	int type;
+	int max;
+};
+
+static inline void
+frame_header_init(struct frame_header *h) {
+	h->type = FRAME_BE16;
+	h->max = 0xffff;
+}
+
+// returns 0 if succ
+static int
+frame_header_parse(struct frame_header *h, const char * spec) {
+	static const struct {
+		const char * name;
+		int type;
+	} types[] = {
+		{ "S", FRAME_BE16 },
+		{ "be16", FRAME_BE16 },
+		{ "L", FRAME_BE32 },
+		{ "be32", FRAME_BE32 },
+		{ "le16", FRAME_LE16 },
+		{ "le32", FRAME_LE32 },
+		{ "varint", FRAME_VARINT },
+	};
+	const char * sep = strchr(spec, ':');
+	size_t n = sep ? (size_t)(sep - spec) : strlen(spec);
+	int i;
+	for (i=0;i<sizeof(types)/sizeof(types[0]);i++) {
+		if (strlen(types[i].name) == n && memcmp(types[i].name, spec, n) == 0) {
+			break;
+		}
+	}
+	if (i == sizeof(types)/sizeof(types[0]))
+		return 1;
+	int type = types[i].type;
+	int limit = (type == FRAME_BE16 || type == FRAME_LE16) ? 0xffff : FRAME_DEFAULT_MAX;
+	int max = limit;
+	if (sep) {
+		char * end;
+		long v = strtol(sep + 1, &end, 10);
+		if (*end != '\0' || v <= 0 || v > 0x7fffffff || (limit == 0xffff && v > limit))
+			return 1;
+		max = (int)v;
+	}
+	h->type = type;
+	h->max = max;
+	return 0;
+}
+
+// bytes of header for the frame size
+static inline int
+frame_header_size(const struct frame_header *h, int size) {
+	switch (h->type) {
+	case FRAME_BE16:
+	case FRAME_LE16:
+		return 2;
+	case FRAME_BE32:
+	case FRAME_LE32:
+		return 4;
+	default: {
+		int n = 1;
+		while (size >= 0x80) {
+			size >>= 7;
+			++n;
+		}
+		return n;
+	}
+	}
+}
+
+// p should have FRAME_HEADER_MAX bytes, returns bytes written
+static inline int
+frame_header_write(const struct frame_header *h, uint8_t *p, int size) {
+	switch (h->type) {
+	case FRAME_BE16:
+		p[0] = (size >> 8) & 0xff;
+		p[1] = size & 0xff;
+		return 2;
+	case FRAME_LE16:
+		p[0] = size & 0xff;
+		p[1] = (size >> 8) & 0xff;
+		return 2;
+	case FRAME_BE32:
+		p[0] = (size >> 24) & 0xff;
+		p[1] = (size >> 16) & 0xff;
+		p[2] = (size >> 8) & 0xff;
+		p[3] = size & 0xff;
+		return 4;
+	case FRAME_LE32:
+		p[0] = size & 0xff;
+		p[1] = (size >> 8) & 0xff;
+		p[2] = (size >> 16) & 0xff;
+		p[3] = (size >> 24) & 0xff;
+		return 4;
+	default: {
+		int n = 0;
+		uint32_t v = (uint32_t)size;
+		while (v >= 0x80) {
+			p[n++] = (v & 0x7f) | 0x80;
+			v >>= 7;
+		}
+		p[n++] = v;
+		return n;
+	}
+	}
+}
+
+// decode the header from p (sz bytes), returns the bytes of header, FRAME_MORE or FRAME_INVALID
+static inline int
+frame_header_read(const struct frame_header *h, const uint8_t *p, int sz, int *size) {
+	uint32_t v;
+	int n;
+	switch (h->type) {
+	case FRAME_BE16:
+		if (sz < 2)
+			return FRAME_MORE;
+		v = p[0] << 8 | p[1];
+		n = 2;
+		break;
+	case FRAME_LE16:
+		if (sz < 2)
+			return FRAME_MORE;
+		v = p[0] | p[1] << 8;
+		n = 2;
+		break;
+	case FRAME_BE32:
+		if (sz < 4)
+			return FRAME_MORE;
+		v = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+		n = 4;
+		break;
+	case FRAME_LE32:
+		if (sz < 4)
+			return FRAME_MORE;
+		v = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+		n = 4;
+		break;
+	default:
+		v = 0;
+		for (n=0;;n++) {
+			if (n >= sz)
+				return FRAME_MORE;
+			if (n >= FRAME_HEADER_MAX || (n == FRAME_HEADER_MAX - 1 && p[n] > 0x0f))
+				return FRAME_INVALID;
+			v |= (uint32_t)(p[n] & 0x7f) << (7 * n);
+			if ((p[n] & 0x80) == 0) {
+				++n;
+				break;
+			}
+		}
+		break;
+	}
+	if (v > (uint32_t)h->max)
+		return FRAME_INVALID;
+	*size = (int)v;
+	return n;
+}
+
+#endif
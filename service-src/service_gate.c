@@ -1,5 +1,6 @@
 #include "skynet.h"
 #include "skynet_socket.h"
+#include "frameheader.h"
 #include "databuffer.h"
 #include "hashid.h"
 
@@ -26,7 +27,8 @@ struct gate {
 	uint32_t watchdog;
 	uint32_t broker;
 	int client_tag;
-	int header_size;
+	struct frame_header header;
+	int batch;	// send all the frames of one read in one message (with headers), see netpack.frames
 	int max_connection;
 	struct hashid hash;
 	struct connection *conn;
@@ -165,19 +167,43 @@ _report(struct gate * g, const char * data, ...) {
 	skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT,  0, tmp, n);
 }
 
-static void
-_forward(struct gate *g, struct connection * c, int size) {
+// send msg to broker or agent, returns 0 if the message should be sent to watchdog.
+static int
+_send_client(struct gate *g, struct connection * c, void * msg, int size) {
 	struct skynet_context * ctx = g->ctx;
 	if (g->broker) {
-		void * temp = skynet_malloc(size);
-		databuffer_read(&c->buffer,&g->mp,temp, size);
-		skynet_send(ctx, 0, g->broker, g->client_tag | PTYPE_TAG_DONTCOPY, 1, temp, size);
-		return;
+		skynet_send(ctx, 0, g->broker, g->client_tag | PTYPE_TAG_DONTCOPY, 1, msg, size);
+		return 1;
 	}
 	if (c->agent) {
-		void * temp = skynet_malloc(size);
-		databuffer_read(&c->buffer,&g->mp,temp, size);
-		skynet_send(ctx, c->client, c->agent, g->client_tag | PTYPE_TAG_DONTCOPY, 1 , temp, size);
+		skynet_send(ctx, c->client, c->agent, g->client_tag | PTYPE_TAG_DONTCOPY, 1 , msg, size);
+		return 1;
+	}
+	return 0;
+}
+
+static void
+_send_watchdog(struct gate *g, struct connection * c, const void * data, int size) {
+	if (g->watchdog) {
+		char * tmp = skynet_malloc(size + 32);
+		int n = snprintf(tmp,32,"%d data ",c->id);
+		memcpy(tmp+n, data, size);
+		skynet_send(g->ctx, 0, g->watchdog, PTYPE_TEXT | PTYPE_TAG_DONTCOPY, 1, tmp, size + n);
+	}
+}
+
+// forward the frame in databuffer
+static void
+_forward(struct gate *g, struct connection * c, int size) {
+	struct skynet_context * ctx = g->ctx;
+	if (g->broker || c->agent) {
+		int header = g->batch ? frame_header_size(&g->header, size) : 0;
+		uint8_t * temp = skynet_malloc(size + header);
+		if (header) {
+			frame_header_write(&g->header, temp, size);
+		}
+		databuffer_read(&c->buffer,&g->mp,temp + header, size);
+		_send_client(g, c, temp, size + header);
 	} else if (g->watchdog) {
 		char * tmp = skynet_malloc(size + 32);
 		int n = snprintf(tmp,32,"%d data ",c->id);
@@ -186,26 +212,130 @@ _forward(struct gate *g, struct connection * c, int size) {
 	}
 }
 
+// forward the frame in socket buffer
+static void
+_forward_frame(struct gate *g, struct connection * c, const char * frame, int size) {
+	if (g->broker || c->agent) {
+		void * temp = skynet_malloc(size);
+		memcpy(temp, frame, size);
+		_send_client(g, c, temp, size);
+	} else {
+		_send_watchdog(g, c, frame, size);
+	}
+}
+
+static void
+_invalid_frame(struct gate *g, struct connection *c, int id) {
+	struct skynet_context * ctx = g->ctx;
+	databuffer_clear(&c->buffer,&g->mp);
+	skynet_socket_close(ctx, id);
+	skynet_error(ctx, "Recv invalid frame header or frame size > %d", g->header.max);
+}
+
+// keep the uncomplete frame (the tail of data) in databuffer
+static void
+_save_tail(struct gate *g, struct connection *c, char * data, int offset, int sz, int reuse) {
+	int n = sz - offset;
+	if (n == 0) {
+		if (reuse) {
+			skynet_free(data);
+		}
+		return;
+	}
+	if (reuse) {
+		memmove(data, data + offset, n);
+	} else {
+		char * temp = skynet_malloc(n);
+		memcpy(temp, data + offset, n);
+		data = temp;
+	}
+	databuffer_push(&c->buffer, &g->mp, data, n);
+}
+
 static void
 dispatch_message(struct gate *g, struct connection *c, int id, void * data, int sz) {
-	databuffer_push(&c->buffer,&g->mp, data, sz);
-	for (;;) {
-		int size = databuffer_readheader(&c->buffer, &g->mp, g->header_size);
-		if (size < 0) {
+	char * buffer = data;
+	int offset = 0;
+	// complete the frame in databuffer first, only the bytes it needs are copied
+	while (c->buffer.size > 0 || c->buffer.header > 0) {
+		int size = databuffer_readheader(&c->buffer, &g->mp, &g->header);
+		if (size == DATABUFFER_INVALID) {
+			_invalid_frame(g, c, id);
+			skynet_free(data);
+			return;
+		}
+		if (size >= 0) {
+			if (size > 0) {
+				_forward(g, c, size);
+			}
+			databuffer_reset(&c->buffer);
+			continue;
+		}
+		int need;
+		if (c->buffer.header > 0) {
+			need = c->buffer.header - c->buffer.size;
+			if (need > sz - offset) {
+				_save_tail(g, c, buffer, offset, sz, 1);
+				return;
+			}
+		} else {
+			// the size of header may be unknown (varint), the bytes after header are the data of frame
+			need = FRAME_HEADER_MAX - c->buffer.size;
+			if (need > sz - offset) {
+				need = sz - offset;
+				if (need == 0) {
+					skynet_free(data);
+					return;
+				}
+			}
+		}
+		char * temp = skynet_malloc(need);
+		memcpy(temp, buffer + offset, need);
+		databuffer_push(&c->buffer, &g->mp, temp, need);
+		offset += need;
+	}
+	// parse the frames in place
+	int start = offset;
+	int frames = 0;
+	int client = g->broker || c->agent;
+	while (offset < sz) {
+		int size;
+		int header = frame_header_read(&g->header, (const uint8_t *)buffer + offset, sz - offset, &size);
+		if (header == FRAME_MORE) {
+			break;
+		}
+		if (header == FRAME_INVALID) {
+			_invalid_frame(g, c, id);
+			skynet_free(data);
 			return;
+		}
+		int next = offset + header + size;
+		if (next > sz) {
+			break;
+		}
+		if (g->batch && client) {
+			++frames;
 		} else if (size > 0) {
-			if (size >= 0x1000000) {
-				struct skynet_context * ctx = g->ctx;
-				databuffer_clear(&c->buffer,&g->mp);
-				skynet_socket_close(ctx, id);
-				skynet_error(ctx, "Recv socket message > 16M");
+			if (next == sz && client) {
+				// the last frame, send the socket buffer without copy
+				memmove(buffer, buffer + offset + header, size);
+				_send_client(g, c, buffer, size);
 				return;
-			} else {
-				_forward(g, c, size);
-				databuffer_reset(&c->buffer);
 			}
+			_forward_frame(g, c, buffer + offset + header, size);
 		}
+		offset = next;
+	}
+	if (frames == 0) {
+		_save_tail(g, c, buffer, offset, sz, 1);
+		return;
+	}
+	// batch mode : the frames from start to offset (with headers) in one message
+	_save_tail(g, c, buffer, offset, sz, 0);
+	if (start > 0) {
+		memmove(buffer, buffer + start, offset - start);
 	}
+	_send_client(g, c, buffer, offset - start);
 }
 
 static void
@@ -334,6 +464,8 @@ start_listen(struct gate *g, char * listen_addr) {
 	return 0;
 }
 
+// parm : header watchdog(! for none) address client_tag max_connection [batch]
+// header : S (uint16 big-endian), L (uint32 big-endian), or the others, see frameheader.h
 int
 gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	if (parm == NULL)
@@ -343,8 +475,9 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	char watchdog[sz];
 	char binding[sz];
 	int client_tag = 0;
-	char header;
-	int n = sscanf(parm, "%c %s %s %d %d", &header, watchdog, binding, &client_tag, &max);
+	char header[sz];
+	char mode[8] = "";
+	int n = sscanf(parm, "%s %s %s %d %d %7s", header, watchdog, binding, &client_tag, &max, mode);
 	if (n<4) {
 		skynet_error(ctx, "Invalid gate parm %s",parm);
 		return 1;
@@ -353,8 +486,8 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 		skynet_error(ctx, "Need max connection");
 		return 1;
 	}
-	if (header != 'S' && header !='L') {
-		skynet_error(ctx, "Invalid data header style");
+	if (frame_header_parse(&g->header, header)) {
+		skynet_error(ctx, "Invalid data header style %s", header);
 		return 1;
 	}
 
@@ -383,7 +516,7 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	}
 	
 	g->client_tag = client_tag;
-	g->header_size = header=='S' ? 2 : 4;
+	g->batch = strcmp(mode, "batch") == 0;
 
 	skynet_callback(ctx,g,_cb);
 
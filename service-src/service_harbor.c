@@ -2,15 +2,28 @@
 #include "skynet_harbor.h"
 #include "skynet_socket.h"
 #include "skynet_handle.h"
+#include "socket_rbuffer.h"
+#include "skynet_timer.h"
+#include "lz4.h"
 
 /*
 	harbor listen the PTYPE_HARBOR (in text)
 	N name : update the global name
-	S fd id: connect to new harbor , we should send self_id to fd first , and then recv a id (check it), and at last send queue.
-	A fd id: accept new harbor , we should send self_id to fd , and then send queue.
+	S fd id [flags]: connect to new harbor , we should send self_id to fd first , and then recv a id (check it), and at last send queue.
+	A fd id [flags]: accept new harbor , we should send self_id to fd , and then send queue.
+	I : reply the stats of each link (in text)
+
+	The handshake is 1 byte : id, or 2 bytes : id and flags if the remote harbor advertises its flags (cslave passes them
+	in S/A, they are exchanged through the master, see cmaster.lua). So the link to an old harbor still uses the 1 byte handshake.
+	If the remote harbor supports HARBOR_FLAG_LZ4, the messages not smaller than harbor_compress (in config, 0 is off)
+	are compressed : [FRAME_COMPRESSED|length(24bits)] [raw size(32bits)] [lz4 block] [cookie]
 
 	If the fd is disconnected, send message to slave in PTYPE_TEXT.  D id
 	If we don't known a globalname, send message to slave in PTYPE_TEXT. Q name
+	The name is queried once in NAME_QUERY_TTL, the messages to the unknown name are queued (bounded) until it's registered.
+
+	The remote messages are coalesced in the send buffer of each harbor, and harbor sends F (flush) to itself
+	after the first message is buffered, so all the messages before F are sent in one write.
  */
 
 #include <stdio.h>
@@ -19,13 +32,27 @@
 #include <string.h>
 #include <assert.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <unistd.h>
 
-#define HASH_SIZE 4096
+#define HASH_SIZE 64	// initial size of name table, it grows when it's full
 #define DEFAULT_QUEUE_SIZE 1024
+#define NAME_QUEUE_SIZE 16
+#define NAME_QUEUE_MAX 1024	// max pending messages of an unknown name
+#define NAME_PENDING_MAX (64 * 1024)	// max pending messages of all unknown names
+#define NAME_QUERY_TTL 1000	// in 1/100 sec, don't query an unknown name again within it
+#define NAME_SWEEP_INTERVAL 100	// in 1/100 sec, sweep the expired names when there are too many pending messages
+#define SEND_BUFFER_SIZE 4096
+// flush the send buffer at once if it's larger than it
+#define SEND_BUFFER_FLUSH (64 * 1024)
 
 // 12 is sizeof(struct remote_message_header)
 #define HEADER_COOKIE_LENGTH 12
+#define HANDSHAKE_LENGTH 2	// id and flags, or id only (HANDSHAKE_LENGTH - 1) for an old harbor
+#define HARBOR_FLAG_LZ4 1
+// the first byte of frame header
+#define FRAME_COMPRESSED 0x80
+#define FRAME_MAX 0x1000000
 
 /*
 	message type (8bits) is in destination high 8bits
@@ -55,11 +82,21 @@ struct keyvalue {
 	char key[GLOBALNAME_LENGTH];
 	uint32_t hash;
 	uint32_t value;
-	struct harbor_msg_queue * queue;
+	uint64_t query;	// the time of last query if value is 0
+	int drop;	// messages dropped since last query
+	struct harbor_msg_queue * queue;	// pending messages if value is 0
 };
 
 struct hashmap {
-	struct keyvalue *node[HASH_SIZE];
+	int size;
+	int count;
+	struct keyvalue **node;
+};
+
+struct link_stat {
+	uint64_t raw;	// frame bytes before compression
+	uint64_t wire;	// frame bytes on the link
+	uint64_t time;	// cpu time of (de)compression in microsecond
 };
 
 #define STATUS_WAIT 0
@@ -74,14 +111,28 @@ struct slave {
 	int status;
 	int length;
 	int read;
+	bool compressed;	// the frame in recv_buffer
 	uint8_t size[4];
 	char * recv_buffer;
+	uint8_t * send_buffer;
+	int send_size;
+	int send_cap;
+	int compress;	// compress threshold, 0 if the remote harbor doesn't support it
+	int handshake;	// length of the handshake
+	struct link_stat out;
+	struct link_stat in;
 };
 
 struct harbor {
 	struct skynet_context *ctx;
 	int id;
+	uint32_t self;
+	bool flush;	// F is sent to self
+	int compress;	// harbor_compress in config
 	uint32_t slave;
+	int pending;	// messages in the queues of unknown names
+	int drop;	// messages dropped since last sweep, because of NAME_PENDING_MAX
+	uint64_t sweep;	// the time of last sweep
 	struct hashmap * map;
 	struct slave s[REMOTE_MAX];
 };
@@ -128,13 +179,18 @@ pop_queue(struct harbor_msg_queue * queue) {
 	return slot;
 }
 
+static inline int
+queue_length(struct harbor_msg_queue * queue) {
+	return (queue->tail - queue->head + queue->size) % queue->size;
+}
+
 static struct harbor_msg_queue *
-new_queue() {
+new_queue(int size) {
 	struct harbor_msg_queue * queue = skynet_malloc(sizeof(*queue));
-	queue->size = DEFAULT_QUEUE_SIZE;
+	queue->size = size;
 	queue->head = 0;
 	queue->tail = 0;
-	queue->data = skynet_malloc(DEFAULT_QUEUE_SIZE * sizeof(struct harbor_msg));
+	queue->data = skynet_malloc(size * sizeof(struct harbor_msg));
 
 	return queue;
 }
@@ -151,11 +207,25 @@ release_queue(struct harbor_msg_queue *queue) {
 	skynet_free(queue);
 }
 
+static inline uint32_t
+hash_name(const char name[GLOBALNAME_LENGTH]) {
+	const uint32_t *ptr = (const uint32_t *)name;
+	return ptr[0] ^ ptr[1] ^ ptr[2] ^ ptr[3];
+}
+
+static inline int
+hash_slot(struct hashmap * hash, uint32_t h) {
+	// mix the bits, names often differ only in a few bytes
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	return (int)(h & (hash->size - 1));
+}
+
 static struct keyvalue *
 hash_search(struct hashmap * hash, const char name[GLOBALNAME_LENGTH]) {
-	uint32_t *ptr = (uint32_t*) name;
-	uint32_t h = ptr[0] ^ ptr[1] ^ ptr[2] ^ ptr[3];
-	struct keyvalue * node = hash->node[h % HASH_SIZE];
+	uint32_t h = hash_name(name);
+	struct keyvalue * node = hash->node[hash_slot(hash, h)];
 	while (node) {
 		if (node->hash == h && strncmp(node->key, name, GLOBALNAME_LENGTH) == 0) {
 			return node;
@@ -165,40 +235,59 @@ hash_search(struct hashmap * hash, const char name[GLOBALNAME_LENGTH]) {
 	return NULL;
 }
 
-/*
-
-// Don't support erase name yet
-
-static struct void
-hash_erase(struct hashmap * hash, char name[GLOBALNAME_LENGTH) {
-	uint32_t *ptr = name;
-	uint32_t h = ptr[0] ^ ptr[1] ^ ptr[2] ^ ptr[3];
-	struct keyvalue ** ptr = &hash->node[h % HASH_SIZE];
-	while (*ptr) {
-		struct keyvalue * node = *ptr;
-		if (node->hash == h && strncmp(node->key, name, GLOBALNAME_LENGTH) == 0) {
-			_release_queue(node->queue);
-			*ptr->next = node->next;
+// erase the node, the queue should be released before
+static void
+hash_erase(struct hashmap * hash, struct keyvalue * node) {
+	struct keyvalue ** pkv = &hash->node[hash_slot(hash, node->hash)];
+	while (*pkv) {
+		if (*pkv == node) {
+			*pkv = node->next;
 			skynet_free(node);
+			--hash->count;
 			return;
 		}
-		*ptr = &(node->next);
+		pkv = &(*pkv)->next;
+	}
+}
+
+static void
+hash_resize(struct hashmap * hash, int size) {
+	struct keyvalue ** old = hash->node;
+	int old_size = hash->size;
+	hash->size = size;
+	hash->node = skynet_malloc(size * sizeof(struct keyvalue *));
+	memset(hash->node, 0, size * sizeof(struct keyvalue *));
+	int i;
+	for (i=0;i<old_size;i++) {
+		struct keyvalue * node = old[i];
+		while (node) {
+			struct keyvalue * next = node->next;
+			struct keyvalue ** pkv = &hash->node[hash_slot(hash, node->hash)];
+			node->next = *pkv;
+			*pkv = node;
+			node = next;
+		}
 	}
+	skynet_free(old);
 }
-*/
 
 static struct keyvalue *
 hash_insert(struct hashmap * hash, const char name[GLOBALNAME_LENGTH]) {
-	uint32_t *ptr = (uint32_t *)name;
-	uint32_t h = ptr[0] ^ ptr[1] ^ ptr[2] ^ ptr[3];
-	struct keyvalue ** pkv = &hash->node[h % HASH_SIZE];
+	if (hash->count >= hash->size) {
+		hash_resize(hash, hash->size * 2);
+	}
+	uint32_t h = hash_name(name);
+	struct keyvalue ** pkv = &hash->node[hash_slot(hash, h)];
 	struct keyvalue * node = skynet_malloc(sizeof(*node));
 	memcpy(node->key, name, GLOBALNAME_LENGTH);
 	node->next = *pkv;
 	node->queue = NULL;
 	node->hash = h;
 	node->value = 0;
+	node->query = 0;
+	node->drop = 0;
 	*pkv = node;
+	++hash->count;
 
 	return node;
 }
@@ -206,14 +295,17 @@ hash_insert(struct hashmap * hash, const char name[GLOBALNAME_LENGTH]) {
 static struct hashmap * 
 hash_new() {
 	struct hashmap * h = skynet_malloc(sizeof(struct hashmap));
-	memset(h,0,sizeof(*h));
+	h->size = HASH_SIZE;
+	h->count = 0;
+	h->node = skynet_malloc(HASH_SIZE * sizeof(struct keyvalue *));
+	memset(h->node, 0, HASH_SIZE * sizeof(struct keyvalue *));
 	return h;
 }
 
 static void
 hash_delete(struct hashmap *hash) {
 	int i;
-	for (i=0;i<HASH_SIZE;i++) {
+	for (i=0;i<hash->size;i++) {
 		struct keyvalue * node = hash->node[i];
 		while (node) {
 			struct keyvalue * next = node->next;
@@ -222,6 +314,7 @@ hash_delete(struct hashmap *hash) {
 			node = next;
 		}
 	}
+	skynet_free(hash->node);
 	skynet_free(hash);
 }
 
@@ -238,6 +331,10 @@ close_harbor(struct harbor *h, int id) {
 		release_queue(s->queue);
 		s->queue = NULL;
 	}
+	skynet_free(s->send_buffer);
+	s->send_buffer = NULL;
+	s->send_size = 0;
+	s->send_cap = 0;
 }
 
 static void
@@ -266,6 +363,7 @@ harbor_release(struct harbor *h) {
 			// don't call report_harbor_down.
 			// never call skynet_send during module exit, because of dead lock
 		}
+		skynet_free(s->send_buffer);
 	}
 	hash_delete(h->map);
 	skynet_free(h);
@@ -326,19 +424,82 @@ forward_local_messsage(struct harbor *h, void *msg, int sz) {
 }
 
 static void
-send_remote(struct skynet_context * ctx, int fd, const char * buffer, size_t sz, struct remote_message_header * cookie) {
-	size_t sz_header = sz+sizeof(*cookie);
-	if (sz_header > UINT32_MAX) {
-		skynet_error(ctx, "remote message from :%08x to :%08x is too large.", cookie->source, cookie->destination);
+flush_remote(struct harbor *h, struct slave *s) {
+	if (s->send_size == 0)
 		return;
+	// ignore send error, because if the connection is broken, the mainloop will recv a message.
+	skynet_socket_send(h->ctx, s->fd, s->send_buffer, s->send_size);
+	s->send_buffer = NULL;
+	s->send_size = 0;
+}
+
+// write the frame into sendbuf (sz + 16 bytes at most), returns the size of frame
+static size_t
+pack_frame(struct slave *s, uint8_t * sendbuf, const char * buffer, size_t sz, struct remote_message_header * cookie) {
+	size_t sz_header = sz+sizeof(*cookie);
+	size_t len = sz_header + 4;
+	s->out.raw += len;
+	if (s->compress && sz >= (size_t)s->compress && sz > 8 && sz_header < FRAME_MAX) {
+		uint64_t t = skynet_thread_time();
+		// use the compressed frame only if it's smaller
+		int csz = LZ4_compress_default(buffer, (char *)sendbuf + 8, (int)sz, (int)sz - 5);
+		s->out.time += skynet_thread_time() - t;
+		if (csz > 0) {
+			len = 8 + csz + HEADER_COOKIE_LENGTH;
+			to_bigendian(sendbuf, (uint32_t)len - 4);
+			sendbuf[0] = FRAME_COMPRESSED;
+			to_bigendian(sendbuf+4, (uint32_t)sz);
+			header_to_message(cookie, sendbuf+8+csz);
+			s->out.wire += len;
+			return len;
+		}
 	}
-	uint8_t * sendbuf = skynet_malloc(sz_header+4);
 	to_bigendian(sendbuf, (uint32_t)sz_header);
 	memcpy(sendbuf+4, buffer, sz);
 	header_to_message(cookie, sendbuf+4+sz);
+	s->out.wire += len;
+	return len;
+}
 
-	// ignore send error, because if the connection is broken, the mainloop will recv a message.
-	skynet_socket_send(ctx, fd, sendbuf, sz_header+4);
+static void
+send_remote(struct harbor *h, int id, const char * buffer, size_t sz, struct remote_message_header * cookie) {
+	struct slave *s = &h->s[id];
+	size_t sz_header = sz+sizeof(*cookie);
+	if (sz_header > UINT32_MAX) {
+		skynet_error(h->ctx, "remote message from :%08x to :%08x is too large.", cookie->source, cookie->destination);
+		return;
+	}
+	uint8_t * sendbuf;
+	bool alone = sz_header + 4 >= SEND_BUFFER_FLUSH;
+	if (alone) {
+		// large message, send it alone
+		flush_remote(h, s);
+		sendbuf = skynet_malloc(sz_header+4);
+	} else {
+		int need = s->send_size + (int)sz_header + 4;
+		if (s->send_buffer == NULL || need > s->send_cap) {
+			int cap = s->send_cap ? s->send_cap : SEND_BUFFER_SIZE;
+			while (cap < need) {
+				cap *= 2;
+			}
+			s->send_buffer = skynet_realloc(s->send_buffer, cap);
+			s->send_cap = cap;
+		}
+		sendbuf = s->send_buffer + s->send_size;
+	}
+	size_t len = pack_frame(s, sendbuf, buffer, sz, cookie);
+
+	if (alone) {
+		skynet_socket_send(h->ctx, s->fd, sendbuf, len);
+		return;
+	}
+	s->send_size += (int)len;
+	if (s->send_size >= SEND_BUFFER_FLUSH) {
+		flush_remote(h, s);
+	} else if (!h->flush) {
+		h->flush = true;
+		skynet_send(h->ctx, 0, h->self, PTYPE_HARBOR, 0, "F", 1);
+	}
 }
 
 static void
@@ -381,7 +542,7 @@ dispatch_name_queue(struct harbor *h, struct keyvalue * node) {
 	struct harbor_msg * m;
 	while ((m = pop_queue(queue)) != NULL) {
 		m->header.destination |= (handle & HANDLE_MASK);
-		send_remote(context, fd, m->buffer, m->size, &m->header);
+		send_remote(h, harbor_id, m->buffer, m->size, &m->header);
 		skynet_free(m->buffer);
 	}
 }
@@ -398,14 +559,57 @@ dispatch_queue(struct harbor *h, int id) {
 
 	struct harbor_msg * m;
 	while ((m = pop_queue(queue)) != NULL) {
-		send_remote(h->ctx, fd, m->buffer, m->size, &m->header);
+		send_remote(h, id, m->buffer, m->size, &m->header);
 		skynet_free(m->buffer);
 	}
 	release_queue(queue);
 	s->queue = NULL;
 }
 
-static void
+// forward the frame in socket buffer, returns 1 if the socket buffer is forwarded
+static int
+forward_frame(struct harbor *h, uint8_t * socket_buffer, uint8_t * msg, int sz, bool last) {
+	if (socket_rbuffer_retain(msg)) {
+		// pooled socket buffer is refcounted, forward the pointer in it
+		forward_local_messsage(h, msg, sz);
+		return 0;
+	}
+	if (last) {
+		memmove(socket_buffer, msg, sz);
+		forward_local_messsage(h, socket_buffer, sz);
+		return 1;
+	}
+	void * tmp = skynet_malloc(sz);
+	memcpy(tmp, msg, sz);
+	forward_local_messsage(h, tmp, sz);
+	return 0;
+}
+
+// decompress the frame : [raw size] [lz4 block] [cookie], returns false if it's malformed
+static bool
+forward_compressed(struct harbor *h, struct slave *s, const uint8_t * msg, int sz) {
+	if (sz < 4 + HEADER_COOKIE_LENGTH)
+		return false;
+	uint32_t rawsize = msg[0] << 24 | msg[1] << 16 | msg[2] << 8 | msg[3];
+	if (rawsize >= FRAME_MAX)
+		return false;
+	uint64_t t = skynet_thread_time();
+	uint8_t * buffer = skynet_malloc(rawsize + HEADER_COOKIE_LENGTH);
+	int n = LZ4_decompress_safe((const char *)msg + 4, (char *)buffer, sz - 4 - HEADER_COOKIE_LENGTH, (int)rawsize);
+	s->in.time += skynet_thread_time() - t;
+	if (n != (int)rawsize) {
+		skynet_free(buffer);
+		return false;
+	}
+	memcpy(buffer + rawsize, msg + sz - HEADER_COOKIE_LENGTH, HEADER_COOKIE_LENGTH);
+	s->in.raw += rawsize + HEADER_COOKIE_LENGTH + 4;
+	s->in.wire += sz + 4;
+	forward_local_messsage(h, buffer, rawsize + HEADER_COOKIE_LENGTH);
+	return true;
+}
+
+// returns 1 if message->buffer is forwarded
+static int
 push_socket_data(struct harbor *h, const struct skynet_socket_message * message) {
 	assert(message->type == SKYNET_SOCKET_TYPE_DATA);
 	int fd = message->id;
@@ -421,23 +625,36 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 	}
 	if (s == NULL) {
 		skynet_error(h->ctx, "Invalid socket fd (%d) data", fd);
-		return;
+		return 0;
 	}
 	uint8_t * buffer = (uint8_t *)message->buffer;
 	int size = message->ud;
+	int forward = 0;
 
 	for (;;) {
 		switch(s->status) {
 		case STATUS_HANDSHAKE: {
+			// id and flags (if advertised)
+			int need = s->handshake - s->read;
+			if (size < need) {
+				memcpy(s->size + s->read, buffer, size);
+				s->read += size;
+				return 0;
+			}
+			memcpy(s->size + s->read, buffer, need);
+			buffer += need;
+			size -= need;
+			s->read = 0;
 			// check id
-			uint8_t remote_id = buffer[0];
+			uint8_t remote_id = s->size[0];
 			if (remote_id != id) {
 				skynet_error(h->ctx, "Invalid shakehand id (%d) from fd = %d , harbor = %d", id, fd, remote_id);
 				close_harbor(h,id);
-				return;
+				return 0;
+			}
+			if (s->handshake == HANDSHAKE_LENGTH) {
+				s->compress = (s->size[1] & HARBOR_FLAG_LZ4) ? h->compress : 0;
 			}
-			++buffer;
-			--size;
 			s->status = STATUS_HEADER;
 
 			dispatch_queue(h, id);
@@ -448,28 +665,57 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 			// go though
 		}
 		case STATUS_HEADER: {
+			if (s->read == 0) {
+				// forward the whole frames in place
+				while (size >= 4) {
+					if (buffer[0] != 0 && buffer[0] != FRAME_COMPRESSED) {
+						skynet_error(h->ctx, "Message is too long from harbor %d", id);
+						close_harbor(h,id);
+						return forward;
+					}
+					int length = buffer[1] << 16 | buffer[2] << 8 | buffer[3];
+					if (size - 4 < length)
+						break;
+					if (buffer[0] == FRAME_COMPRESSED) {
+						if (!forward_compressed(h, s, buffer + 4, length)) {
+							skynet_error(h->ctx, "Invalid compressed message from harbor %d", id);
+							close_harbor(h,id);
+							return forward;
+						}
+					} else {
+						s->in.raw += 4 + length;
+						s->in.wire += 4 + length;
+						forward = forward_frame(h, (uint8_t *)message->buffer, buffer + 4, length, size - 4 == length);
+					}
+					buffer += 4 + length;
+					size -= 4 + length;
+				}
+				if (size == 0)
+					return forward;
+			}
 			// big endian 4 bytes length, the first one must be 0.
 			int need = 4 - s->read;
 			if (size < need) {
 				memcpy(s->size + s->read, buffer, size);
 				s->read += size;
-				return;
+				return forward;
 			} else {
 				memcpy(s->size + s->read, buffer, need);
 				buffer += need;
 				size -= need;
 
-				if (s->size[0] != 0) {
+				if (s->size[0] != 0 && s->size[0] != FRAME_COMPRESSED) {
 					skynet_error(h->ctx, "Message is too long from harbor %d", id);
 					close_harbor(h,id);
-					return;
+					return forward;
 				}
+				s->compressed = s->size[0] == FRAME_COMPRESSED;
 				s->length = s->size[1] << 16 | s->size[2] << 8 | s->size[3];
 				s->read = 0;
 				s->recv_buffer = skynet_malloc(s->length);
 				s->status = STATUS_CONTENT;
 				if (size == 0) {
-					return;
+					return forward;
 				}
 			}
 		}
@@ -479,10 +725,23 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 			if (size < need) {
 				memcpy(s->recv_buffer + s->read, buffer, size);
 				s->read += size;
-				return;
+				return forward;
 			}
 			memcpy(s->recv_buffer + s->read, buffer, need);
-			forward_local_messsage(h, s->recv_buffer, s->length);
+			if (s->compressed) {
+				bool ok = forward_compressed(h, s, (const uint8_t *)s->recv_buffer, s->length);
+				skynet_free(s->recv_buffer);
+				if (!ok) {
+					s->recv_buffer = NULL;
+					skynet_error(h->ctx, "Invalid compressed message from harbor %d", id);
+					close_harbor(h,id);
+					return forward;
+				}
+			} else {
+				s->in.raw += 4 + s->length;
+				s->in.wire += 4 + s->length;
+				forward_local_messsage(h, s->recv_buffer, s->length);
+			}
 			s->length = 0;
 			s->read = 0;
 			s->recv_buffer = NULL;
@@ -490,15 +749,76 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 			buffer += need;
 			s->status = STATUS_HEADER;
 			if (size == 0)
-				return;
+				return forward;
 			break;
 		}
 		default:
-			return;
+			return forward;
 		}
 	}
 }
 
+static void
+name_string(char tmp[GLOBALNAME_LENGTH+1], const char name[GLOBALNAME_LENGTH]) {
+	memcpy(tmp, name, GLOBALNAME_LENGTH);
+	tmp[GLOBALNAME_LENGTH] = '\0';
+}
+
+// report the dropped message to the source if it's a request
+static void
+drop_message(struct harbor *h, uint32_t source, int session, void * msg) {
+	if (session != 0) {
+		skynet_send(h->ctx, 0, source, PTYPE_ERROR, session, NULL, 0);
+	}
+	skynet_free(msg);
+}
+
+static void
+drop_name_queue(struct harbor *h, struct keyvalue * node) {
+	struct harbor_msg * m;
+	int n = node->drop;
+	while ((m = pop_queue(node->queue)) != NULL) {
+		drop_message(h, m->header.source, (int)m->header.session, m->buffer);
+		--h->pending;
+		++n;
+	}
+	node->drop = 0;
+	if (n > 0) {
+		char tmp[GLOBALNAME_LENGTH+1];
+		name_string(tmp, node->key);
+		skynet_error(h->ctx, "Drop %d messages to unknown name %s", n, tmp);
+	}
+}
+
+// drop the queues of the names not registered within NAME_QUERY_TTL, returns the number of names erased
+static int
+sweep_names(struct harbor *h, uint64_t now) {
+	if (now - h->sweep < NAME_SWEEP_INTERVAL)
+		return 0;
+	h->sweep = now;
+	if (h->drop > 0) {
+		skynet_error(h->ctx, "Drop %d messages, too many messages to unknown names (%d)", h->drop, h->pending);
+		h->drop = 0;
+	}
+	struct hashmap * hash = h->map;
+	int n = 0;
+	int i;
+	for (i=0;i<hash->size;i++) {
+		struct keyvalue * node = hash->node[i];
+		while (node) {
+			struct keyvalue * next = node->next;
+			if (node->value == 0 && now - node->query >= NAME_QUERY_TTL) {
+				drop_name_queue(h, node);
+				release_queue(node->queue);
+				hash_erase(hash, node);
+				++n;
+			}
+			node = next;
+		}
+	}
+	return n;
+}
+
 static void
 update_name(struct harbor *h, const char name[GLOBALNAME_LENGTH], uint32_t handle) {
 	struct keyvalue * node = hash_search(h->map, name);
@@ -507,6 +827,13 @@ update_name(struct harbor *h, const char name[GLOBALNAME_LENGTH], uint32_t handl
 	}
 	node->value = handle;
 	if (node->queue) {
+		h->pending -= queue_length(node->queue);
+		if (node->drop > 0) {
+			char tmp[GLOBALNAME_LENGTH+1];
+			name_string(tmp, name);
+			skynet_error(h->ctx, "Drop %d messages to %s before it's registered", node->drop, tmp);
+			node->drop = 0;
+		}
 		dispatch_name_queue(h, node);
 		release_queue(node->queue);
 		node->queue = NULL;
@@ -532,7 +859,7 @@ remote_send_handle(struct harbor *h, uint32_t source, uint32_t destination, int
 			skynet_error(context, "Drop message to harbor %d from %x to %x (session = %d, msgsz = %d)",harbor_id, source, destination,session,(int)sz);
 		} else {
 			if (s->queue == NULL) {
-				s->queue = new_queue();
+				s->queue = new_queue(DEFAULT_QUEUE_SIZE);
 			}
 			struct remote_message_header header;
 			header.source = source;
@@ -546,7 +873,7 @@ remote_send_handle(struct harbor *h, uint32_t source, uint32_t destination, int
 		cookie.source = source;
 		cookie.destination = (destination & HANDLE_MASK) | ((uint32_t)type << HANDLE_REMOTE_SHIFT);
 		cookie.session = (uint32_t)session;
-		send_remote(context, s->fd, msg,sz,&cookie);
+		send_remote(h, harbor_id, msg,sz,&cookie);
 	}
 
 	return 0;
@@ -555,34 +882,85 @@ remote_send_handle(struct harbor *h, uint32_t source, uint32_t destination, int
 static int
 remote_send_name(struct harbor *h, uint32_t source, const char name[GLOBALNAME_LENGTH], int type, int session, const char * msg, size_t sz) {
 	struct keyvalue * node = hash_search(h->map, name);
+	if (node && node->value) {
+		return remote_send_handle(h, source, node->value, type, session, msg, sz);
+	}
+	uint64_t now = skynet_now();
+	if (h->pending >= NAME_PENDING_MAX) {
+		if (sweep_names(h, now) > 0) {
+			node = hash_search(h->map, name);
+		}
+		if (h->pending >= NAME_PENDING_MAX) {
+			if (h->drop++ == 0) {
+				skynet_error(h->ctx, "Too many messages (%d) to unknown names, drop", NAME_PENDING_MAX);
+			}
+			drop_message(h, source, session, (void *)msg);
+			return 1;
+		}
+	}
+	bool send_query = true;
 	if (node == NULL) {
 		node = hash_insert(h->map, name);
-	}
-	if (node->value == 0) {
-		if (node->queue == NULL) {
-			node->queue = new_queue();
+		node->queue = new_queue(NAME_QUEUE_SIZE);
+	} else if (now - node->query < NAME_QUERY_TTL) {
+		// the query is sent, wait for the name
+		if (queue_length(node->queue) >= NAME_QUEUE_MAX) {
+			if (node->drop++ == 0) {
+				char tmp[GLOBALNAME_LENGTH+1];
+				name_string(tmp, name);
+				skynet_error(h->ctx, "Too many messages (%d) to unknown name %s, drop", NAME_QUEUE_MAX, tmp);
+			}
+			drop_message(h, source, session, (void *)msg);
+			return 1;
 		}
-		struct remote_message_header header;
-		header.source = source;
-		header.destination = type << HANDLE_REMOTE_SHIFT;
-		header.session = (uint32_t)session;
-		push_queue(node->queue, (void *)msg, sz, &header);
+		send_query = false;
+	} else {
+		// the name isn't registered within NAME_QUERY_TTL
+		drop_name_queue(h, node);
+	}
+	struct remote_message_header header;
+	header.source = source;
+	header.destination = type << HANDLE_REMOTE_SHIFT;
+	header.session = (uint32_t)session;
+	push_queue(node->queue, (void *)msg, sz, &header);
+	++h->pending;
+	if (send_query) {
+		node->query = now;
 		char query[2+GLOBALNAME_LENGTH+1] = "Q ";
 		query[2+GLOBALNAME_LENGTH] = 0;
 		memcpy(query+2, name, GLOBALNAME_LENGTH);
 		skynet_send(h->ctx, 0, h->slave, PTYPE_TEXT, 0, query, strlen(query));
-		return 1;
-	} else {
-		return remote_send_handle(h, source, node->value, type, session, msg, sz);
 	}
+	return 1;
 }
 
 static void
 handshake(struct harbor *h, int id) {
 	struct slave *s = &h->s[id];
-	uint8_t * handshake = skynet_malloc(1);
+	uint8_t * handshake = skynet_malloc(HANDSHAKE_LENGTH);
 	handshake[0] = (uint8_t)h->id;
-	skynet_socket_send(h->ctx, s->fd, handshake, 1);
+	handshake[1] = HARBOR_FLAG_LZ4;
+	skynet_socket_send(h->ctx, s->fd, handshake, s->handshake);
+}
+
+static void
+report_stat(struct harbor *h, int session, uint32_t source) {
+	if (session == 0)
+		return;
+	char tmp[REMOTE_MAX * 192];
+	int n = 0;
+	int i;
+	for (i=1;i<REMOTE_MAX;i++) {
+		struct slave *s = &h->s[i];
+		if (s->fd == 0)
+			continue;
+		n += snprintf(tmp + n, sizeof(tmp) - n,
+			"harbor %d compress %d out %" PRIu64 "/%" PRIu64 " bytes %" PRIu64 " us in %" PRIu64 "/%" PRIu64 " bytes %" PRIu64 " us\n",
+			i, s->compress,
+			s->out.wire, s->out.raw, s->out.time,
+			s->in.wire, s->in.raw, s->in.time);
+	}
+	skynet_send(h->ctx, 0, source, PTYPE_RESPONSE, session, tmp, n);
 }
 
 static void
@@ -591,6 +969,17 @@ harbor_command(struct harbor * h, const char * msg, size_t sz, int session, uint
 	int s = (int)sz;
 	s -= 2;
 	switch(msg[0]) {
+	case 'F' : {
+		int i;
+		h->flush = false;
+		for (i=1;i<REMOTE_MAX;i++) {
+			struct slave *slave = &h->s[i];
+			if (slave->send_size > 0 && slave->status != STATUS_DOWN) {
+				flush_remote(h, slave);
+			}
+		}
+		break;
+	}
 	case 'N' : {
 		if (s <=0 || s>= GLOBALNAME_LENGTH) {
 			skynet_error(h->ctx, "Invalid global name %s", name);
@@ -608,8 +997,8 @@ harbor_command(struct harbor * h, const char * msg, size_t sz, int session, uint
 		char buffer[s+1];
 		memcpy(buffer, name, s);
 		buffer[s] = 0;
-		int fd=0, id=0;
-		sscanf(buffer, "%d %d",&fd,&id);
+		int fd=0, id=0, flags=0;
+		int n = sscanf(buffer, "%d %d %d",&fd,&id,&flags);
 		if (fd == 0 || id <= 0 || id>=REMOTE_MAX) {
 			skynet_error(h->ctx, "Invalid command %c %s", msg[0], buffer);
 			return;
@@ -620,6 +1009,12 @@ harbor_command(struct harbor * h, const char * msg, size_t sz, int session, uint
 			return;
 		}
 		slave->fd = fd;
+		slave->read = 0;
+		// the remote harbor advertises its flags, so it uses the handshake with flags
+		slave->handshake = n == 3 ? HANDSHAKE_LENGTH : HANDSHAKE_LENGTH - 1;
+		slave->compress = 0;
+		memset(&slave->out, 0, sizeof(slave->out));
+		memset(&slave->in, 0, sizeof(slave->in));
 
 		skynet_socket_start(h->ctx, fd);
 		handshake(h, id);
@@ -627,10 +1022,15 @@ harbor_command(struct harbor * h, const char * msg, size_t sz, int session, uint
 			slave->status = STATUS_HANDSHAKE;
 		} else {
 			slave->status = STATUS_HEADER;
+			slave->compress = (flags & HARBOR_FLAG_LZ4) ? h->compress : 0;
 			dispatch_queue(h,id);
 		}
 		break;
 	}
+	case 'I' : {
+		report_stat(h, session, source);
+		break;
+	}
 	default:
 		skynet_error(h->ctx, "Unknown command %s", msg);
 		return;
@@ -657,8 +1057,9 @@ mainloop(struct skynet_context * context, void * ud, int type, int session, uint
 		const struct skynet_socket_message * message = msg;
 		switch(message->type) {
 		case SKYNET_SOCKET_TYPE_DATA:
-			push_socket_data(h, message);
-			skynet_free(message->buffer);
+			if (!push_socket_data(h, message)) {
+				skynet_free(message->buffer);
+			}
 			break;
 		case SKYNET_SOCKET_TYPE_ERROR:
 		case SKYNET_SOCKET_TYPE_CLOSE: {
@@ -719,6 +1120,12 @@ harbor_init(struct harbor *h, struct skynet_context *ctx, const char * args) {
 	}
 	h->id = harbor_id;
 	h->slave = slave;
+	const char * self = skynet_command(ctx, "REG", NULL);
+	h->self = strtoul(self+1, NULL, 16);
+	const char * compress = skynet_command(ctx, "GETENV", "harbor_compress");
+	if (compress) {
+		h->compress = strtol(compress, NULL, 10);
+	}
 	skynet_callback(ctx, h, mainloop);
 	skynet_harbor_start(ctx);
 
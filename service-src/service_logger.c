@@ -1,4 +1,5 @@
 #include "skynet.h"
+#include "skynet_logring.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,11 +36,17 @@ logger_cb(struct skynet_context * context, void *ud, int type, int session, uint
 	struct logger * inst = ud;
 	switch (type) {
 	case PTYPE_SYSTEM:
-		if (inst->filename) {
+		if (inst->handle == NULL) {
+			skynet_logring_reopen();
+		} else if (inst->filename) {
 			inst->handle = freopen(inst->filename, "a", inst->handle);
 		}
 		break;
 	case PTYPE_TEXT:
+		if (inst->handle == NULL) {
+			skynet_logring_push(source, msg, sz);
+			break;
+		}
 		fprintf(inst->handle, "[:%08x] ",source);
 		fwrite(msg, sz , 1, inst->handle);
 		fprintf(inst->handle, "\n");
@@ -52,6 +59,12 @@ logger_cb(struct skynet_context * context, void *ud, int type, int session, uint
 
 int
 logger_init(struct logger * inst, struct skynet_context *ctx, const char * parm) {
+	if (skynet_logring_enabled()) {
+		// the log file is written by the flusher thread, see skynet_logring.c
+		skynet_callback(ctx, inst, logger_cb);
+		skynet_command(ctx, "REG", ".logger");
+		return 0;
+	}
 	if (parm) {
 		inst->handle = fopen(parm,"w");
 		if (inst->handle == NULL) {
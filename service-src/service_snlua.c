@@ -1,4 +1,5 @@
 #include "skynet.h"
+#include "skynet_env.h"
 
 #include <lua.h>
 #include <lualib.h>
@@ -8,15 +9,45 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #define MEMORY_WARNING_REPORT (1024 * 1024 * 32)
 
+/*
+	Optional (config lua_slab = true) size class allocator for the small objects of lua vm.
+	The objects of a size class are allocated from the pages of its own, and lua passes the size of the block when it's freed,
+	so no header is needed for each object. A page is aligned to SLAB_PAGE, and the page header is at the beginning.
+	The pages are allocated by skynet_memalign, so the memory of lua is counted per page in the memory stats of the service.
+ */
+
+#define SLAB_PAGE 8192
+#define SLAB_PAGE_ALLOC (SLAB_PAGE - 16)	// leave room for the cookie of malloc hook, so the page is in the size class of SLAB_PAGE
+#define SLAB_ALIGN 16
+#define SLAB_MAX 512	// larger blocks use skynet_lalloc
+#define SLAB_CLASS (SLAB_MAX / SLAB_ALIGN)
+#define SLAB_CLASS_ID(sz) (((sz) + SLAB_ALIGN - 1) / SLAB_ALIGN - 1)
+
+struct slab_page {
+	struct slab_page * prev;
+	struct slab_page * next;
+	void * freelist;
+	int used;
+	int cls;
+};
+
+#define SLAB_HEADER ((sizeof(struct slab_page) + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1))
+
+struct slab {
+	struct slab_page * partial[SLAB_CLASS];	// the pages have free objects
+};
+
 struct snlua {
 	lua_State * L;
 	struct skynet_context * ctx;
 	size_t mem;
 	size_t mem_report;
 	size_t mem_limit;
+	struct slab * slab;
 };
 
 // LUA_CACHELIB may defined in patched lua for shared proto
@@ -157,6 +188,123 @@ snlua_init(struct snlua *l, struct skynet_context *ctx, const char * args) {
 	return 0;
 }
 
+static void
+slab_link(struct slab *s, struct slab_page *page) {
+	struct slab_page * head = s->partial[page->cls];
+	page->prev = NULL;
+	page->next = head;
+	if (head)
+		head->prev = page;
+	s->partial[page->cls] = page;
+}
+
+static void
+slab_unlink(struct slab *s, struct slab_page *page) {
+	if (page->prev)
+		page->prev->next = page->next;
+	else
+		s->partial[page->cls] = page->next;
+	if (page->next)
+		page->next->prev = page->prev;
+}
+
+static struct slab_page *
+slab_newpage(struct slab *s, int cls) {
+	struct slab_page * page = skynet_memalign(SLAB_PAGE, SLAB_PAGE_ALLOC);
+	if (page == NULL)
+		return NULL;
+	size_t sz = (cls + 1) * SLAB_ALIGN;
+	char * obj = (char *)page + SLAB_HEADER;
+	char * end = (char *)page + SLAB_PAGE_ALLOC - sz;
+	void * freelist = NULL;
+	// build the free list in reverse order, so the objects are allocated in address order
+	for (; end >= obj; end -= sz) {
+		*(void **)end = freelist;
+		freelist = end;
+	}
+	page->freelist = freelist;
+	page->used = 0;
+	page->cls = cls;
+	slab_link(s, page);
+	return page;
+}
+
+static void *
+slab_alloc(struct slab *s, size_t sz) {
+	if (sz > SLAB_MAX)
+		return skynet_lalloc(NULL, 0, sz);
+	int cls = SLAB_CLASS_ID(sz);
+	struct slab_page * page = s->partial[cls];
+	if (page == NULL) {
+		page = slab_newpage(s, cls);
+		if (page == NULL)
+			return NULL;
+	}
+	void * obj = page->freelist;
+	page->freelist = *(void **)obj;
+	++page->used;
+	if (page->freelist == NULL) {
+		// full page is not in any list, it will be linked again when an object is freed
+		slab_unlink(s, page);
+	}
+	return obj;
+}
+
+static void
+slab_free(struct slab *s, void *ptr, size_t sz) {
+	if (sz > SLAB_MAX) {
+		skynet_lalloc(ptr, sz, 0);
+		return;
+	}
+	struct slab_page * page = (struct slab_page *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_PAGE - 1));
+	if (page->freelist == NULL) {
+		slab_link(s, page);
+	}
+	*(void **)ptr = page->freelist;
+	page->freelist = ptr;
+	if (--page->used == 0 && (page->prev || page->next)) {
+		// keep one empty page for each size class
+		slab_unlink(s, page);
+		skynet_free(page);
+	}
+}
+
+static void *
+slab_realloc(struct slab *s, void *ptr, size_t osize, size_t nsize) {
+	if (nsize == 0) {
+		if (ptr)
+			slab_free(s, ptr, osize);
+		return NULL;
+	}
+	if (ptr == NULL)
+		return slab_alloc(s, nsize);	// osize is the type of object
+	if (osize > SLAB_MAX && nsize > SLAB_MAX)
+		return skynet_lalloc(ptr, osize, nsize);
+	if (osize <= SLAB_MAX && nsize <= SLAB_MAX && SLAB_CLASS_ID(osize) == SLAB_CLASS_ID(nsize))
+		return ptr;
+	void * newptr = slab_alloc(s, nsize);
+	if (newptr == NULL)
+		return NULL;
+	memcpy(newptr, ptr, osize < nsize ? osize : nsize);
+	slab_free(s, ptr, osize);
+	return newptr;
+}
+
+static void
+slab_release(struct slab *s) {
+	int i;
+	for (i=0;i<SLAB_CLASS;i++) {
+		// all the objects are freed by lua_close, only the empty pages are left
+		struct slab_page * page = s->partial[i];
+		while (page) {
+			struct slab_page * next = page->next;
+			skynet_free(page);
+			page = next;
+		}
+	}
+	skynet_free(s);
+}
+
 static void *
 lalloc(void * ud, void *ptr, size_t osize, size_t nsize) {
 	struct snlua *l = ud;
@@ -174,6 +322,13 @@ lalloc(void * ud, void *ptr, size_t osize, size_t nsize) {
 		l->mem_report *= 2;
 		skynet_error(l->ctx, "Memory warning %.2f M", (float)l->mem / (1024 * 1024));
 	}
+	if (l->slab) {
+		void * ret = slab_realloc(l->slab, ptr, osize, nsize);
+		if (ret == NULL && nsize > 0) {
+			l->mem = mem;
+		}
+		return ret;
+	}
 	return skynet_lalloc(ptr, osize, nsize);
 }
 
@@ -183,6 +338,11 @@ snlua_create(void) {
 	memset(l,0,sizeof(*l));
 	l->mem_report = MEMORY_WARNING_REPORT;
 	l->mem_limit = 0;
+	const char * slab = skynet_getenv("lua_slab");
+	if (slab && strcmp(slab, "true") == 0) {
+		l->slab = skynet_malloc(sizeof(*l->slab));
+		memset(l->slab, 0, sizeof(*l->slab));
+	}
 	l->L = lua_newstate(lalloc, l);
 	return l;
 }
@@ -190,6 +350,9 @@ snlua_create(void) {
 void
 snlua_release(struct snlua *l) {
 	lua_close(l->L);
+	if (l->slab) {
+		slab_release(l->slab);
+	}
 	skynet_free(l);
 }
 
@@ -0,0 +1,92 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local cluster = require "skynet.cluster.core"
+
+-- Handle the requests from one connection, clusterd launches an agent for each connection accepted.
+
+local clusterd, gate, fd = ...
+clusterd = tonumber(clusterd)
+gate = tonumber(gate)
+fd = tonumber(fd)
+
+-- the large requests are reassembled in it
+local large = cluster.largebuffer(tonumber(skynet.getenv "cluster_large_limit"))
+local compress = tonumber(skynet.getenv "cluster_compress")
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = function(msg, sz)
+		-- msg/sz will be free after dispatch, unpackmessage copies the request
+		return cluster.unpackmessage(large, msg, sz)
+	end,
+}
+
+local function dispatch_request(_, _, addr, session, msg, sz, is_push)
+	if addr == nil then
+		-- a part of large request
+		return
+	end
+	local ok, response
+	if addr == false then
+		if not is_push then
+			response = cluster.packresponse(session, false, msg)
+			socket.write(fd, response)
+		else
+			skynet.error(string.format("Drop push (session = %d) : %s", session, msg))
+		end
+		return
+	end
+	if addr == 0 then
+		local name, flags = skynet.unpack(msg, sz)
+		skynet.trash(msg, sz)
+		local addr
+		if name == cluster.hello then
+			-- see clustersender.lua
+			addr = cluster.negotiate(large, flags, compress)
+		else
+			addr = skynet.call(clusterd, "lua", "queryname", name)
+		end
+		if addr then
+			ok = true
+			msg, sz = skynet.pack(addr)
+		else
+			ok = false
+			msg = "name not found"
+		end
+	elseif is_push then
+		skynet.rawsend(addr, "lua", msg, sz)
+		return	-- no response
+	else
+		ok , msg, sz = pcall(skynet.rawcall, addr, "lua", msg, sz)
+	end
+	if ok then
+		response = cluster.packresponse(session, true, msg, sz, large)
+		if type(response) == "table" then
+			for _, v in ipairs(response) do
+				socket.lwrite(fd, v)
+			end
+		else
+			socket.write(fd, response)
+		end
+	else
+		response = cluster.packresponse(session, false, msg)
+		socket.write(fd, response)
+	end
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, cmd)
+		if cmd == "exit" then
+			skynet.exit()
+		end
+	end)
+	skynet.dispatch("client", dispatch_request)
+	skynet.info_func(function()
+		return cluster.linkstat(large)
+	end)
+	if not pcall(skynet.call, gate, "lua", "forward", fd) then
+		-- the connection is closed before forwarding, newservice returns nil to clusterd
+		skynet.exit()
+	end
+end)
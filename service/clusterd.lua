@@ -1,53 +1,41 @@
 local skynet = require "skynet"
-local sc = require "skynet.socketchannel"
-local socket = require "skynet.socket"
-local cluster = require "skynet.cluster.core"
 
 local config_name = skynet.getenv "cluster"
+local channel_n = tonumber(skynet.getenv "cluster_channel") or 1	-- channels (clustersender) to each node
 local node_address = {}
-local node_session = {}
+local node_sender = {}	-- node -> { clustersender }
 local command = {}
 
-local function read_response(sock)
-	local sz = socket.header(sock:read(2))
-	local msg = sock:read(sz)
-	return cluster.unpackresponse(msg)	-- session, ok, data, padding
-end
-
 local connecting = {}
 
-local function open_channel(t, key)
-	local ct = connecting[key]
+local function open_sender(node)
+	local ct = connecting[node]
 	if ct then
 		local co = coroutine.running()
 		table.insert(ct, co)
 		skynet.wait(co)
-		return assert(ct.channel)
+		return assert(ct.sender)
 	end
 	ct = {}
-	connecting[key] = ct
-	local host, port = string.match(node_address[key], "([^:]+):(.*)$")
-	local c = sc.channel {
-		host = host,
-		port = tonumber(port),
-		response = read_response,
-		nodelay = true,
-	}
-	local succ, err = pcall(c.connect, c, true)
-	if succ then
-		t[key] = c
-		ct.channel = c
-	end
-	connecting[key] = nil
+	connecting[node] = ct
+	local succ, err = pcall(function()
+		local address = assert(node_address[node], "Invalid cluster node " .. tostring(node))
+		local host, port = string.match(address, "([^:]+):(.*)$")
+		local s = {}
+		for i = 1, channel_n do
+			s[i] = skynet.newservice("clustersender", node, host, port)
+		end
+		node_sender[node] = s
+		ct.sender = s
+	end)
+	connecting[node] = nil
 	for _, co in ipairs(ct) do
 		skynet.wakeup(co)
 	end
 	assert(succ, err)
-	return c
+	return ct.sender
 end
 
-local node_channel = setmetatable({}, { __index = open_channel })
-
 local function loadconfig(tmp)
 	if tmp == nil then
 		tmp = {}
@@ -62,8 +50,12 @@ local function loadconfig(tmp)
 		assert(type(address) == "string")
 		if node_address[name] ~= address then
 			-- address changed
-			if rawget(node_channel, name) then
-				node_channel[name] = nil	-- reset connection
+			local s = node_sender[name]
+			if s then
+				local host, port = string.match(address, "([^:]+):(.*)$")
+				for _, sender in ipairs(s) do
+					skynet.send(sender, "lua", "changenode", host, port)	-- reset connection
+				end
 			end
 			node_address[name] = address
 		end
@@ -84,47 +76,18 @@ function command.listen(source, addr, port)
 	skynet.ret(skynet.pack(nil))
 end
 
-local function send_request(source, node, addr, msg, sz)
-	local session = node_session[node] or 1
-	-- msg is a local pointer, cluster.packrequest will free it
-	local request, new_session, padding = cluster.packrequest(addr, session, msg, sz)
-	node_session[node] = new_session
-
-	-- node_channel[node] may yield or throw error
-	local c = node_channel[node]
-
-	return c:request(request, session, padding)
-end
-
-function command.req(...)
-	local ok, msg, sz = pcall(send_request, ...)
+function command.sender(source, node)
+	local ok, s = pcall(function()
+		return node_sender[node] or open_sender(node)
+	end)
 	if ok then
-		if type(msg) == "table" then
-			skynet.ret(cluster.concat(msg))
-		else
-			skynet.ret(msg)
-		end
+		skynet.ret(skynet.pack(s))
 	else
-		skynet.error(msg)
+		skynet.error(s)
 		skynet.response()(false)
 	end
 end
 
-function command.push(source, node, addr, msg, sz)
-	local session = node_session[node] or 1
-	local request, new_session, padding = cluster.packpush(addr, session, msg, sz)
-	if padding then	-- is multi push
-		node_session[node] = new_session
-	end
-
-	-- node_channel[node] may yield or throw error
-	local c = node_channel[node]
-
-	c:request(request, nil, padding)
-
-	-- notice: push may fail where the channel is disconnected or broken.
-end
-
 local proxy = {}
 
 function command.proxy(source, node, name)
@@ -150,75 +113,34 @@ function command.register(source, name, addr)
 	skynet.error(string.format("Register [%s] :%08x", name, addr))
 end
 
-local large_request = {}
+function command.queryname(source, name)
+	skynet.ret(skynet.pack(register_name[name]))
+end
+
+local agent = {}	-- fd -> clusteragent
 
 function command.socket(source, subcmd, fd, msg)
-	if subcmd == "data" then
-		local sz
-		local addr, session, msg, padding, is_push = cluster.unpackrequest(msg)
-		if padding then
-			local requests = large_request[fd]
-			if requests == nil then
-				requests = {}
-				large_request[fd] = requests
-			end
-			local req = requests[session] or { addr = addr , is_push = is_push }
-			requests[session] = req
-			table.insert(req, msg)
-			return
-		else
-			local requests = large_request[fd]
-			if requests then
-				local req = requests[session]
-				if req then
-					requests[session] = nil
-					table.insert(req, msg)
-					msg,sz = cluster.concat(req)
-					addr = req.addr
-					is_push = req.is_push
-				end
-			end
-			if not msg then
-				local response = cluster.packresponse(session, false, "Invalid large req")
-				socket.write(fd, response)
-				return
-			end
-		end
-		local ok, response
-		if addr == 0 then
-			local name = skynet.unpack(msg, sz)
-			local addr = register_name[name]
-			if addr then
-				ok = true
-				msg, sz = skynet.pack(addr)
-			else
-				ok = false
-				msg = "name not found"
-			end
-		elseif is_push then
-			skynet.rawsend(addr, "lua", msg, sz)
-			return	-- no response
-		else
-			ok , msg, sz = pcall(skynet.rawcall, addr, "lua", msg, sz)
+	if subcmd == "open" then
+		skynet.error(string.format("socket accept from %s", msg))
+		-- the requests of each connection are handled by its own agent
+		local pending = {}	-- the fd may be reused by another connection before the agent is launched
+		agent[fd] = pending
+		local a = skynet.newservice("clusteragent", skynet.self(), source, fd)
+		if agent[fd] == pending then
+			-- a is nil if the agent can't forward the fd (closed already)
+			agent[fd] = a
+		elseif a then
+			-- closed before the agent is launched
+			skynet.send(a, "lua", "exit")
 		end
-		if ok then
-			response = cluster.packresponse(session, true, msg, sz)
-			if type(response) == "table" then
-				for _, v in ipairs(response) do
-					socket.lwrite(fd, v)
-				end
-			else
-				socket.write(fd, response)
+	else
+		if subcmd == "close" or subcmd == "error" then
+			local a = agent[fd]
+			agent[fd] = nil
+			if type(a) == "number" then
+				skynet.send(a, "lua", "exit")
 			end
-		else
-			response = cluster.packresponse(session, false, msg)
-			socket.write(fd, response)
 		end
-	elseif subcmd == "open" then
-		skynet.error(string.format("socket accept from %s", msg))
-		skynet.call(source, "lua", "accept", fd)
-	else
-		large_request[fd] = nil
 		skynet.error(string.format("socket %s %d %s", subcmd, fd, msg or ""))
 	end
 end
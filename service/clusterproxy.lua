@@ -17,16 +17,16 @@ local forward_map = {
 }
 
 skynet.forward_type( forward_map ,function()
-	local clusterd = skynet.uniqueservice("clusterd")
 	local n = tonumber(address)
 	if n then
 		address = n
 	end
+	local sender = cluster.sender(node, address)
 	skynet.dispatch("system", function (session, source, msg, sz)
 		if session == 0 then
-			skynet.send(clusterd, "lua", "push", node, address, msg, sz)
+			skynet.send(sender, "lua", "push", address, msg, sz)
 		else
-			skynet.ret(skynet.rawcall(clusterd, "lua", skynet.pack("req", node, address, msg, sz)))
+			skynet.ret(skynet.rawcall(sender, "lua", skynet.pack("req", address, msg, sz)))
 		end
 	end)
 end)
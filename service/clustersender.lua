@@ -0,0 +1,89 @@
+local skynet = require "skynet"
+local sc = require "skynet.socketchannel"
+local socket = require "skynet.socket"
+local cluster = require "skynet.cluster.core"
+
+-- One channel to a remote node, clusterd launches cluster_channel senders for each node.
+
+local node, host, port = ...
+local channel
+local session = 1
+local command = {}
+-- the large responses are reassembled in it, one for each connection (see hello)
+local large_limit = tonumber(skynet.getenv "cluster_large_limit")
+local large = cluster.largebuffer(large_limit)
+local compress = tonumber(skynet.getenv "cluster_compress")
+
+local function read_response(sock)
+	local sz = socket.header(sock:read(2))
+	local msg = sock:read(sz)
+	return cluster.unpackresponse(msg, large)	-- session, ok, data, padding
+end
+
+local function send_request(addr, msg, sz)
+	local current_session = session
+	-- msg is a local pointer, cluster.packrequest will free it
+	local request, new_session, padding = cluster.packrequest(addr, current_session, msg, sz, large)
+	session = new_session
+
+	-- channel:request may yield or throw error
+	return channel:request(request, current_session, padding)
+end
+
+-- negotiate the compression after connected, the old node responds "name not found" to the hello.
+local function hello()
+	-- drop the unfinished responses of the last connection
+	large = cluster.largebuffer(large_limit)
+	local flags = cluster.negotiate(large, 0)
+	local ok, msg = pcall(send_request, 0, skynet.pack(cluster.hello, flags))
+	if ok then
+		cluster.negotiate(large, skynet.unpack(msg), compress)
+	end
+end
+
+function command.req(...)
+	local ok, msg = pcall(send_request, ...)
+	if ok then
+		if type(msg) == "table" then
+			-- the parts before the last one are nil, see cluster.unpackresponse
+			skynet.ret(cluster.take(msg[1]))
+		else
+			skynet.ret(msg)
+		end
+	else
+		skynet.error(msg)
+		skynet.response()(false)
+	end
+end
+
+function command.push(addr, msg, sz)
+	local request, new_session, padding = cluster.packpush(addr, session, msg, sz, large)
+	if padding then	-- is multi push
+		session = new_session
+	end
+
+	channel:request(request, nil, padding)
+
+	-- notice: push may fail where the channel is disconnected or broken.
+end
+
+function command.changenode(host, port)
+	channel:changehost(host, tonumber(port))
+end
+
+skynet.start(function()
+	channel = sc.channel {
+		host = host,
+		port = tonumber(port),
+		auth = hello,
+		response = read_response,
+		nodelay = true,
+	}
+	skynet.info_func(function()
+		return cluster.linkstat(large)
+	end)
+	skynet.dispatch("lua", function(session, source, cmd, ...)
+		local f = assert(command[cmd])
+		f(...)
+	end)
+end)
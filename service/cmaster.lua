@@ -11,7 +11,7 @@ local socket = require "skynet.socket"
 	protocol slave->master :
 		package size 1 byte
 		type 1 byte :
-			'H' : HANDSHAKE, report slave id, and address.
+			'H' : HANDSHAKE, report slave id, address, and flags of harbor link (optional).
 			'R' : REGISTER name address
 			'Q' : QUERY name
 
@@ -19,10 +19,15 @@ local socket = require "skynet.socket"
 	protocol master->slave:
 		package size 1 byte
 		type 1 byte :
+			'F' : FLAGS slave_id flags, the flags of the slaves (which advertise them) before WAIT,
+				only sent to the slave which advertises the flags.
 			'W' : WAIT n
-			'C' : CONNECT slave_id slave_address
+			'C' : CONNECT slave_id slave_address flags (if the slave advertises them)
 			'N' : NAME globalname address
 			'D' : DISCONNECT slave_id
+
+	The slaves which don't advertise the flags ignore them, and the links to them use the old (1 byte) handshake,
+	see service_harbor.c .
 ]]
 
 local slave_node = {}
@@ -43,12 +48,15 @@ local function pack_package(...)
 	return string.char(size) .. message
 end
 
-local function report_slave(fd, slave_id, slave_addr)
-	local message = pack_package("C", slave_id, slave_addr)
+local function report_slave(fd, slave_id, slave_addr, flags)
+	local message = pack_package("C", slave_id, slave_addr, flags)
 	local n = 0
 	for k,v in pairs(slave_node) do
 		if v.fd ~= 0 then
 			socket.write(v.fd, message)
+			if flags and v.flags then
+				socket.write(fd, pack_package("F", v.id, v.flags))
+			end
 			n = n + 1
 		end
 	end
@@ -56,17 +64,18 @@ local function report_slave(fd, slave_id, slave_addr)
 end
 
 local function handshake(fd)
-	local t, slave_id, slave_addr = read_package(fd)
+	local t, slave_id, slave_addr, flags = read_package(fd)
 	assert(t=='H', "Invalid handshake type " .. t)
 	assert(slave_id ~= 0 , "Invalid slave id 0")
 	if slave_node[slave_id] then
 		error(string.format("Slave %d already register on %s", slave_id, slave_node[slave_id].addr))
 	end
-	report_slave(fd, slave_id, slave_addr)
+	report_slave(fd, slave_id, slave_addr, flags)
 	slave_node[slave_id] = {
 		fd = fd,
 		id = slave_id,
 		addr = slave_addr,
+		flags = flags,
 	}
 	return slave_id , slave_addr
 end
@@ -12,6 +12,9 @@ local harbor = {}
 local harbor_service
 local monitor = {}
 local monitor_master_set = {}
+-- the flags of harbor link advertised to master (HARBOR_FLAG_LZ4, see service_harbor.c)
+local HARBOR_FLAGS = 1
+local harbor_flags = {}	-- slave_id -> flags, the slaves which advertise the flags
 
 local function read_package(fd)
 	local sz = socket.read(fd, 1)
@@ -38,7 +41,16 @@ local function monitor_clear(id)
 	end
 end
 
-local function connect_slave(slave_id, address)
+-- the harbor uses the handshake with flags only if the remote slave advertises them
+local function harbor_command(cmd, fd, slave_id, flags)
+	if flags then
+		return string.format("%s %d %d %d", cmd, fd, slave_id, flags)
+	else
+		return string.format("%s %d %d", cmd, fd, slave_id)
+	end
+end
+
+local function connect_slave(slave_id, address, flags)
 	local ok, err = pcall(function()
 		if slaves[slave_id] == nil then
 			local fd = assert(socket.open(address), "Can't connect to "..address)
@@ -47,7 +59,7 @@ local function connect_slave(slave_id, address)
 			slaves[slave_id] = fd
 			monitor_clear(slave_id)
 			socket.abandon(fd)
-			skynet.send(harbor_service, "harbor", string.format("S %d %d",fd,slave_id))
+			skynet.send(harbor_service, "harbor", harbor_command("S", fd, slave_id, flags))
 		end
 	end)
 	if not ok then
@@ -59,7 +71,7 @@ local function ready()
 	local queue = connect_queue
 	connect_queue = nil
 	for k,v in pairs(queue) do
-		connect_slave(k,v)
+		connect_slave(k,v.address,v.flags)
 	end
 	for name,address in pairs(globalname) do
 		skynet.redirect(harbor_service, address, "harbor", 0, "N " .. name)
@@ -79,13 +91,13 @@ end
 
 local function monitor_master(master_fd)
 	while true do
-		local ok, t, id_name, address = pcall(read_package,master_fd)
+		local ok, t, id_name, address, flags = pcall(read_package,master_fd)
 		if ok then
 			if t == 'C' then
 				if connect_queue then
-					connect_queue[id_name] = address
+					connect_queue[id_name] = { address = address, flags = flags }
 				else
-					connect_slave(id_name, address)
+					connect_slave(id_name, address, flags)
 				end
 			elseif t == 'N' then
 				globalname[id_name] = address
@@ -114,13 +126,19 @@ end
 
 local function accept_slave(fd)
 	socket.start(fd)
-	local id = socket.read(fd, 1)
-	if not id then
+	-- handshake : id, and flags if the remote slave advertises them, see service_harbor.c
+	local hs = socket.read(fd, 1)
+	local id = hs and string.byte(hs)
+	local flags
+	if id and harbor_flags[id] then
+		hs = socket.read(fd, 1)
+		flags = hs and string.byte(hs)
+	end
+	if not hs then
 		skynet.error(string.format("Connection (fd =%d) closed", fd))
 		socket.close(fd)
 		return
 	end
-	id = string.byte(id)
 	if slaves[id] ~= nil then
 		skynet.error(string.format("Slave %d exist (fd =%d)", id, fd))
 		socket.close(fd)
@@ -130,7 +148,7 @@ local function accept_slave(fd)
 	monitor_clear(id)
 	socket.abandon(fd)
 	skynet.error(string.format("Harbor %d connected (fd = %d)", id, fd))
-	skynet.send(harbor_service, "harbor", string.format("A %d %d", fd, id))
+	skynet.send(harbor_service, "harbor", harbor_command("A", fd, id, flags))
 end
 
 skynet.register_protocol {
@@ -240,10 +258,19 @@ skynet.start(function()
 	skynet.dispatch("text", monitor_harbor(master_fd))
 
 	harbor_service = assert(skynet.launch("harbor", harbor_id, skynet.self()))
+	skynet.info_func(function()
+		-- bytes on the link / before compression, and the cpu time of compression
+		return skynet.call(harbor_service, "harbor", "I")
+	end)
 
-	local hs_message = pack_package("H", harbor_id, slave_address)
+	local hs_message = pack_package("H", harbor_id, slave_address, HARBOR_FLAGS)
 	socket.write(master_fd, hs_message)
-	local t, n = read_package(master_fd)
+	local t, n, flags = read_package(master_fd)
+	while t == "F" do
+		-- the flags of the slaves which will connect to us, an old master doesn't send them
+		harbor_flags[n] = flags
+		t, n, flags = read_package(master_fd)
+	end
 	assert(t == "W" and type(n) == "number", "slave shakehand failed")
 	skynet.error(string.format("Waiting for %d harbors", n))
 	skynet.fork(monitor_master, master_fd)
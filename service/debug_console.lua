@@ -149,7 +149,7 @@ function COMMAND.help()
 		service = "List unique service",
 		task = "task address : show service task detail",
 		inject = "inject address luascript.lua",
-		logon = "logon address",
+		logon = "logon address [sample] : trace 1 of sample messages of the service, decode the trace by tools/tracedump.lua",
 		logoff = "logoff address",
 		log = "launch a new lua service with log",
 		debug = "debug address : debug a lua service",
@@ -299,9 +299,13 @@ function COMMANDX.debug(cmd)
 	end
 end
 
-function COMMAND.logon(address)
+function COMMAND.logon(address, sample)
 	address = adjust_address(address)
-	core.command("LOGON", skynet.address(address))
+	if sample then
+		core.command("LOGON", string.format("%s %d", skynet.address(address), math.tointeger(sample)))
+	else
+		core.command("LOGON", skynet.address(address))
+	end
 end
 
 function COMMAND.logoff(address)
@@ -8,6 +8,7 @@
 #include "malloc_hook.h"
 #include "skynet.h"
 #include "atomic.h"
+#include "socket_rbuffer.h"
 
 // turn on MEMORY_CHECK can do more memory check, such as double free
 // #define MEMORY_CHECK
@@ -174,6 +175,7 @@ skynet_malloc(size_t size) {
 void *
 skynet_realloc(void *ptr, size_t size) {
 	if (ptr == NULL) return skynet_malloc(size);
+	if (socket_rbuffer_owns(ptr)) return socket_rbuffer_realloc(ptr, size);
 
 	void* rawptr = clean_prefix(ptr);
 	void *newptr = je_realloc(rawptr, size+PREFIX_SIZE);
@@ -184,6 +186,11 @@ skynet_realloc(void *ptr, size_t size) {
 void
 skynet_free(void *ptr) {
 	if (ptr == NULL) return;
+	if (socket_rbuffer_owns(ptr)) {
+		// socket read buffer (or its message wrapper), see socket_rbuffer.h
+		socket_rbuffer_free(ptr);
+		return;
+	}
 	void* rawptr = clean_prefix(ptr);
 	je_free(rawptr);
 }
@@ -0,0 +1,147 @@
+#include "skynet.h"
+#include "skynet_epoch.h"
+#include "atomic.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE 64
+
+// An object retired in epoch e can be released when the global epoch reaches e + 2 .
+// The global epoch advances only when all the active readers have entered the current epoch.
+// Each thread keeps its own retired list, and tries to advance the epoch and release them every RETIRE_BATCH objects,
+// so retiring takes no lock.
+
+#define RETIRE_BATCH 16
+
+struct retired {
+	struct retired *next;
+	void *ptr;
+	epoch_release release;
+	unsigned epoch;
+};
+
+struct reader {
+	struct reader *next;
+	int depth;
+	unsigned active;	// 0 : not in critical section , (epoch << 1 | 1) : in critical section
+	// owned by the thread
+	int nretired;
+	struct retired *retired;
+	struct retired *freenode;
+	char padding[CACHE_LINE - sizeof(void *) * 3 - sizeof(int) * 3];
+};
+
+struct epoch {
+	unsigned epoch;
+	struct reader *reader;
+};
+
+static struct epoch E;
+static __thread struct reader *R = NULL;
+
+static struct reader *
+new_reader() {
+	struct reader *r = skynet_malloc(sizeof(*r));
+	memset(r, 0, sizeof(*r));
+	// reader never be released, because other thread may scan it.
+	struct reader *head;
+	do {
+		head = E.reader;
+		r->next = head;
+	} while (!ATOM_CAS_POINTER(&E.reader, head, r));
+	return r;
+}
+
+void
+skynet_epoch_enter(void) {
+	struct reader *r = R;
+	if (r == NULL) {
+		R = r = new_reader();
+	}
+	if (r->depth++ == 0) {
+		r->active = E.epoch << 1 | 1;
+		__sync_synchronize();
+	}
+}
+
+void
+skynet_epoch_leave(void) {
+	struct reader *r = R;
+	if (--r->depth == 0) {
+		__sync_lock_release(&r->active);
+	}
+}
+
+static int
+try_advance(unsigned epoch) {
+	struct reader *r;
+	__sync_synchronize();
+	for (r = E.reader; r; r = r->next) {
+		unsigned active = r->active;
+		if ((active & 1) && (active >> 1) != (epoch & (~0u >> 1))) {
+			return 0;
+		}
+	}
+	ATOM_CAS(&E.epoch, epoch, epoch + 1);
+	return 1;
+}
+
+// release the objects of reader r retired before epoch - 1, the nodes are kept for reuse.
+static void
+collect(struct reader *r, unsigned epoch) {
+	struct retired **prev = &r->retired;
+	struct retired *node;
+	while ((node = *prev)) {
+		if ((int)(epoch - node->epoch) >= 2) {
+			*prev = node->next;
+			node->release(node->ptr);
+			node->next = r->freenode;
+			r->freenode = node;
+			--r->nretired;
+		} else {
+			prev = &node->next;
+		}
+	}
+}
+
+void
+skynet_epoch_retire(void *ptr, epoch_release release) {
+	struct reader *r = R;
+	if (r == NULL) {
+		R = r = new_reader();
+	}
+	struct retired *node = r->freenode;
+	if (node) {
+		r->freenode = node->next;
+	} else {
+		node = skynet_malloc(sizeof(*node));
+	}
+	node->ptr = ptr;
+	node->release = release;
+	__sync_synchronize();
+	unsigned epoch = E.epoch;
+	node->epoch = epoch;
+	node->next = r->retired;
+	r->retired = node;
+	if (++r->nretired >= RETIRE_BATCH) {
+		if (try_advance(epoch)) {
+			++epoch;
+		}
+		collect(r, epoch);
+	}
+}
+
+void
+skynet_epoch_exit(void) {
+	struct reader *r;
+	for (r = E.reader; r; r = r->next) {
+		collect(r, E.epoch + 2);
+		while (r->freenode) {
+			struct retired *node = r->freenode;
+			r->freenode = node->next;
+			skynet_free(node);
+		}
+	}
+}
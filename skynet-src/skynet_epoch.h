@@ -0,0 +1,17 @@
+#ifndef SKYNET_EPOCH_H
+#define SKYNET_EPOCH_H
+
+// Epoch based reclamation for lock free structures.
+// A reader wraps its access in skynet_epoch_enter/skynet_epoch_leave (can be nested),
+// and the writer unlinks an object and calls skynet_epoch_retire to release it after a grace period.
+// The retired objects are released in batches by the thread which retires them, so the release function runs in that thread.
+
+typedef void (*epoch_release)(void *);
+
+void skynet_epoch_enter(void);
+void skynet_epoch_leave(void);
+void skynet_epoch_retire(void *ptr, epoch_release release);
+// release all the retired objects, call it only when no reader exists.
+void skynet_epoch_exit(void);
+
+#endif
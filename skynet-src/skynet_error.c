@@ -2,6 +2,7 @@
 #include "skynet_handle.h"
 #include "skynet_mq.h"
 #include "skynet_server.h"
+#include "skynet_logring.h"
 
 #include <stdarg.h>
 #include <stdio.h>
@@ -20,6 +21,7 @@ skynet_error(struct skynet_context * context, const char *msg, ...) {
 		return;
 	}
 
+	uint32_t source = context ? skynet_context_handle(context) : 0;
 	char tmp[LOG_MESSAGE_SIZE];
 	char *data = NULL;
 
@@ -29,6 +31,9 @@ skynet_error(struct skynet_context * context, const char *msg, ...) {
 	int len = vsnprintf(tmp, LOG_MESSAGE_SIZE, msg, ap);
 	va_end(ap);
 	if (len >=0 && len < LOG_MESSAGE_SIZE) {
+		if (skynet_logring_push(source, tmp, len)) {
+			return;
+		}
 		data = skynet_strdup(tmp);
 	} else {
 		int max_size = LOG_MESSAGE_SIZE;
@@ -49,14 +54,13 @@ skynet_error(struct skynet_context * context, const char *msg, ...) {
 		perror("vsnprintf error :");
 		return;
 	}
-
+	if (skynet_logring_push(source, data, len)) {
+		skynet_free(data);
+		return;
+	}
 
 	struct skynet_message smsg;
-	if (context == NULL) {
-		smsg.source = 0;
-	} else {
-		smsg.source = skynet_context_handle(context);
-	}
+	smsg.source = source;
 	smsg.session = 0;
 	smsg.data = data;
 	smsg.sz = len | ((size_t)PTYPE_TEXT << MESSAGE_TYPE_SHIFT);
@@ -2,6 +2,7 @@
 
 #include "skynet_handle.h"
 #include "skynet_server.h"
+#include "skynet_epoch.h"
 #include "rwlock.h"
 
 #include <stdlib.h>
@@ -11,9 +12,25 @@
 #define DEFAULT_SLOT_SIZE 4
 #define MAX_SLOT_SIZE 0x40000000
 
+#define DEFAULT_NAME_SIZE 16
+
+// Each name is linked in two hash chains : by name (for findname) and by handle (for retire).
+
 struct handle_name {
 	char * name;
 	uint32_t handle;
+	uint32_t hash;
+	struct handle_name *next_name;
+	struct handle_name *next_handle;
+};
+
+// The slot array is replaced as a whole when it grows, and the old one is retired (read skynet_epoch.h).
+// So skynet_handle_grab can read it without lock.
+// define USE_RWLOCK_HANDLE to grab with read lock.
+
+struct handle_slot {
+	int size;
+	struct skynet_context * ctx[1];
 };
 
 struct handle_storage {
@@ -21,16 +38,98 @@ struct handle_storage {
 
 	uint32_t harbor;
 	uint32_t handle_index;
-	int slot_size;
-	struct skynet_context ** slot;
+	struct handle_slot * slot;
 	
 	int name_cap;
 	int name_count;
-	struct handle_name *name;
+	struct handle_name ** name;
+	struct handle_name ** name_handle;
 };
 
 static struct handle_storage *H = NULL;
 
+static uint32_t
+name_hash(const char * name) {
+	// the same hash function of lua string
+	size_t l = strlen(name);
+	uint32_t h = (uint32_t)l;
+	size_t i;
+	for (i=0; i<l; i++) {
+		h ^= ((h<<5) + (h>>2) + (uint8_t)name[i]);
+	}
+	return h;
+}
+
+static struct handle_name *
+_find_name(struct handle_storage *s, const char * name, uint32_t hash) {
+	struct handle_name *n = s->name[hash & (s->name_cap-1)];
+	while (n) {
+		if (n->hash == hash && strcmp(n->name, name) == 0) {
+			return n;
+		}
+		n = n->next_name;
+	}
+	return NULL;
+}
+
+static void
+_remove_names(struct handle_storage *s, uint32_t handle) {
+	struct handle_name **prev = &s->name_handle[handle & (s->name_cap-1)];
+	struct handle_name *n;
+	while ((n = *prev)) {
+		if (n->handle != handle) {
+			prev = &n->next_handle;
+			continue;
+		}
+		*prev = n->next_handle;
+		struct handle_name **p = &s->name[n->hash & (s->name_cap-1)];
+		while (*p != n) {
+			p = &(*p)->next_name;
+		}
+		*p = n->next_name;
+		skynet_free(n->name);
+		skynet_free(n);
+		--s->name_count;
+	}
+}
+
+static void
+_expand_name(struct handle_storage *s) {
+	int cap = s->name_cap * 2;
+	assert(cap <= MAX_SLOT_SIZE);
+	struct handle_name ** name = skynet_malloc(cap * sizeof(struct handle_name *));
+	struct handle_name ** name_handle = skynet_malloc(cap * sizeof(struct handle_name *));
+	memset(name, 0, cap * sizeof(struct handle_name *));
+	memset(name_handle, 0, cap * sizeof(struct handle_name *));
+	int i;
+	for (i=0;i<s->name_cap;i++) {
+		struct handle_name *n = s->name[i];
+		while (n) {
+			struct handle_name *next = n->next_name;
+			struct handle_name **bucket = &name[n->hash & (cap-1)];
+			n->next_name = *bucket;
+			*bucket = n;
+			bucket = &name_handle[n->handle & (cap-1)];
+			n->next_handle = *bucket;
+			*bucket = n;
+			n = next;
+		}
+	}
+	skynet_free(s->name);
+	skynet_free(s->name_handle);
+	s->name = name;
+	s->name_handle = name_handle;
+	s->name_cap = cap;
+}
+
+static struct handle_slot *
+new_slot(int size) {
+	struct handle_slot * slot = skynet_malloc(sizeof(*slot) + (size - 1) * sizeof(struct skynet_context *));
+	memset(slot, 0, sizeof(*slot) + (size - 1) * sizeof(struct skynet_context *));
+	slot->size = size;
+	return slot;
+}
+
 uint32_t
 skynet_handle_register(struct skynet_context *ctx) {
 	struct handle_storage *s = H;
@@ -39,11 +138,12 @@ skynet_handle_register(struct skynet_context *ctx) {
 	
 	for (;;) {
 		int i;
-		for (i=0;i<s->slot_size;i++) {
+		struct handle_slot * slot = s->slot;
+		for (i=0;i<slot->size;i++) {
 			uint32_t handle = (i+s->handle_index) & HANDLE_MASK;
-			int hash = handle & (s->slot_size-1);
-			if (s->slot[hash] == NULL) {
-				s->slot[hash] = ctx;
+			int hash = handle & (slot->size-1);
+			if (slot->ctx[hash] == NULL) {
+				slot->ctx[hash] = ctx;
 				s->handle_index = handle + 1;
 
 				rwlock_wunlock(&s->lock);
@@ -52,17 +152,17 @@ skynet_handle_register(struct skynet_context *ctx) {
 				return handle;
 			}
 		}
-		assert((s->slot_size*2 - 1) <= HANDLE_MASK);
-		struct skynet_context ** new_slot = skynet_malloc(s->slot_size * 2 * sizeof(struct skynet_context *));
-		memset(new_slot, 0, s->slot_size * 2 * sizeof(struct skynet_context *));
-		for (i=0;i<s->slot_size;i++) {
-			int hash = skynet_context_handle(s->slot[i]) & (s->slot_size * 2 - 1);
-			assert(new_slot[hash] == NULL);
-			new_slot[hash] = s->slot[i];
+		assert((slot->size*2 - 1) <= HANDLE_MASK);
+		struct handle_slot * ns = new_slot(slot->size * 2);
+		for (i=0;i<slot->size;i++) {
+			int hash = skynet_context_handle(slot->ctx[i]) & (ns->size - 1);
+			assert(ns->ctx[hash] == NULL);
+			ns->ctx[hash] = slot->ctx[i];
 		}
-		skynet_free(s->slot);
-		s->slot = new_slot;
-		s->slot_size *= 2;
+		// publish the new slot array after it's filled
+		__sync_synchronize();
+		s->slot = ns;
+		skynet_epoch_retire(slot, skynet_free);
 	}
 }
 
@@ -73,24 +173,14 @@ skynet_handle_retire(uint32_t handle) {
 
 	rwlock_wlock(&s->lock);
 
-	uint32_t hash = handle & (s->slot_size-1);
-	struct skynet_context * ctx = s->slot[hash];
+	struct handle_slot * slot = s->slot;
+	uint32_t hash = handle & (slot->size-1);
+	struct skynet_context * ctx = slot->ctx[hash];
 
 	if (ctx != NULL && skynet_context_handle(ctx) == handle) {
-		s->slot[hash] = NULL;
+		slot->ctx[hash] = NULL;
 		ret = 1;
-		int i;
-		int j=0, n=s->name_count;
-		for (i=0; i<n; ++i) {
-			if (s->name[i].handle == handle) {
-				skynet_free(s->name[i].name);
-				continue;
-			} else if (i!=j) {
-				s->name[j] = s->name[i];
-			}
-			++j;
-		}
-		s->name_count = j;
+		_remove_names(s, handle);
 	} else {
 		ctx = NULL;
 	}
@@ -111,9 +201,9 @@ skynet_handle_retireall() {
 	for (;;) {
 		int n=0;
 		int i;
-		for (i=0;i<s->slot_size;i++) {
+		for (i=0;i<s->slot->size;i++) {
 			rwlock_rlock(&s->lock);
-			struct skynet_context * ctx = s->slot[i];
+			struct skynet_context * ctx = s->slot->ctx[i];
 			uint32_t handle = 0;
 			if (ctx)
 				handle = skynet_context_handle(ctx);
@@ -134,16 +224,25 @@ skynet_handle_grab(uint32_t handle) {
 	struct handle_storage *s = H;
 	struct skynet_context * result = NULL;
 
+#ifdef USE_RWLOCK_HANDLE
 	rwlock_rlock(&s->lock);
-
-	uint32_t hash = handle & (s->slot_size-1);
-	struct skynet_context * ctx = s->slot[hash];
-	if (ctx && skynet_context_handle(ctx) == handle) {
+#else
+	skynet_epoch_enter();
+#endif
+
+	struct handle_slot * slot = s->slot;
+	uint32_t hash = handle & (slot->size-1);
+	struct skynet_context * ctx = slot->ctx[hash];
+	// ctx may be retired by other thread, trygrab fails when its reference is zero
+	if (ctx && skynet_context_handle(ctx) == handle && skynet_context_trygrab(ctx)) {
 		result = ctx;
-		skynet_context_grab(result);
 	}
 
+#ifdef USE_RWLOCK_HANDLE
 	rwlock_runlock(&s->lock);
+#else
+	skynet_epoch_leave();
+#endif
 
 	return result;
 }
@@ -151,26 +250,14 @@ skynet_handle_grab(uint32_t handle) {
 uint32_t 
 skynet_handle_findname(const char * name) {
 	struct handle_storage *s = H;
+	uint32_t hash = name_hash(name);
 
 	rwlock_rlock(&s->lock);
 
 	uint32_t handle = 0;
-
-	int begin = 0;
-	int end = s->name_count - 1;
-	while (begin<=end) {
-		int mid = (begin+end)/2;
-		struct handle_name *n = &s->name[mid];
-		int c = strcmp(n->name, name);
-		if (c==0) {
-			handle = n->handle;
-			break;
-		}
-		if (c<0) {
-			begin = mid + 1;
-		} else {
-			end = mid - 1;
-		}
+	struct handle_name *n = _find_name(s, name, hash);
+	if (n) {
+		handle = n->handle;
 	}
 
 	rwlock_runlock(&s->lock);
@@ -178,54 +265,28 @@ skynet_handle_findname(const char * name) {
 	return handle;
 }
 
-static void
-_insert_name_before(struct handle_storage *s, char *name, uint32_t handle, int before) {
-	if (s->name_count >= s->name_cap) {
-		s->name_cap *= 2;
-		assert(s->name_cap <= MAX_SLOT_SIZE);
-		struct handle_name * n = skynet_malloc(s->name_cap * sizeof(struct handle_name));
-		int i;
-		for (i=0;i<before;i++) {
-			n[i] = s->name[i];
-		}
-		for (i=before;i<s->name_count;i++) {
-			n[i+1] = s->name[i];
-		}
-		skynet_free(s->name);
-		s->name = n;
-	} else {
-		int i;
-		for (i=s->name_count;i>before;i--) {
-			s->name[i] = s->name[i-1];
-		}
-	}
-	s->name[before].name = name;
-	s->name[before].handle = handle;
-	s->name_count ++;
-}
-
 static const char *
 _insert_name(struct handle_storage *s, const char * name, uint32_t handle) {
-	int begin = 0;
-	int end = s->name_count - 1;
-	while (begin<=end) {
-		int mid = (begin+end)/2;
-		struct handle_name *n = &s->name[mid];
-		int c = strcmp(n->name, name);
-		if (c==0) {
-			return NULL;
-		}
-		if (c<0) {
-			begin = mid + 1;
-		} else {
-			end = mid - 1;
-		}
+	uint32_t hash = name_hash(name);
+	if (_find_name(s, name, hash)) {
+		return NULL;
 	}
-	char * result = skynet_strdup(name);
-
-	_insert_name_before(s, result, handle, begin);
-
-	return result;
+	if (s->name_count >= s->name_cap) {
+		_expand_name(s);
+	}
+	struct handle_name *n = skynet_malloc(sizeof(*n));
+	n->name = skynet_strdup(name);
+	n->handle = handle;
+	n->hash = hash;
+	struct handle_name **bucket = &s->name[hash & (s->name_cap-1)];
+	n->next_name = *bucket;
+	*bucket = n;
+	bucket = &s->name_handle[handle & (s->name_cap-1)];
+	n->next_handle = *bucket;
+	*bucket = n;
+	++s->name_count;
+
+	return n->name;
 }
 
 const char * 
@@ -243,17 +304,18 @@ void
 skynet_handle_init(int harbor) {
 	assert(H==NULL);
 	struct handle_storage * s = skynet_malloc(sizeof(*H));
-	s->slot_size = DEFAULT_SLOT_SIZE;
-	s->slot = skynet_malloc(s->slot_size * sizeof(struct skynet_context *));
-	memset(s->slot, 0, s->slot_size * sizeof(struct skynet_context *));
+	s->slot = new_slot(DEFAULT_SLOT_SIZE);
 
 	rwlock_init(&s->lock);
 	// reserve 0 for system
 	s->harbor = (uint32_t) (harbor & 0xff) << HANDLE_REMOTE_SHIFT;
 	s->handle_index = 1;
-	s->name_cap = 2;
+	s->name_cap = DEFAULT_NAME_SIZE;
 	s->name_count = 0;
-	s->name = skynet_malloc(s->name_cap * sizeof(struct handle_name));
+	s->name = skynet_malloc(s->name_cap * sizeof(struct handle_name *));
+	s->name_handle = skynet_malloc(s->name_cap * sizeof(struct handle_name *));
+	memset(s->name, 0, s->name_cap * sizeof(struct handle_name *));
+	memset(s->name_handle, 0, s->name_cap * sizeof(struct handle_name *));
 
 	H = s;
 
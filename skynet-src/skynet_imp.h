@@ -5,11 +5,17 @@ struct skynet_config {
 	int thread;
 	int harbor;
 	int profile;
+	int worksteal;
+	int timer_tick;
+	int socket_thread;
+	int io_uring;
 	const char * daemon;
 	const char * module_path;
 	const char * bootstrap;
 	const char * logger;
 	const char * logservice;
+	int logbuffer;
+	int logflush;
 };
 
 #define THREAD_WORKER 0
@@ -5,8 +5,55 @@
 #include <string.h>
 #include <time.h>
 
-FILE * 
-skynet_log_open(struct skynet_context * ctx, uint32_t handle) {
+/*
+	The message trace of a service (LOGON) is a binary file, decode it by tools/tracedump.lua .
+	file header : struct trace_header
+	record : struct trace_record , payload (sz bytes)
+		PTYPE_SOCKET : int32 type, int32 id, int32 ud, data (TRACE_SOCKET_INLINE : the string in the message, or ud bytes of the buffer)
+		TRACE_CLOSE : the last record, no payload
+	All the integers are in native byte order.
+ */
+
+#define TRACE_MAGIC "SKYTRACE"
+#define TRACE_VERSION 1
+#define TRACE_BUFFER 0x10000
+#define TRACE_FLUSH 100	// centisecond
+
+#define TRACE_SOCKET_INLINE 1
+#define TRACE_CLOSE 2
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t handle;
+	uint32_t starttime;
+	uint32_t sample;
+	uint64_t opentime;
+};
+
+struct trace_record {
+	uint32_t source;
+	int32_t session;
+	uint32_t time;
+	uint32_t sz;
+	uint8_t type;
+	uint8_t flags;
+	uint16_t reserved;
+};
+
+struct skynet_log {
+	FILE * f;
+	uint32_t handle;
+	uint32_t sample;
+	uint32_t count;
+	int header;
+	uint64_t opentime;
+	uint64_t flushtime;
+	char buffer[TRACE_BUFFER];
+};
+
+struct skynet_log *
+skynet_log_open(struct skynet_context * ctx, uint32_t handle, int sample) {
 	const char * logpath = skynet_getenv("logpath");
 	if (logpath == NULL)
 		return NULL;
@@ -14,64 +61,110 @@ skynet_log_open(struct skynet_context * ctx, uint32_t handle) {
 	char tmp[sz + 16];
 	sprintf(tmp, "%s/%08x.log", logpath, handle);
 	FILE *f = fopen(tmp, "ab");
-	if (f) {
-		uint32_t starttime = skynet_starttime();
-		uint64_t currenttime = skynet_now();
-		time_t ti = starttime + currenttime/100;
-		skynet_error(ctx, "Open log file %s", tmp);
-		fprintf(f, "open time: %u %s", (uint32_t)currenttime, ctime(&ti));
-		fflush(f);
-	} else {
+	if (f == NULL) {
 		skynet_error(ctx, "Open log file %s fail", tmp);
+		return NULL;
+	}
+	struct skynet_log * l = skynet_malloc(sizeof(*l));
+	l->f = f;
+	l->handle = handle;
+	l->sample = sample > 1 ? sample : 1;
+	l->count = 0;
+	l->header = 0;
+	l->opentime = skynet_now();
+	l->flushtime = l->opentime;
+	setvbuf(f, l->buffer, _IOFBF, TRACE_BUFFER);
+	if (l->sample > 1) {
+		skynet_error(ctx, "Open log file %s (sample 1/%u)", tmp, l->sample);
+	} else {
+		skynet_error(ctx, "Open log file %s", tmp);
 	}
-	return f;
+	return l;
 }
 
-void
-skynet_log_close(struct skynet_context * ctx, FILE *f, uint32_t handle) {
-	skynet_error(ctx, "Close log file :%08x", handle);
-	fprintf(f, "close time: %u\n", (uint32_t)skynet_now());
-	fclose(f);
+// The header is written with the first record, so a log that is opened but never used (see cmd_logon) leaves nothing in the file.
+static void
+write_header(struct skynet_log * l) {
+	struct trace_header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+	h.version = TRACE_VERSION;
+	h.handle = l->handle;
+	h.starttime = skynet_starttime();
+	h.sample = l->sample;
+	h.opentime = l->opentime;
+	fwrite(&h, sizeof(h), 1, l->f);
+	l->header = 1;
 }
 
 static void
-log_blob(FILE *f, void * buffer, size_t sz) {
-	size_t i;
-	uint8_t * buf = buffer;
-	for (i=0;i!=sz;i++) {
-		fprintf(f, "%02x", buf[i]);
+write_record(struct skynet_log * l, uint32_t source, int type, int session, uint32_t sz, int flags) {
+	struct trace_record r;
+	r.source = source;
+	r.session = session;
+	r.time = (uint32_t)skynet_now();
+	r.sz = sz;
+	r.type = (uint8_t)type;
+	r.flags = (uint8_t)flags;
+	r.reserved = 0;
+	fwrite(&r, sizeof(r), 1, l->f);
+}
+
+void
+skynet_log_close(struct skynet_context * ctx, struct skynet_log * l, uint32_t handle) {
+	skynet_error(ctx, "Close log file :%08x", handle);
+	if (!l->header) {
+		write_header(l);
 	}
+	write_record(l, 0, 0, 0, 0, TRACE_CLOSE);
+	skynet_log_free(l);
 }
 
-static void
-log_socket(FILE * f, struct skynet_socket_message * message, size_t sz) {
-	fprintf(f, "[socket] %d %d %d ", message->type, message->id, message->ud);
+void
+skynet_log_free(struct skynet_log * l) {
+	fclose(l->f);
+	skynet_free(l);
+}
 
+static void
+log_socket(struct skynet_log * l, uint32_t source, struct skynet_socket_message * message, size_t sz) {
+	int32_t head[3] = { message->type, message->id, message->ud };
+	const void * data;
+	int flags = 0;
 	if (message->buffer == NULL) {
-		const char *buffer = (const char *)(message + 1);
+		data = message + 1;
 		sz -= sizeof(*message);
-		const char * eol = memchr(buffer, '\0', sz);
+		const char * eol = memchr(data, '\0', sz);
 		if (eol) {
-			sz = eol - buffer;
+			sz = eol - (const char *)data;
 		}
-		fprintf(f, "[%*s]", (int)sz, (const char *)buffer);
+		flags = TRACE_SOCKET_INLINE;
 	} else {
+		data = message->buffer;
 		sz = message->ud;
-		log_blob(f, message->buffer, sz);
 	}
-	fprintf(f, "\n");
-	fflush(f);
+	write_record(l, source, PTYPE_SOCKET, 0, (uint32_t)(sizeof(head) + sz), flags);
+	fwrite(head, sizeof(head), 1, l->f);
+	fwrite(data, sz, 1, l->f);
 }
 
-void 
-skynet_log_output(FILE *f, uint32_t source, int type, int session, void * buffer, size_t sz) {
+void
+skynet_log_output(struct skynet_log * l, uint32_t source, int type, int session, void * buffer, size_t sz) {
+	if (l->sample > 1 && l->count++ % l->sample != 0)
+		return;
+	if (!l->header) {
+		write_header(l);
+	}
 	if (type == PTYPE_SOCKET) {
-		log_socket(f, buffer, sz);
+		log_socket(l, source, buffer, sz);
 	} else {
-		uint32_t ti = (uint32_t)skynet_now();
-		fprintf(f, ":%08x %d %d %u ", source, type, session, ti);
-		log_blob(f, buffer, sz);
-		fprintf(f,"\n");
-		fflush(f);
+		write_record(l, source, type, session, (uint32_t)sz, 0);
+		fwrite(buffer, sz, 1, l->f);
+	}
+	// flush the buffer every TRACE_FLUSH, instead of each message
+	uint64_t now = skynet_now();
+	if (now - l->flushtime >= TRACE_FLUSH) {
+		fflush(l->f);
+		l->flushtime = now;
 	}
 }
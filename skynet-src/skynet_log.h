@@ -7,8 +7,13 @@
 #include <stdio.h>
 #include <stdint.h>
 
-FILE * skynet_log_open(struct skynet_context * ctx, uint32_t handle);
-void skynet_log_close(struct skynet_context * ctx, FILE *f, uint32_t handle);
-void skynet_log_output(FILE *f, uint32_t source, int type, int session, void * buffer, size_t sz);
+struct skynet_log;
+
+// record 1 of sample messages (sample <= 1 : all of them)
+struct skynet_log * skynet_log_open(struct skynet_context * ctx, uint32_t handle, int sample);
+void skynet_log_close(struct skynet_context * ctx, struct skynet_log *l, uint32_t handle);
+// release a log which records nothing, without the close record
+void skynet_log_free(struct skynet_log *l);
+void skynet_log_output(struct skynet_log *l, uint32_t source, int type, int session, void * buffer, size_t sz);
 
 #endif
\ No newline at end of file
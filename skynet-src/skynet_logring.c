@@ -0,0 +1,392 @@
+#include "skynet.h"
+#include "skynet_logring.h"
+#include "skynet_timer.h"
+#include "atomic.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#define CACHE_LINE 64
+#define DEFAULT_RING_SIZE 0x10000
+#define MIN_RING_SIZE 0x1000
+#define DEFAULT_FLUSH 100
+#define PUSH_RETRY 8
+#define FLUSH_LINE 256	// 3 iovecs per line, less than IOV_MAX
+#define PREFIX_SIZE 48
+
+#define RECORD_WRAP 0xffffffff	// skip the rest of the ring
+#define RECORD_HEAP 0x80000000	// the text is too long for the ring, a pointer to the copy follows the header
+#define RECORD_SIZE(sz) ((sizeof(struct record) + (sz) + 15) & ~(size_t)15)
+
+// 16 bytes, all the records are aligned to 16 bytes, so the header of RECORD_WRAP always fits the rest of the ring.
+struct record {
+	uint32_t sz;
+	uint32_t source;
+	uint64_t time;	// skynet_now()
+};
+
+// single producer (the owner thread), single consumer (the flusher thread)
+struct log_ring {
+	struct log_ring * next;
+	char * buffer;
+	size_t head;	// written by producer
+	char padding[CACHE_LINE - sizeof(void *) * 2 - sizeof(size_t)];
+	size_t tail;	// written by flusher
+	size_t read;	// flusher private : the records before it are in the batch
+	size_t end;	// flusher private : the head when the batch begins
+	uint32_t dropped;
+};
+
+struct logring {
+	int enabled;
+	int quit;
+	int reopen;
+	int sleep;
+	int flush;
+	size_t size;
+	FILE * handle;
+	char * filename;
+	struct log_ring * ring;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	// the batch, only for flusher thread
+	int niov;
+	int nline;
+	int nheap;
+	struct iovec iov[FLUSH_LINE * 3];
+	char prefix[FLUSH_LINE][PREFIX_SIZE];
+	void * heap[FLUSH_LINE];
+	uint32_t second;
+	char timestr[32];
+};
+
+static struct logring LR;
+static __thread struct log_ring * R = NULL;
+
+static struct log_ring *
+new_ring() {
+	struct log_ring * r = skynet_malloc(sizeof(*r));
+	memset(r, 0, sizeof(*r));
+	r->buffer = skynet_malloc(LR.size);
+	// ring never be released, because the flusher may read it.
+	struct log_ring * head;
+	do {
+		head = LR.ring;
+		r->next = head;
+	} while (!ATOM_CAS_POINTER(&LR.ring, head, r));
+	return r;
+}
+
+static void
+wakeup() {
+	if (LR.sleep) {
+		pthread_mutex_lock(&LR.mutex);
+		pthread_cond_signal(&LR.cond);
+		pthread_mutex_unlock(&LR.mutex);
+	}
+}
+
+static int
+ring_push(struct log_ring * r, uint32_t source, const char * msg, size_t sz) {
+	int heap = sz > LR.size / 4;
+	size_t total = RECORD_SIZE(heap ? sizeof(void *) : sz);
+	size_t head = r->head;
+	size_t tail = r->tail;
+	__sync_synchronize();
+	size_t pos = head & (LR.size - 1);
+	size_t contiguous = LR.size - pos;
+	size_t need = contiguous < total ? contiguous + total : total;
+	if (LR.size - (head - tail) < need)
+		return 0;
+	if (contiguous < total) {
+		struct record * wrap = (struct record *)(r->buffer + pos);
+		wrap->sz = RECORD_WRAP;
+		head += contiguous;
+		pos = 0;
+	}
+	struct record * rec = (struct record *)(r->buffer + pos);
+	rec->source = source;
+	rec->time = skynet_now();
+	if (heap) {
+		char * copy = skynet_malloc(sz);
+		memcpy(copy, msg, sz);
+		rec->sz = (uint32_t)sz | RECORD_HEAP;
+		memcpy(rec + 1, &copy, sizeof(copy));
+	} else {
+		rec->sz = (uint32_t)sz;
+		memcpy(rec + 1, msg, sz);
+	}
+	__sync_synchronize();
+	r->head = head + total;
+	return 1;
+}
+
+static int
+format_prefix(char * prefix, uint32_t source, uint64_t now) {
+	uint32_t second = skynet_starttime() + (uint32_t)(now / 100);
+	if (second != LR.second || LR.timestr[0] == 0) {
+		time_t t = second;
+		struct tm tm;
+		localtime_r(&t, &tm);
+		strftime(LR.timestr, sizeof(LR.timestr), "%Y-%m-%d %H:%M:%S", &tm);
+		LR.second = second;
+	}
+	return snprintf(prefix, PREFIX_SIZE, "[:%08x] [%s.%02d] ", source, LR.timestr, (int)(now % 100));
+}
+
+static void
+write_iov(struct iovec * iov, int n) {
+	int fd = fileno(LR.handle);
+	while (n > 0) {
+		ssize_t wt = writev(fd, iov, n);
+		if (wt < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "logger write error : %s\n", strerror(errno));
+			return;
+		}
+		while (n > 0 && (size_t)wt >= iov->iov_len) {
+			wt -= iov->iov_len;
+			++iov;
+			--n;
+		}
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + wt;
+			iov->iov_len -= wt;
+		}
+	}
+}
+
+static void
+batch_line(const char * prefix, int psz, const char * msg, size_t sz) {
+	struct iovec * iov = &LR.iov[LR.niov];
+	iov[0].iov_base = (void *)prefix;
+	iov[0].iov_len = psz;
+	iov[1].iov_base = (void *)msg;
+	iov[1].iov_len = sz;
+	iov[2].iov_base = "\n";
+	iov[2].iov_len = 1;
+	LR.niov += 3;
+	++LR.nline;
+}
+
+// write the batch, and release the ring space of it
+static void
+commit() {
+	write_iov(LR.iov, LR.niov);
+	int i;
+	for (i=0;i<LR.nheap;i++) {
+		skynet_free(LR.heap[i]);
+	}
+	__sync_synchronize();
+	struct log_ring * r;
+	for (r = LR.ring; r; r = r->next) {
+		r->tail = r->read;
+	}
+	LR.niov = 0;
+	LR.nline = 0;
+	LR.nheap = 0;
+}
+
+static struct record *
+next_record(struct log_ring * r) {
+	while (r->read != r->end) {
+		size_t pos = r->read & (LR.size - 1);
+		struct record * rec = (struct record *)(r->buffer + pos);
+		if (rec->sz != RECORD_WRAP)
+			return rec;
+		r->read += LR.size - pos;
+	}
+	return NULL;
+}
+
+static void
+batch_record(struct log_ring * r, struct record * rec) {
+	const char * msg;
+	uint32_t sz = rec->sz & ~RECORD_HEAP;
+	if (rec->sz & RECORD_HEAP) {
+		void * copy;
+		memcpy(&copy, rec + 1, sizeof(copy));
+		LR.heap[LR.nheap++] = copy;
+		msg = copy;
+		r->read += RECORD_SIZE(sizeof(copy));
+	} else {
+		msg = (const char *)(rec + 1);
+		r->read += RECORD_SIZE(sz);
+	}
+	char * prefix = LR.prefix[LR.nline];
+	batch_line(prefix, format_prefix(prefix, rec->source, rec->time), msg, sz);
+}
+
+// merge the rings by time, so the lines of different threads are in order (in the precision of skynet_now)
+static void
+flush_rings() {
+	struct log_ring * r;
+	__sync_synchronize();
+	for (r = LR.ring; r; r = r->next) {
+		r->read = r->tail;
+		r->end = r->head;
+	}
+	__sync_synchronize();
+	for (;;) {
+		struct log_ring * best = NULL;
+		struct record * best_rec = NULL;
+		for (r = LR.ring; r; r = r->next) {
+			struct record * rec = next_record(r);
+			if (rec && (best == NULL || rec->time < best_rec->time)) {
+				best = r;
+				best_rec = rec;
+			}
+		}
+		if (best == NULL)
+			break;
+		batch_record(best, best_rec);
+		if (LR.nline == FLUSH_LINE) {
+			commit();
+		}
+	}
+	for (r = LR.ring; r; r = r->next) {
+		uint32_t dropped = r->dropped;
+		if (dropped && LR.nline < FLUSH_LINE) {
+			ATOM_SUB(&r->dropped, dropped);
+			char * prefix = LR.prefix[LR.nline];
+			int sz = snprintf(prefix, PREFIX_SIZE, "[:00000000] %u log lines dropped", dropped);
+			batch_line(prefix, sz, "", 0);
+		}
+	}
+	commit();
+}
+
+static void
+reopen() {
+	if (LR.filename) {
+		FILE * f = freopen(LR.filename, "a", LR.handle);
+		if (f == NULL) {
+			fprintf(stderr, "Can't reopen log file %s : %s\n", LR.filename, strerror(errno));
+			return;
+		}
+		LR.handle = f;
+	}
+}
+
+static void *
+thread_flusher(void *p) {
+	for (;;) {
+		flush_rings();
+		if (LR.reopen) {
+			LR.reopen = 0;
+			reopen();
+		}
+		if (LR.quit)
+			break;
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += LR.flush / 1000;
+		ts.tv_nsec += (LR.flush % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_nsec -= 1000000000;
+			++ts.tv_sec;
+		}
+		pthread_mutex_lock(&LR.mutex);
+		if (!LR.quit && !LR.reopen) {
+			LR.sleep = 1;
+			pthread_cond_timedwait(&LR.cond, &LR.mutex, &ts);
+			LR.sleep = 0;
+		}
+		pthread_mutex_unlock(&LR.mutex);
+	}
+	return NULL;
+}
+
+int
+skynet_logring_init(const char * filename, int size, int flush) {
+	size_t sz = MIN_RING_SIZE;
+	if (size <= 0) {
+		size = DEFAULT_RING_SIZE;
+	}
+	while (sz < (size_t)size) {
+		sz *= 2;
+	}
+	LR.size = sz;
+	LR.flush = flush > 0 ? flush : DEFAULT_FLUSH;
+	if (filename) {
+		LR.handle = fopen(filename, "w");
+		if (LR.handle == NULL) {
+			return 1;
+		}
+		LR.filename = skynet_strdup(filename);
+	} else {
+		LR.handle = stdout;
+	}
+	if (pthread_mutex_init(&LR.mutex, NULL) || pthread_cond_init(&LR.cond, NULL)) {
+		return 1;
+	}
+	if (pthread_create(&LR.thread, NULL, thread_flusher, NULL)) {
+		return 1;
+	}
+	LR.enabled = 1;
+	return 0;
+}
+
+int
+skynet_logring_enabled(void) {
+	return LR.enabled;
+}
+
+int
+skynet_logring_push(uint32_t source, const char * msg, size_t sz) {
+	if (!LR.enabled)
+		return 0;
+	if (LR.quit) {
+		// only main thread is alive
+		char prefix[PREFIX_SIZE];
+		batch_line(prefix, format_prefix(prefix, source, skynet_now()), msg, sz);
+		write_iov(LR.iov, LR.niov);
+		LR.niov = 0;
+		LR.nline = 0;
+		return 1;
+	}
+	struct log_ring * r = R;
+	if (r == NULL) {
+		R = r = new_ring();
+	}
+	int i;
+	for (i=0; !ring_push(r, source, msg, sz); i++) {
+		if (i >= PUSH_RETRY) {
+			ATOM_INC(&r->dropped);
+			return 1;
+		}
+		wakeup();
+		sched_yield();
+	}
+	if (r->head - r->tail > LR.size / 2) {
+		wakeup();
+	}
+	return 1;
+}
+
+void
+skynet_logring_reopen(void) {
+	if (LR.enabled) {
+		LR.reopen = 1;
+		wakeup();
+	}
+}
+
+void
+skynet_logring_exit(void) {
+	if (!LR.enabled || LR.quit)
+		return;
+	pthread_mutex_lock(&LR.mutex);
+	LR.quit = 1;
+	pthread_cond_signal(&LR.cond);
+	pthread_mutex_unlock(&LR.mutex);
+	pthread_join(LR.thread, NULL);
+}
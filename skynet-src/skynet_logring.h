@@ -0,0 +1,20 @@
+#ifndef SKYNET_LOGRING_H
+#define SKYNET_LOGRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Asynchronous logger : each thread appends the log lines to its own ring,
+// and a flusher thread writes them to the log file in batches (every flush milliseconds, or when a ring is half full).
+
+// size : bytes of each ring, flush : in millisecond. filename NULL is stdout. returns 0 if succeed.
+int skynet_logring_init(const char * filename, int size, int flush);
+int skynet_logring_enabled(void);
+// returns 0 if the asynchronous logger is not enabled.
+int skynet_logring_push(uint32_t source, const char * msg, size_t sz);
+// reopen the log file (SIGHUP)
+void skynet_logring_reopen(void);
+// write all the lines and stop the flusher thread, the lines pushed after it are written synchronously.
+void skynet_logring_exit(void);
+
+#endif
@@ -156,7 +156,13 @@ main(int argc, char *argv[]) {
 	config.daemon = optstring("daemon", NULL);
 	config.logger = optstring("logger", NULL);
 	config.logservice = optstring("logservice", "logger");
+	config.logbuffer = optint("logbuffer", 0);
+	config.logflush = optint("logflush", 100);
 	config.profile = optboolean("profile", 1);
+	config.worksteal = optboolean("worksteal", 0);
+	config.timer_tick = optint("timer_tick", 10000);
+	config.socket_thread = optint("socket_thread", 1);
+	config.io_uring = optboolean("io_uring", 1);
 
 	lua_close(L);
 
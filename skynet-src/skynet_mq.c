@@ -2,6 +2,8 @@
 #include "skynet_mq.h"
 #include "skynet_handle.h"
 #include "spinlock.h"
+#include "atomic.h"
+#include "skynet_epoch.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,6 +19,9 @@
 
 #define MQ_IN_GLOBAL 1
 #define MQ_OVERLOAD 1024
+#define CACHE_LINE 64
+
+#ifdef USE_SPINLOCK_MQ
 
 struct message_queue {
 	struct spinlock lock;
@@ -32,6 +37,44 @@ struct message_queue {
 	struct message_queue *next;
 };
 
+#else
+
+// Lock free multi-producer/single-consumer queue.
+// Messages are stored in a linked list of fixed size segments, a producer claims a position by atomic increasing tail,
+// so expanding the queue only links a new segment and never copies the messages.
+// The consumer retires the drained segments, they are released after a grace period (read skynet_epoch.h).
+
+#define SEGMENT_SIZE DEFAULT_QUEUE_SIZE
+
+struct slot {
+	int ready;
+	struct skynet_message msg;
+};
+
+struct segment {
+	struct segment *next;
+	uint64_t id;
+	struct slot slot[SEGMENT_SIZE];
+};
+
+struct message_queue {
+	// producer side
+	uint64_t tail;
+	struct segment *tail_seg;
+	char padding[CACHE_LINE - sizeof(uint64_t) - sizeof(void *)];
+	// consumer side
+	uint64_t head;
+	struct segment *head_seg;
+	uint32_t handle;
+	int release;
+	int in_global;
+	int overload;
+	int overload_threshold;
+	struct message_queue *next;
+};
+
+#endif
+
 struct global_queue {
 	struct message_queue *head;
 	struct message_queue *tail;
@@ -40,10 +83,28 @@ struct global_queue {
 
 static struct global_queue *Q = NULL;
 
-void 
-skynet_globalmq_push(struct message_queue * queue) {
-	struct global_queue *q= Q;
+// Work stealing mode : each worker owns a local run queue (L[id]).
+// Workers push ready queues to their own local queue, other threads (socket, timer) spread them round robin.
+// An idle worker steals from the others, Q is still checked for the queues pushed before workers start.
+
+// each local queue takes its own cache line, the owner and the thieves lock the neighbours without false sharing.
+union local_slot {
+	struct global_queue q;
+	char padding[CACHE_LINE];
+};
+
+struct local_queue {
+	int count;
+	union local_slot *q;
+	char padding[CACHE_LINE - sizeof(int) - sizeof(void *)];
+	int next;	// written by socket and timer threads
+};
+
+static struct local_queue L;
+static __thread int WORKER = -1;
 
+static void
+queue_push(struct global_queue *q, struct message_queue * queue) {
 	SPIN_LOCK(q)
 	assert(queue->next == NULL);
 	if(q->tail) {
@@ -55,9 +116,11 @@ skynet_globalmq_push(struct message_queue * queue) {
 	SPIN_UNLOCK(q)
 }
 
-struct message_queue * 
-skynet_globalmq_pop() {
-	struct global_queue *q = Q;
+static struct message_queue *
+queue_pop(struct global_queue *q) {
+	// read head without lock first, it's only a hint to skip the empty queue
+	if (q->head == NULL)
+		return NULL;
 
 	SPIN_LOCK(q)
 	struct message_queue *mq = q->head;
@@ -74,6 +137,61 @@ skynet_globalmq_pop() {
 	return mq;
 }
 
+void 
+skynet_globalmq_push(struct message_queue * queue) {
+	if (L.count == 0) {
+		queue_push(Q, queue);
+		return;
+	}
+	int id = WORKER;
+	if (id < 0) {
+		id = (unsigned)ATOM_FINC(&L.next) % L.count;
+	}
+	queue_push(&L.q[id].q, queue);
+}
+
+struct message_queue * 
+skynet_globalmq_pop() {
+	if (L.count == 0) {
+		return queue_pop(Q);
+	}
+	struct message_queue *mq;
+	int i;
+	int id = WORKER < 0 ? 0 : WORKER;
+	// i == 0 is the worker's own queue, others are steal from
+	for (i=0;i<L.count;i++) {
+		mq = queue_pop(&L.q[(id + i) % L.count].q);
+		if (mq)
+			return mq;
+	}
+	return queue_pop(Q);
+}
+
+void
+skynet_globalmq_bind(int worker) {
+	if (L.count > 0) {
+		assert(worker >= 0 && worker < L.count);
+		WORKER = worker;
+	}
+}
+
+uint32_t 
+skynet_mq_handle(struct message_queue *q) {
+	return q->handle;
+}
+
+int
+skynet_mq_overload(struct message_queue *q) {
+	if (q->overload) {
+		int overload = q->overload;
+		q->overload = 0;
+		return overload;
+	} 
+	return 0;
+}
+
+#ifdef USE_SPINLOCK_MQ
+
 struct message_queue * 
 skynet_mq_create(uint32_t handle) {
 	struct message_queue *q = skynet_malloc(sizeof(*q));
@@ -103,11 +221,6 @@ _release(struct message_queue *q) {
 	skynet_free(q);
 }
 
-uint32_t 
-skynet_mq_handle(struct message_queue *q) {
-	return q->handle;
-}
-
 int
 skynet_mq_length(struct message_queue *q) {
 	int head, tail,cap;
@@ -124,16 +237,6 @@ skynet_mq_length(struct message_queue *q) {
 	return tail + cap - head;
 }
 
-int
-skynet_mq_overload(struct message_queue *q) {
-	if (q->overload) {
-		int overload = q->overload;
-		q->overload = 0;
-		return overload;
-	} 
-	return 0;
-}
-
 int
 skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
 	int ret = 1;
@@ -171,6 +274,42 @@ skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
 	return ret;
 }
 
+int
+skynet_mq_pop_batch(struct message_queue *q, struct skynet_message *msgs, int max) {
+	int n = 0;
+	SPIN_LOCK(q)
+
+	int head = q->head;
+	int tail = q->tail;
+	int cap = q->cap;
+	while (n < max && head != tail) {
+		msgs[n++] = q->queue[head++];
+		if (head >= cap) {
+			head = 0;
+		}
+	}
+	q->head = head;
+
+	if (n > 0) {
+		int length = tail - head;
+		if (length < 0) {
+			length += cap;
+		}
+		while (length > q->overload_threshold) {
+			q->overload = length;
+			q->overload_threshold *= 2;
+		}
+	} else {
+		// reset overload_threshold when queue is empty
+		q->overload_threshold = MQ_OVERLOAD;
+		q->in_global = 0;
+	}
+
+	SPIN_UNLOCK(q)
+
+	return n;
+}
+
 static void
 expand_queue(struct message_queue *q) {
 	struct skynet_message *new_queue = skynet_malloc(sizeof(struct skynet_message) * q->cap * 2);
@@ -208,14 +347,6 @@ skynet_mq_push(struct message_queue *q, struct skynet_message *message) {
 	SPIN_UNLOCK(q)
 }
 
-void 
-skynet_mq_init() {
-	struct global_queue *q = skynet_malloc(sizeof(*q));
-	memset(q,0,sizeof(*q));
-	SPIN_INIT(q);
-	Q=q;
-}
-
 void 
 skynet_mq_mark_release(struct message_queue *q) {
 	SPIN_LOCK(q)
@@ -248,3 +379,267 @@ skynet_mq_release(struct message_queue *q, message_drop drop_func, void *ud) {
 		SPIN_UNLOCK(q)
 	}
 }
+
+#else
+
+// The released segments are cached by the thread which releases them (the consumer collects its retired segments),
+// and reused by the producers in the same thread, so a busy queue doesn't malloc/free a segment for every SEGMENT_SIZE messages.
+#define SEGMENT_CACHE 16
+
+struct segment_cache {
+	int n;
+	struct segment *list;
+};
+
+static __thread struct segment_cache SC;
+
+static struct segment *
+new_segment(uint64_t id) {
+	struct segment *s = SC.list;
+	if (s) {
+		SC.list = s->next;
+		--SC.n;
+	} else {
+		s = skynet_malloc(sizeof(*s));
+	}
+	memset(s, 0, sizeof(*s));
+	s->id = id;
+	return s;
+}
+
+static void
+free_segment(void *p) {
+	struct segment *s = p;
+	if (SC.n >= SEGMENT_CACHE) {
+		skynet_free(s);
+		return;
+	}
+	s->next = SC.list;
+	SC.list = s;
+	++SC.n;
+}
+
+struct message_queue * 
+skynet_mq_create(uint32_t handle) {
+	struct message_queue *q = skynet_malloc(sizeof(*q));
+	q->handle = handle;
+	q->head = 0;
+	q->tail = 0;
+	q->head_seg = q->tail_seg = new_segment(0);
+	// When the queue is create (always between service create and service init) ,
+	// set in_global flag to avoid push it to global queue .
+	// If the service init success, skynet_context_new will call skynet_mq_push to push it to global queue.
+	q->in_global = MQ_IN_GLOBAL;
+	q->release = 0;
+	q->overload = 0;
+	q->overload_threshold = MQ_OVERLOAD;
+	q->next = NULL;
+
+	return q;
+}
+
+static void 
+_release(struct message_queue *q) {
+	assert(q->next == NULL);
+	struct segment *s = q->head_seg;
+	while (s) {
+		struct segment *next = s->next;
+		free_segment(s);
+		s = next;
+	}
+	skynet_free(q);
+}
+
+int
+skynet_mq_length(struct message_queue *q) {
+	return (int)(q->tail - q->head);
+}
+
+// tail_seg is only a hint for producers, it never moves backward.
+static void
+advance_tail(struct message_queue *q, struct segment *s) {
+	struct segment *t;
+	while ((t = q->tail_seg)->id < s->id) {
+		if (ATOM_CAS_POINTER(&q->tail_seg, t, s))
+			break;
+	}
+}
+
+// call it in epoch critical section
+static struct segment *
+find_segment(struct message_queue *q, uint64_t id) {
+	struct segment *s = q->tail_seg;
+	if (s->id > id) {
+		// the consumer can't pass an unfinished slot, so head_seg->id <= id
+		s = q->head_seg;
+	}
+	while (s->id < id) {
+		struct segment *next = s->next;
+		if (next == NULL) {
+			struct segment *ns = new_segment(s->id + 1);
+			if (ATOM_CAS_POINTER(&s->next, NULL, ns)) {
+				next = ns;
+			} else {
+				free_segment(ns);
+				next = s->next;
+			}
+		}
+		s = next;
+	}
+	advance_tail(q, s);
+	return s;
+}
+
+// Only the consumer can call it, it may retire the drained segment.
+static struct slot *
+head_slot(struct message_queue *q) {
+	struct segment *s = q->head_seg;
+	uint64_t head = q->head;
+	if (head / SEGMENT_SIZE != s->id) {
+		struct segment *next = s->next;
+		if (next == NULL)
+			return NULL;
+		q->head_seg = next;
+		advance_tail(q, next);
+		skynet_epoch_retire(s, free_segment);
+		s = next;
+	}
+	struct slot *slot = &s->slot[head % SEGMENT_SIZE];
+	// CAS(1,1) is a load with full barrier, read the message after ready
+	if (!ATOM_CAS(&slot->ready, 1, 1)) {
+		return NULL;
+	}
+	return slot;
+}
+
+// Read only version of head_slot, the queue may be owned by another consumer already.
+static int
+is_empty(struct message_queue *q) {
+	int empty;
+	skynet_epoch_enter();
+	struct segment *s = q->head_seg;
+	uint64_t head = q->head;
+	if (head / SEGMENT_SIZE != s->id) {
+		s = s->next;
+	}
+	if (s == NULL) {
+		empty = 1;
+	} else {
+		empty = !ATOM_CAS(&s->slot[head % SEGMENT_SIZE].ready, 1, 1);
+	}
+	skynet_epoch_leave();
+	return empty;
+}
+
+int
+skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
+	struct slot *slot;
+	while ((slot = head_slot(q)) == NULL) {
+		// reset overload_threshold when queue is empty
+		q->overload_threshold = MQ_OVERLOAD;
+		q->in_global = 0;
+		__sync_synchronize();
+		// A producer may push a message before in_global is cleared, and it didn't push the queue into global mq.
+		if (is_empty(q) || !ATOM_CAS(&q->in_global, 0, MQ_IN_GLOBAL)) {
+			return 1;
+		}
+		// The queue is taken back, but it may be pushed into global mq by a producer after in_global is cleared,
+		// and drained by another worker before the CAS. So it can be empty again, check it from the beginning.
+	}
+	*message = slot->msg;
+	uint64_t head = ++q->head;
+	int length = (int)(q->tail - head);
+	while (length > q->overload_threshold) {
+		q->overload = length;
+		q->overload_threshold *= 2;
+	}
+
+	return 0;
+}
+
+int
+skynet_mq_pop_batch(struct message_queue *q, struct skynet_message *msgs, int max) {
+	int n = 0;
+	struct slot *slot;
+	while (n < max && (slot = head_slot(q))) {
+		msgs[n++] = slot->msg;
+		++q->head;
+	}
+	if (n == 0) {
+		// skynet_mq_pop clears in_global when the queue is empty
+		return skynet_mq_pop(q, msgs) == 0;
+	}
+	int length = (int)(q->tail - q->head);
+	while (length > q->overload_threshold) {
+		q->overload = length;
+		q->overload_threshold *= 2;
+	}
+
+	return n;
+}
+
+void 
+skynet_mq_push(struct message_queue *q, struct skynet_message *message) {
+	assert(message);
+	skynet_epoch_enter();
+	uint64_t pos = __sync_fetch_and_add(&q->tail, 1);
+	struct segment *s = find_segment(q, pos / SEGMENT_SIZE);
+	struct slot *slot = &s->slot[pos % SEGMENT_SIZE];
+	slot->msg = *message;
+	// full barrier : publish the message, and read in_global after that
+	ATOM_CAS(&slot->ready, 0, 1);
+	skynet_epoch_leave();
+
+	if (q->in_global == 0 && ATOM_CAS(&q->in_global, 0, MQ_IN_GLOBAL)) {
+		skynet_globalmq_push(q);
+	}
+}
+
+void 
+skynet_mq_mark_release(struct message_queue *q) {
+	assert(q->release == 0);
+	q->release = 1;
+	__sync_synchronize();
+	if (q->in_global == 0 && ATOM_CAS(&q->in_global, 0, MQ_IN_GLOBAL)) {
+		skynet_globalmq_push(q);
+	}
+}
+
+static void
+_drop_queue(struct message_queue *q, message_drop drop_func, void *ud) {
+	struct skynet_message msg;
+	while(!skynet_mq_pop(q, &msg)) {
+		drop_func(&msg, ud);
+	}
+	_release(q);
+}
+
+void 
+skynet_mq_release(struct message_queue *q, message_drop drop_func, void *ud) {
+	__sync_synchronize();
+	if (q->release) {
+		_drop_queue(q, drop_func, ud);
+	} else {
+		skynet_globalmq_push(q);
+	}
+}
+
+#endif
+
+void 
+skynet_mq_init(int worker) {
+	struct global_queue *q = skynet_malloc(sizeof(*q));
+	memset(q,0,sizeof(*q));
+	SPIN_INIT(q);
+	Q=q;
+	if (worker > 0) {
+		int i;
+		L.q = skynet_memalign(CACHE_LINE, worker * sizeof(union local_slot));
+		memset(L.q, 0, worker * sizeof(union local_slot));
+		for (i=0;i<worker;i++) {
+			SPIN_INIT(&L.q[i].q);
+		}
+		L.next = 0;
+		L.count = worker;
+	}
+}
@@ -19,6 +19,8 @@ struct message_queue;
 
 void skynet_globalmq_push(struct message_queue * queue);
 struct message_queue * skynet_globalmq_pop(void);
+// bind current thread to a worker's local queue (work stealing mode only)
+void skynet_globalmq_bind(int worker);
 
 struct message_queue * skynet_mq_create(uint32_t handle);
 void skynet_mq_mark_release(struct message_queue *q);
@@ -31,11 +33,14 @@ uint32_t skynet_mq_handle(struct message_queue *);
 // 0 for success
 int skynet_mq_pop(struct message_queue *q, struct skynet_message *message);
 void skynet_mq_push(struct message_queue *q, struct skynet_message *message);
+// pop at most max messages at once, return the number of messages. 0 for empty (the same as skynet_mq_pop fails)
+int skynet_mq_pop_batch(struct message_queue *q, struct skynet_message *msgs, int max);
 
 // return the length of message queue, for debug
 int skynet_mq_length(struct message_queue *q);
 int skynet_mq_overload(struct message_queue *q);
 
-void skynet_mq_init();
+// worker > 0 : work stealing mode, one local queue per worker
+void skynet_mq_init(int worker);
 
 #endif
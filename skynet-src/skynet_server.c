@@ -11,6 +11,7 @@
 #include "skynet_imp.h"
 #include "skynet_log.h"
 #include "skynet_timer.h"
+#include "skynet_epoch.h"
 #include "spinlock.h"
 #include "atomic.h"
 
@@ -46,7 +47,7 @@ struct skynet_context {
 	void * cb_ud;
 	skynet_cb cb;
 	struct message_queue *queue;
-	FILE * logfile;
+	struct skynet_log * logfile;
 	uint64_t cpu_cost;	// in microsec
 	uint64_t cpu_start;	// in microsec
 	char result[32];
@@ -197,6 +198,20 @@ skynet_context_grab(struct skynet_context *ctx) {
 	ATOM_INC(&ctx->ref);
 }
 
+int
+skynet_context_trygrab(struct skynet_context *ctx) {
+	for (;;) {
+		int ref = ctx->ref;
+		if (ref == 0) {
+			// the context is deleting
+			return 0;
+		}
+		if (ATOM_CAS(&ctx->ref, ref, ref+1)) {
+			return 1;
+		}
+	}
+}
+
 void
 skynet_context_reserve(struct skynet_context *ctx) {
 	skynet_context_grab(ctx);
@@ -208,12 +223,13 @@ skynet_context_reserve(struct skynet_context *ctx) {
 static void 
 delete_context(struct skynet_context *ctx) {
 	if (ctx->logfile) {
-		fclose(ctx->logfile);
+		skynet_log_close(ctx, ctx->logfile, ctx->handle);
 	}
 	skynet_module_instance_release(ctx->mod, ctx->instance);
 	skynet_mq_mark_release(ctx->queue);
 	CHECKCALLING_DESTROY(ctx)
-	skynet_free(ctx);
+	// skynet_handle_grab may read ctx without lock, free it after a grace period
+	skynet_epoch_retire(ctx, skynet_free);
 	context_dec();
 }
 
@@ -264,8 +280,9 @@ dispatch_message(struct skynet_context *ctx, struct skynet_message *msg) {
 	pthread_setspecific(G_NODE.handle_key, (void *)(uintptr_t)(ctx->handle));
 	int type = msg->sz >> MESSAGE_TYPE_SHIFT;
 	size_t sz = msg->sz & MESSAGE_TYPE_MASK;
-	if (ctx->logfile) {
-		skynet_log_output(ctx->logfile, msg->source, type, msg->session, msg->data, sz);
+	struct skynet_log * logfile = ctx->logfile;
+	if (logfile) {
+		skynet_log_output(logfile, msg->source, type, msg->session, msg->data, sz);
 	}
 	++ctx->message_count;
 	int reserve_msg;
@@ -293,6 +310,9 @@ skynet_context_dispatchall(struct skynet_context * ctx) {
 	}
 }
 
+// max number of messages popped from the message queue at once
+#define MESSAGE_BATCH 32
+
 struct message_queue * 
 skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue *q, int weight) {
 	if (q == NULL) {
@@ -311,30 +331,44 @@ skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue
 	}
 
 	int i,n=1;
-	struct skynet_message msg;
+	struct skynet_message msgs[MESSAGE_BATCH];
+
+	if (weight >= 0) {
+		n = skynet_mq_length(q) >> weight;
+		if (n < 1) {
+			n = 1;
+		}
+	}
 
-	for (i=0;i<n;i++) {
-		if (skynet_mq_pop(q,&msg)) {
+	while (n > 0) {
+		int batch = n < MESSAGE_BATCH ? n : MESSAGE_BATCH;
+		int m = skynet_mq_pop_batch(q, msgs, batch);
+		if (m == 0) {
 			skynet_context_release(ctx);
 			return skynet_globalmq_pop();
-		} else if (i==0 && weight >= 0) {
-			n = skynet_mq_length(q);
-			n >>= weight;
 		}
 		int overload = skynet_mq_overload(q);
 		if (overload) {
 			skynet_error(ctx, "May overload, message queue length = %d", overload);
 		}
 
-		skynet_monitor_trigger(sm, msg.source , handle);
+		for (i=0;i<m;i++) {
+			struct skynet_message *msg = &msgs[i];
+			skynet_monitor_trigger(sm, msg->source , handle);
 
-		if (ctx->cb == NULL) {
-			skynet_free(msg.data);
-		} else {
-			dispatch_message(ctx, &msg);
-		}
+			if (ctx->cb == NULL) {
+				skynet_free(msg->data);
+			} else {
+				dispatch_message(ctx, msg);
+			}
 
-		skynet_monitor_trigger(sm, 0,0);
+			skynet_monitor_trigger(sm, 0,0);
+		}
+		if (m < batch) {
+			// message queue is empty now
+			break;
+		}
+		n -= m;
 	}
 
 	assert(q == ctx->queue);
@@ -404,6 +438,23 @@ cmd_timeout(struct skynet_context * context, const char * param) {
 	return context->result;
 }
 
+static const char *
+cmd_timeout_ms(struct skynet_context * context, const char * param) {
+	int ti = strtol(param, NULL, 10);
+	int session = skynet_context_newsession(context);
+	skynet_timeout_ms(context->handle, ti, session);
+	sprintf(context->result, "%d", session);
+	return context->result;
+}
+
+static const char *
+cmd_timeout_cancel(struct skynet_context * context, const char * param) {
+	int session = strtol(param, NULL, 10);
+	int ret = skynet_timeout_cancel(context->handle, session);
+	sprintf(context->result, "%d", ret);
+	return context->result;
+}
+
 static const char *
 cmd_reg(struct skynet_context * context, const char * param) {
 	if (param == NULL || param[0] == '\0') {
@@ -580,22 +631,28 @@ cmd_stat(struct skynet_context * context, const char * param) {
 	return context->result;
 }
 
+// param : address [sample] , trace 1 of sample messages
 static const char *
 cmd_logon(struct skynet_context * context, const char * param) {
-	uint32_t handle = tohandle(context, param);
+	size_t sz = strlen(param);
+	char address[sz+1];
+	int sample = 1;
+	if (sscanf(param, "%s %d", address, &sample) < 1)
+		return NULL;
+	uint32_t handle = tohandle(context, address);
 	if (handle == 0)
 		return NULL;
 	struct skynet_context * ctx = skynet_handle_grab(handle);
 	if (ctx == NULL)
 		return NULL;
-	FILE *f = NULL;
-	FILE * lastf = ctx->logfile;
+	struct skynet_log *f = NULL;
+	struct skynet_log * lastf = ctx->logfile;
 	if (lastf == NULL) {
-		f = skynet_log_open(context, handle);
+		f = skynet_log_open(context, handle, sample);
 		if (f) {
 			if (!ATOM_CAS_POINTER(&ctx->logfile, NULL, f)) {
-				// logfile opens in other thread, close this one.
-				fclose(f);
+				// logfile opens in other thread, free this one, it has written nothing.
+				skynet_log_free(f);
 			}
 		}
 	}
@@ -611,7 +668,7 @@ cmd_logoff(struct skynet_context * context, const char * param) {
 	struct skynet_context * ctx = skynet_handle_grab(handle);
 	if (ctx == NULL)
 		return NULL;
-	FILE * f = ctx->logfile;
+	struct skynet_log * f = ctx->logfile;
 	if (f) {
 		// logfile may close in other thread
 		if (ATOM_CAS_POINTER(&ctx->logfile, f, NULL)) {
@@ -644,6 +701,8 @@ cmd_signal(struct skynet_context * context, const char * param) {
 
 static struct command_func cmd_funcs[] = {
 	{ "TIMEOUT", cmd_timeout },
+	{ "TIMEOUT_MS", cmd_timeout_ms },
+	{ "TIMEOUT_CANCEL", cmd_timeout_cancel },
 	{ "REG", cmd_reg },
 	{ "QUERY", cmd_query },
 	{ "NAME", cmd_name },
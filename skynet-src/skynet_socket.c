@@ -5,35 +5,118 @@
 #include "skynet_server.h"
 #include "skynet_mq.h"
 #include "skynet_harbor.h"
+#include "socket_rbuffer.h"
+#include "atomic.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
 
-static struct socket_server * SOCKET_SERVER = NULL;
+#define MAX_SOCKET_THREAD 16
 
-void 
-skynet_socket_init() {
-	SOCKET_SERVER = socket_server_create();
+// socket id % SOCKET_THREAD is the index of socket server owns it
+static struct socket_server * SOCKET_SERVER[MAX_SOCKET_THREAD];
+static pthread_t SOCKET_PTHREAD[MAX_SOCKET_THREAD];
+static int SOCKET_THREAD = 0;
+static int SOCKET_ALLOC = 0;
+static int SOCKET_URING = 0;
+
+static inline struct socket_server *
+socket_server(int id) {
+	return SOCKET_SERVER[(unsigned)id % SOCKET_THREAD];
+}
+
+// new socket (listen/connect/bind/udp) is placed round robin
+static inline struct socket_server *
+socket_alloc() {
+	if (SOCKET_THREAD == 1)
+		return SOCKET_SERVER[0];
+	return SOCKET_SERVER[(unsigned)ATOM_FINC(&SOCKET_ALLOC) % SOCKET_THREAD];
+}
+
+int
+skynet_socket_init(int thread, int uring) {
+	if (thread < 1) {
+		thread = 1;
+	} else if (thread > MAX_SOCKET_THREAD) {
+		thread = MAX_SOCKET_THREAD;
+	}
+	SOCKET_URING = socket_server_iouring(uring);
+	int i;
+	for (i=0;i<thread;i++) {
+		SOCKET_SERVER[i] = socket_server_create();
+		if (SOCKET_SERVER[i] == NULL) {
+			fprintf(stderr, "Create socket server %d failed\n", i);
+			exit(1);
+		}
+		if (thread > 1) {
+			socket_server_shard(SOCKET_SERVER[i], SOCKET_SERVER, i, thread);
+		}
+	}
+	SOCKET_THREAD = thread;
+	assert(sizeof(struct skynet_socket_message) <= RBUFFER_HEADER);
+	socket_rbuffer_init();
+	return thread;
+}
+
+void
+skynet_socket_initthread(int thread) {
+	SOCKET_PTHREAD[thread] = pthread_self();
+}
+
+void
+skynet_socket_stat(struct skynet_socket_stat *stat) {
+	struct socket_rbuffer_stat rb;
+	socket_rbuffer_stat(&rb);
+	stat->rbuffer_pool = rb.pool;
+	stat->rbuffer_malloc = rb.malloc;
+	stat->rbuffer_wrapper = rb.wrapper;
+	stat->cputime = 0;
+	stat->poll_syscall = socket_server_pollsyscall();
+	stat->uring = SOCKET_URING;
+#ifdef __linux__
+	int i;
+	for (i=0;i<SOCKET_THREAD;i++) {
+		clockid_t cid;
+		struct timespec ti;
+		if (SOCKET_PTHREAD[i] && pthread_getcpuclockid(SOCKET_PTHREAD[i], &cid) == 0 && clock_gettime(cid, &ti) == 0) {
+			stat->cputime += (uint64_t)ti.tv_sec * 1000000 + ti.tv_nsec / 1000;
+		}
+	}
+#endif
 }
 
 void
 skynet_socket_exit() {
-	socket_server_exit(SOCKET_SERVER);
+	int i;
+	for (i=0;i<SOCKET_THREAD;i++) {
+		socket_server_exit(SOCKET_SERVER[i]);
+	}
 }
 
 void
 skynet_socket_free() {
-	socket_server_release(SOCKET_SERVER);
-	SOCKET_SERVER = NULL;
+	int i;
+	for (i=0;i<SOCKET_THREAD;i++) {
+		socket_server_release(SOCKET_SERVER[i]);
+		SOCKET_SERVER[i] = NULL;
+	}
+	SOCKET_THREAD = 0;
 }
 
 // mainloop thread
 static void
 forward_message(int type, bool padding, struct socket_message * result) {
-	struct skynet_socket_message *sm;
+	struct skynet_socket_message *sm = NULL;
 	size_t sz = sizeof(*sm);
+	if (type == SKYNET_SOCKET_TYPE_DATA) {
+		// the wrapper lives in the same pooled block as the data
+		sm = socket_rbuffer_header(result->data);
+	}
 	if (padding) {
 		if (result->data) {
 			size_t msg_sz = strlen(result->data);
@@ -45,7 +128,9 @@ forward_message(int type, bool padding, struct socket_message * result) {
 			result->data = "";
 		}
 	}
-	sm = (struct skynet_socket_message *)skynet_malloc(sz);
+	if (sm == NULL) {
+		sm = (struct skynet_socket_message *)skynet_malloc(sz);
+	}
 	sm->type = type;
 	sm->id = result->id;
 	sm->ud = result->ud;
@@ -71,8 +156,8 @@ forward_message(int type, bool padding, struct socket_message * result) {
 }
 
 int 
-skynet_socket_poll() {
-	struct socket_server *ss = SOCKET_SERVER;
+skynet_socket_poll(int thread) {
+	struct socket_server *ss = SOCKET_SERVER[thread];
 	assert(ss);
 	struct socket_message result;
 	int more = 1;
@@ -113,69 +198,69 @@ skynet_socket_poll() {
 
 int
 skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz) {
-	return socket_server_send(SOCKET_SERVER, id, buffer, sz);
+	return socket_server_send(socket_server(id), id, buffer, sz);
 }
 
 int
 skynet_socket_send_lowpriority(struct skynet_context *ctx, int id, void *buffer, int sz) {
-	return socket_server_send_lowpriority(SOCKET_SERVER, id, buffer, sz);
+	return socket_server_send_lowpriority(socket_server(id), id, buffer, sz);
 }
 
 int 
 skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog) {
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_listen(SOCKET_SERVER, source, host, port, backlog);
+	return socket_server_listen(socket_alloc(), source, host, port, backlog);
 }
 
 int 
 skynet_socket_connect(struct skynet_context *ctx, const char *host, int port) {
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_connect(SOCKET_SERVER, source, host, port);
+	return socket_server_connect(socket_alloc(), source, host, port);
 }
 
 int 
 skynet_socket_bind(struct skynet_context *ctx, int fd) {
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_bind(SOCKET_SERVER, source, fd);
+	return socket_server_bind(socket_alloc(), source, fd);
 }
 
 void 
 skynet_socket_close(struct skynet_context *ctx, int id) {
 	uint32_t source = skynet_context_handle(ctx);
-	socket_server_close(SOCKET_SERVER, source, id);
+	socket_server_close(socket_server(id), source, id);
 }
 
 void 
 skynet_socket_shutdown(struct skynet_context *ctx, int id) {
 	uint32_t source = skynet_context_handle(ctx);
-	socket_server_shutdown(SOCKET_SERVER, source, id);
+	socket_server_shutdown(socket_server(id), source, id);
 }
 
 void 
 skynet_socket_start(struct skynet_context *ctx, int id) {
 	uint32_t source = skynet_context_handle(ctx);
-	socket_server_start(SOCKET_SERVER, source, id);
+	socket_server_start(socket_server(id), source, id);
 }
 
 void
 skynet_socket_nodelay(struct skynet_context *ctx, int id) {
-	socket_server_nodelay(SOCKET_SERVER, id);
+	socket_server_nodelay(socket_server(id), id);
 }
 
 int 
 skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port) {
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_udp(SOCKET_SERVER, source, addr, port);
+	return socket_server_udp(socket_alloc(), source, addr, port);
 }
 
 int 
 skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr, int port) {
-	return socket_server_udp_connect(SOCKET_SERVER, id, addr, port);
+	return socket_server_udp_connect(socket_server(id), id, addr, port);
 }
 
 int 
 skynet_socket_udp_send(struct skynet_context *ctx, int id, const char * address, const void *buffer, int sz) {
-	return socket_server_udp_send(SOCKET_SERVER, id, (const struct socket_udp_address *)address, buffer, sz);
+	return socket_server_udp_send(socket_server(id), id, (const struct socket_udp_address *)address, buffer, sz);
 }
 
 const char *
@@ -188,5 +273,5 @@ skynet_socket_udp_address(struct skynet_socket_message *msg, int *addrsz) {
 	sm.opaque = 0;
 	sm.ud = msg->ud;
 	sm.data = msg->buffer;
-	return (const char *)socket_server_udp_address(SOCKET_SERVER, &sm, addrsz);
+	return (const char *)socket_server_udp_address(socket_server(sm.id), &sm, addrsz);
 }
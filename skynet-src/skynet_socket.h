@@ -1,6 +1,8 @@
 #ifndef skynet_socket_h
 #define skynet_socket_h
 
+#include <stdint.h>
+
 struct skynet_context;
 
 #define SKYNET_SOCKET_TYPE_DATA 1
@@ -18,10 +20,23 @@ struct skynet_socket_message {
 	char * buffer;
 };
 
-void skynet_socket_init();
+struct skynet_socket_stat {
+	uint64_t rbuffer_pool;		// read buffers from pool
+	uint64_t rbuffer_malloc;	// read buffers by skynet_malloc
+	uint64_t rbuffer_wrapper;	// message wrappers by skynet_malloc
+	uint64_t cputime;	// cpu time of socket threads in microsecond (linux only)
+	uint64_t poll_syscall;	// syscalls of poll backend
+	int uring;	// io_uring is used
+};
+
+// thread is the number of socket poll threads (socket servers), returns the actual number
+// uring : use io_uring if it's supported (build with USE_IO_URING)
+int skynet_socket_init(int thread, int uring);
 void skynet_socket_exit();
 void skynet_socket_free();
-int skynet_socket_poll();
+int skynet_socket_poll(int thread);
+void skynet_socket_initthread(int thread);
+void skynet_socket_stat(struct skynet_socket_stat *);
 
 int skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz);
 int skynet_socket_send_lowpriority(struct skynet_context *ctx, int id, void *buffer, int sz);
@@ -9,6 +9,8 @@
 #include "skynet_socket.h"
 #include "skynet_daemon.h"
 #include "skynet_harbor.h"
+#include "skynet_epoch.h"
+#include "skynet_logring.h"
 
 #include <pthread.h>
 #include <unistd.h>
@@ -62,10 +64,13 @@ wakeup(struct monitor *m, int busy) {
 
 static void *
 thread_socket(void *p) {
-	struct monitor * m = p;
+	struct worker_parm *wp = p;
+	struct monitor * m = wp->m;
+	int id = wp->id;
 	skynet_initthread(THREAD_SOCKET);
+	skynet_socket_initthread(id);
 	for (;;) {
-		int r = skynet_socket_poll();
+		int r = skynet_socket_poll(id);
 		if (r==0)
 			break;
 		if (r<0) {
@@ -133,7 +138,7 @@ thread_timer(void *p) {
 		skynet_updatetime();
 		CHECK_ABORT
 		wakeup(m,m->count-1);
-		usleep(2500);
+		skynet_timer_sleep();
 		if (SIG) {
 			signal_hup();
 			SIG = 0;
@@ -157,6 +162,7 @@ thread_worker(void *p) {
 	struct monitor *m = wp->m;
 	struct skynet_monitor *sm = m->m[id];
 	skynet_initthread(THREAD_WORKER);
+	skynet_globalmq_bind(id);
 	struct message_queue * q = NULL;
 	while (!m->quit) {
 		q = skynet_context_message_dispatch(sm, q, weight);
@@ -179,8 +185,8 @@ thread_worker(void *p) {
 }
 
 static void
-start(int thread) {
-	pthread_t pid[thread+3];
+start(int thread, int socket_thread) {
+	pthread_t pid[thread+socket_thread+2];
 
 	struct monitor *m = skynet_malloc(sizeof(*m));
 	memset(m, 0, sizeof(*m));
@@ -203,7 +209,13 @@ start(int thread) {
 
 	create_thread(&pid[0], thread_monitor, m);
 	create_thread(&pid[1], thread_timer, m);
-	create_thread(&pid[2], thread_socket, m);
+	struct worker_parm sp[socket_thread];
+	for (i=0;i<socket_thread;i++) {
+		sp[i].m = m;
+		sp[i].id = i;
+		sp[i].weight = 0;
+		create_thread(&pid[i+2], thread_socket, &sp[i]);
+	}
 
 	static int weight[] = { 
 		-1, -1, -1, -1, 0, 0, 0, 0,
@@ -219,10 +231,10 @@ start(int thread) {
 		} else {
 			wp[i].weight = 0;
 		}
-		create_thread(&pid[i+3], thread_worker, &wp[i]);
+		create_thread(&pid[i+socket_thread+2], thread_worker, &wp[i]);
 	}
 
-	for (i=0;i<thread+3;i++) {
+	for (i=0;i<thread+socket_thread+2;i++) {
 		pthread_join(pid[i], NULL); 
 	}
 
@@ -239,6 +251,7 @@ bootstrap(struct skynet_context * logger, const char * cmdline) {
 	if (ctx == NULL) {
 		skynet_error(NULL, "Bootstrap error : %s\n", cmdline);
 		skynet_context_dispatchall(logger);
+		skynet_logring_exit();
 		exit(1);
 	}
 }
@@ -259,12 +272,20 @@ skynet_start(struct skynet_config * config) {
 	}
 	skynet_harbor_init(config->harbor);
 	skynet_handle_init(config->harbor);
-	skynet_mq_init();
+	skynet_mq_init(config->worksteal ? config->thread : 0);
 	skynet_module_init(config->module_path);
-	skynet_timer_init();
-	skynet_socket_init();
+	skynet_timer_init(config->timer_tick);
+	int socket_thread = skynet_socket_init(config->socket_thread, config->io_uring);
 	skynet_profile_enable(config->profile);
 
+	// the builtin logger writes the log lines by an asynchronous flusher thread
+	if (config->logbuffer > 0 && strcmp(config->logservice, "logger") == 0) {
+		if (skynet_logring_init(config->logger, config->logbuffer, config->logflush)) {
+			fprintf(stderr, "Can't open log file %s\n", config->logger);
+			exit(1);
+		}
+	}
+
 	struct skynet_context *ctx = skynet_context_new(config->logservice, config->logger);
 	if (ctx == NULL) {
 		fprintf(stderr, "Can't launch %s service\n", config->logservice);
@@ -273,11 +294,13 @@ skynet_start(struct skynet_config * config) {
 
 	bootstrap(ctx, config->bootstrap);
 
-	start(config->thread);
+	start(config->thread, socket_thread);
 
 	// harbor_exit may call socket send, so it should exit before socket_free
 	skynet_harbor_exit();
 	skynet_socket_free();
+	skynet_epoch_exit();
+	skynet_logring_exit();
 	if (config->daemon) {
 		daemon_exit(config->daemon);
 	}
@@ -11,6 +11,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <limits.h>
 
 #if defined(__APPLE__)
 #include <AvailabilityMacros.h>
@@ -19,8 +20,6 @@
 #include <mach/mach.h>
 #endif
 
-typedef void (*timer_execute_func)(void *ud,void *arg);
-
 #define TIME_NEAR_SHIFT 8
 #define TIME_NEAR (1 << TIME_NEAR_SHIFT)
 #define TIME_LEVEL_SHIFT 6
@@ -28,14 +27,26 @@ typedef void (*timer_execute_func)(void *ud,void *arg);
 #define TIME_NEAR_MASK (TIME_NEAR-1)
 #define TIME_LEVEL_MASK (TIME_LEVEL-1)
 
+#define TIMER_SLAB 256
+#define DEFAULT_HASH_SIZE 256
+
+// one tick is 1/100 second (centisecond) by default, set timer_tick in config for high resolution mode.
+#define CENTISEC_TICK 10000	// in microsecond
+
 struct timer_event {
 	uint32_t handle;
 	int session;
 };
 
+struct link_list;
+
 struct timer_node {
-	struct timer_node *next;
+	struct timer_node *next;	// must be the first field, see unlink()
+	struct timer_node **prev;
+	struct link_list *list;
+	struct timer_node *hash_next;	// hash by (handle, session) for cancel
 	uint32_t expire;
+	struct timer_event event;
 };
 
 struct link_list {
@@ -43,14 +54,28 @@ struct link_list {
 	struct timer_node *tail;
 };
 
+// timer nodes are allocated from slabs, and never return to skynet_free
+struct timer_slab {
+	struct timer_slab *next;
+	struct timer_node node[TIMER_SLAB];
+};
+
 struct timer {
 	struct link_list near[TIME_NEAR];
 	struct link_list t[4][TIME_LEVEL];
 	struct spinlock lock;
 	uint32_t time;
 	uint32_t starttime;
-	uint64_t current;
-	uint64_t current_point;
+	uint64_t current;	// centisecond
+	uint64_t current_point;	// tick
+	uint64_t current_tick;	// ticks since start
+	uint64_t start_current;
+	int tick;	// microseconds per tick
+	struct timer_node *freelist;
+	struct timer_slab *slab;
+	int hash_size;
+	int count;
+	struct timer_node **hash;
 };
 
 static struct timer * TI = NULL;
@@ -66,11 +91,101 @@ link_clear(struct link_list *list) {
 
 static inline void
 link(struct link_list *list,struct timer_node *node) {
+	node->prev = &list->tail->next;
+	node->list = list;
 	list->tail->next = node;
 	list->tail = node;
 	node->next=0;
 }
 
+static inline void
+unlink(struct timer_node *node) {
+	*node->prev = node->next;
+	if (node->next) {
+		node->next->prev = node->prev;
+	} else {
+		// node->prev points to the next field (the first field) of previous node
+		node->list->tail = (struct timer_node *)node->prev;
+	}
+}
+
+static struct timer_node *
+node_alloc(struct timer *T) {
+	struct timer_node *node = T->freelist;
+	if (node == NULL) {
+		struct timer_slab *slab = skynet_malloc(sizeof(*slab));
+		int i;
+		for (i=0;i<TIMER_SLAB-1;i++) {
+			slab->node[i].next = &slab->node[i+1];
+		}
+		slab->node[TIMER_SLAB-1].next = NULL;
+		slab->next = T->slab;
+		T->slab = slab;
+		node = &slab->node[0];
+	}
+	T->freelist = node->next;
+	return node;
+}
+
+static inline void
+node_free(struct timer *T, struct timer_node *node) {
+	node->next = T->freelist;
+	T->freelist = node;
+}
+
+static inline struct timer_node **
+hash_slot(struct timer *T, uint32_t handle, int session) {
+	uint32_t h = handle * 2654435761u ^ (uint32_t)session;
+	return &T->hash[h & (T->hash_size - 1)];
+}
+
+static void
+hash_expand(struct timer *T) {
+	int old_size = T->hash_size;
+	struct timer_node **old_hash = T->hash;
+	T->hash_size *= 2;
+	T->hash = skynet_malloc(T->hash_size * sizeof(struct timer_node *));
+	memset(T->hash, 0, T->hash_size * sizeof(struct timer_node *));
+	int i;
+	for (i=0;i<old_size;i++) {
+		struct timer_node *node = old_hash[i];
+		while (node) {
+			struct timer_node *next = node->hash_next;
+			struct timer_node **slot = hash_slot(T, node->event.handle, node->event.session);
+			node->hash_next = *slot;
+			*slot = node;
+			node = next;
+		}
+	}
+	skynet_free(old_hash);
+}
+
+static void
+hash_insert(struct timer *T, struct timer_node *node) {
+	if (T->count >= T->hash_size) {
+		hash_expand(T);
+	}
+	struct timer_node **slot = hash_slot(T, node->event.handle, node->event.session);
+	node->hash_next = *slot;
+	*slot = node;
+	++T->count;
+}
+
+static struct timer_node *
+hash_remove(struct timer *T, uint32_t handle, int session) {
+	struct timer_node **slot = hash_slot(T, handle, session);
+	struct timer_node *node;
+	while ((node = *slot)) {
+		if (node->event.handle == handle && node->event.session == session) {
+			*slot = node->hash_next;
+			--T->count;
+			return node;
+		}
+		slot = &node->hash_next;
+	}
+	return NULL;
+}
+
 static void
 add_node(struct timer *T,struct timer_node *node) {
 	uint32_t time=node->expire;
@@ -93,16 +208,32 @@ add_node(struct timer *T,struct timer_node *node) {
 }
 
 static void
-timer_add(struct timer *T,void *arg,size_t sz,int time) {
-	struct timer_node *node = (struct timer_node *)skynet_malloc(sizeof(*node)+sz);
-	memcpy(node+1,arg,sz);
-
+timer_add(struct timer *T,struct timer_event *event,int time) {
 	SPIN_LOCK(T);
 
+		struct timer_node *node = node_alloc(T);
+		node->event = *event;
 		node->expire=time+T->time;
 		add_node(T,node);
+		hash_insert(T,node);
+
+	SPIN_UNLOCK(T);
+}
+
+static int
+timer_cancel(struct timer *T, uint32_t handle, int session) {
+	int ret = 0;
+	SPIN_LOCK(T);
+
+		struct timer_node *node = hash_remove(T, handle, session);
+		if (node) {
+			unlink(node);
+			node_free(T, node);
+			ret = 1;
+		}
 
 	SPIN_UNLOCK(T);
+	return ret;
 }
 
 static void
@@ -138,22 +269,73 @@ timer_shift(struct timer *T) {
 	}
 }
 
-static inline void
-dispatch_list(struct timer_node *current) {
-	do {
-		struct timer_event * event = (struct timer_event *)(current+1);
-		struct skynet_message message;
-		message.source = 0;
-		message.session = event->session;
+static void
+push_timeout(uint32_t handle, int *session, int n) {
+	struct skynet_message message;
+	message.source = 0;
+	if (n == 1) {
+		message.session = session[0];
 		message.data = NULL;
 		message.sz = (size_t)PTYPE_RESPONSE << MESSAGE_TYPE_SHIFT;
+	} else {
+		// expired timers of one service in the same tick, read skynet_timer.h
+		size_t sz = n * sizeof(int);
+		message.session = 0;
+		message.data = skynet_malloc(sz);
+		memcpy(message.data, session, sz);
+		message.sz = sz | (size_t)PTYPE_RESPONSE << MESSAGE_TYPE_SHIFT;
+	}
+	if (skynet_context_push(handle, &message)) {
+		skynet_free(message.data);
+	}
+}
+
+// stable sort the list by handle, so the timers of one service are adjacent.
+static struct timer_node *
+sort_list(struct timer_node *list) {
+	if (list == NULL || list->next == NULL)
+		return list;
+	struct timer_node *slow = list;
+	struct timer_node *fast = list->next;
+	while (fast && fast->next) {
+		slow = slow->next;
+		fast = fast->next->next;
+	}
+	struct timer_node *right = sort_list(slow->next);
+	slow->next = NULL;
+	struct timer_node *left = sort_list(list);
+	struct timer_node head;
+	struct timer_node *tail = &head;
+	while (left && right) {
+		if (right->event.handle < left->event.handle) {
+			tail->next = right;
+			right = right->next;
+		} else {
+			tail->next = left;
+			left = left->next;
+		}
+		tail = tail->next;
+	}
+	tail->next = left ? left : right;
+	return head.next;
+}
 
-		skynet_context_push(event->handle, &message);
-		
-		struct timer_node * temp = current;
+static inline void
+dispatch_list(struct timer_node *current) {
+	int session[TIMER_SLAB];
+	int n = 0;
+	uint32_t handle = current->event.handle;
+	do {
+		struct timer_event * event = &current->event;
+		if (event->handle != handle || n == TIMER_SLAB) {
+			push_timeout(handle, session, n);
+			handle = event->handle;
+			n = 0;
+		}
+		session[n++] = event->session;
 		current=current->next;
-		skynet_free(temp);	
 	} while (current);
+	push_timeout(handle, session, n);
 }
 
 static inline void
@@ -162,10 +344,21 @@ timer_execute(struct timer *T) {
 	
 	while (T->near[idx].head.next) {
 		struct timer_node *current = link_clear(&T->near[idx]);
+		struct timer_node *node;
+		for (node = current; node; node = node->next) {
+			// can't be canceled after expired
+			hash_remove(T, node->event.handle, node->event.session);
+		}
 		SPIN_UNLOCK(T);
 		// dispatch_list don't need lock T
+		current = sort_list(current);
 		dispatch_list(current);
 		SPIN_LOCK(T);
+		while (current) {
+			node = current->next;
+			node_free(T, current);
+			current = node;
+		}
 	}
 }
 
@@ -204,12 +397,15 @@ timer_create_timer() {
 	SPIN_INIT(r)
 
 	r->current = 0;
+	r->hash_size = DEFAULT_HASH_SIZE;
+	r->hash = skynet_malloc(r->hash_size * sizeof(struct timer_node *));
+	memset(r->hash, 0, r->hash_size * sizeof(struct timer_node *));
 
 	return r;
 }
 
-int
-skynet_timeout(uint32_t handle, int time, int session) {
+static int
+timeout_tick(uint32_t handle, int time, int session) {
 	if (time <= 0) {
 		struct skynet_message message;
 		message.source = 0;
@@ -224,12 +420,39 @@ skynet_timeout(uint32_t handle, int time, int session) {
 		struct timer_event event;
 		event.handle = handle;
 		event.session = session;
-		timer_add(TI, &event, sizeof(event), time);
+		timer_add(TI, &event, time);
 	}
 
 	return session;
 }
 
+// convert to ticks, round up
+static int
+to_tick(int time, int unit) {
+	if (time <= 0)
+		return time;
+	int tick = TI->tick;
+	if (unit == tick)
+		return time;
+	int64_t t = ((int64_t)time * unit + tick - 1) / tick;
+	return t > INT_MAX ? INT_MAX : (int)t;
+}
+
+int
+skynet_timeout(uint32_t handle, int time, int session) {
+	return timeout_tick(handle, to_tick(time, CENTISEC_TICK), session);
+}
+
+int
+skynet_timeout_ms(uint32_t handle, int time, int session) {
+	return timeout_tick(handle, to_tick(time, 1000), session);
+}
+
+int
+skynet_timeout_cancel(uint32_t handle, int session) {
+	return timer_cancel(TI, handle, session);
+}
+
 // centisecond: 1/100 second
 static void
 systime(uint32_t *sec, uint32_t *cs) {
@@ -246,23 +469,29 @@ systime(uint32_t *sec, uint32_t *cs) {
 #endif
 }
 
+// monotonic time in microsecond
 static uint64_t
-gettime() {
+gettime_us() {
 	uint64_t t;
 #if !defined(__APPLE__) || defined(AVAILABLE_MAC_OS_X_VERSION_10_12_AND_LATER)
 	struct timespec ti;
 	clock_gettime(CLOCK_MONOTONIC, &ti);
-	t = (uint64_t)ti.tv_sec * 100;
-	t += ti.tv_nsec / 10000000;
+	t = (uint64_t)ti.tv_sec * 1000000;
+	t += ti.tv_nsec / 1000;
 #else
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
-	t = (uint64_t)tv.tv_sec * 100;
-	t += tv.tv_usec / 10000;
+	t = (uint64_t)tv.tv_sec * 1000000;
+	t += tv.tv_usec;
 #endif
 	return t;
 }
 
+static uint64_t
+gettime() {
+	return gettime_us() / TI->tick;
+}
+
 void
 skynet_updatetime(void) {
 	uint64_t cp = gettime();
@@ -272,7 +501,8 @@ skynet_updatetime(void) {
 	} else if (cp != TI->current_point) {
 		uint32_t diff = (uint32_t)(cp - TI->current_point);
 		TI->current_point = cp;
-		TI->current += diff;
+		TI->current_tick += diff;
+		TI->current = TI->start_current + TI->current_tick * TI->tick / CENTISEC_TICK;
 		int i;
 		for (i=0;i<diff;i++) {
 			timer_update(TI);
@@ -280,6 +510,29 @@ skynet_updatetime(void) {
 	}
 }
 
+void
+skynet_timer_sleep(void) {
+	int tick = TI->tick;
+	struct timespec ti;
+	if (tick >= CENTISEC_TICK) {
+		ti.tv_sec = 0;
+		ti.tv_nsec = 2500000;
+		nanosleep(&ti, NULL);
+		return;
+	}
+#if defined(__linux__)
+	// sleep to the next tick, use absolute deadline to avoid drift
+	uint64_t next = (TI->current_point + 1) * tick;
+	ti.tv_sec = next / 1000000;
+	ti.tv_nsec = (next % 1000000) * 1000;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ti, NULL);
+#else
+	ti.tv_sec = 0;
+	ti.tv_nsec = tick * 1000;
+	nanosleep(&ti, NULL);
+#endif
+}
+
 uint32_t
 skynet_starttime(void) {
 	return TI->starttime;
@@ -291,14 +544,25 @@ skynet_now(void) {
 }
 
 void 
-skynet_timer_init(void) {
+skynet_timer_init(int tick) {
 	TI = timer_create_timer();
+	if (tick <= 0 || tick > CENTISEC_TICK) {
+		tick = CENTISEC_TICK;
+	}
+	TI->tick = tick;
 	uint32_t current = 0;
 	systime(&TI->starttime, &current);
 	TI->current = current;
+	TI->start_current = current;
+	TI->current_tick = 0;
 	TI->current_point = gettime();
 }
 
+int
+skynet_timer_tick(void) {
+	return TI->tick;
+}
+
 // for profile
 
 #define NANOSEC 1000000000
@@ -3,11 +3,20 @@
 
 #include <stdint.h>
 
-int skynet_timeout(uint32_t handle, int time, int session);
+// The expired timers of one service in the same tick are sent in one PTYPE_RESPONSE message,
+// its session is 0 and the data is an array of int sessions. A single timer uses its own session with no data.
+int skynet_timeout(uint32_t handle, int time, int session);	// time in centisecond
+int skynet_timeout_ms(uint32_t handle, int time, int session);	// time in millisecond, rounded up to ticks
+// return 1 if the timer is canceled, 0 if it's not found (expired already)
+int skynet_timeout_cancel(uint32_t handle, int session);
 void skynet_updatetime(void);
 uint32_t skynet_starttime(void);
 uint64_t skynet_thread_time(void);	// for profile, in micro second
 
-void skynet_timer_init(void);
+void skynet_timer_sleep(void);	// sleep until next tick, for timer thread
+
+// tick in microsecond, default is 10000 (1/100 second)
+void skynet_timer_init(int tick);
+int skynet_timer_tick(void);
 
 #endif
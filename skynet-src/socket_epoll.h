@@ -30,6 +30,7 @@ sp_add(int efd, int sock, void *ud) {
 	struct epoll_event ev;
 	ev.events = EPOLLIN;
 	ev.data.ptr = ud;
+	SP_SYSCALL_COUNT;
 	if (epoll_ctl(efd, EPOLL_CTL_ADD, sock, &ev) == -1) {
 		return 1;
 	}
@@ -38,6 +39,7 @@ sp_add(int efd, int sock, void *ud) {
 
 static void 
 sp_del(int efd, int sock) {
+	SP_SYSCALL_COUNT;
 	epoll_ctl(efd, EPOLL_CTL_DEL, sock , NULL);
 }
 
@@ -46,12 +48,14 @@ sp_write(int efd, int sock, void *ud, bool enable) {
 	struct epoll_event ev;
 	ev.events = EPOLLIN | (enable ? EPOLLOUT : 0);
 	ev.data.ptr = ud;
+	SP_SYSCALL_COUNT;
 	epoll_ctl(efd, EPOLL_CTL_MOD, sock, &ev);
 }
 
 static int 
 sp_wait(int efd, struct event *e, int max) {
 	struct epoll_event ev[max];
+	SP_SYSCALL_COUNT;
 	int n = epoll_wait(efd , ev, max, -1);
 	int i;
 	for (i=0;i<n;i++) {
@@ -67,6 +67,7 @@ sp_write(int kfd, int sock, void *ud, bool enable) {
 static int 
 sp_wait(int kfd, struct event *e, int max) {
 	struct kevent ev[max];
+	SP_SYSCALL_COUNT;
 	int n = kevent(kfd, NULL, 0, ev, max, NULL);
 
 	int i;
@@ -2,6 +2,7 @@
 #define socket_poll_h
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef int poll_fd;
 
@@ -21,6 +22,14 @@ static void sp_write(poll_fd, int sock, void *ud, bool enable);
 static int sp_wait(poll_fd, struct event *e, int max);
 static void sp_nonblocking(int sock);
 
+// count the syscalls of poll backend (build with SOCKET_POLL_STAT), see socket_server_pollsyscall
+static uint64_t SP_SYSCALL = 0;
+#ifdef SOCKET_POLL_STAT
+#define SP_SYSCALL_COUNT __sync_fetch_and_add(&SP_SYSCALL, 1)
+#else
+#define SP_SYSCALL_COUNT
+#endif
+
 #ifdef __linux__
 #include "socket_epoll.h"
 #endif
@@ -0,0 +1,200 @@
+#include "skynet.h"
+
+#include "socket_rbuffer.h"
+#include "atomic.h"
+#include "spinlock.h"
+
+#include <sys/mman.h>
+#include <string.h>
+#include <assert.h>
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+// size class i holds data of (MIN_BUFFER << i) bytes, the same as the adaptive read size of socket_server.
+#define MIN_BUFFER 64
+#define MAX_CLASS 11	// 64 bytes ~ 64K
+// each class reserve its own address space, the pages are committed when used.
+#define CLASS_REGION (32 * 1024 * 1024)
+
+struct block {
+	struct block * next;	// in freelist
+	int ref;
+	int cls;
+	char header[RBUFFER_HEADER];
+	char data[];
+};
+
+struct size_class {
+	struct spinlock lock;
+	int block_size;
+	int top;	// blocks never used
+	int capacity;
+	char * base;
+	struct block * freelist;	// owned by socket threads (under lock)
+	struct block * released;	// pushed by any thread (lock free)
+};
+
+// the counters of each thread, summed by socket_rbuffer_stat. They are never released.
+struct counter {
+	struct counter * next;
+	uint64_t pool;
+	uint64_t malloc;
+	uint64_t wrapper;
+};
+
+struct rbuffer_pool {
+	struct size_class c[MAX_CLASS];
+	struct counter * counter;
+};
+
+struct socket_rbuffer_region SOCKET_RBUFFER = { NULL, NULL };
+
+static struct rbuffer_pool P;
+static __thread struct counter * C = NULL;
+
+static struct counter *
+thread_counter() {
+	struct counter * c = C;
+	if (c == NULL) {
+		c = skynet_malloc(sizeof(*c));
+		memset(c, 0, sizeof(*c));
+		struct counter * head;
+		do {
+			head = P.counter;
+			c->next = head;
+		} while (!ATOM_CAS_POINTER(&P.counter, head, c));
+		C = c;
+	}
+	return c;
+}
+
+void
+socket_rbuffer_init(void) {
+	memset(&P, 0, sizeof(P));
+#ifndef NOUSE_JEMALLOC
+	size_t sz = (size_t)CLASS_REGION * MAX_CLASS;
+	char * base = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) {
+		skynet_error(NULL, "Socket read buffer pool disabled : mmap failed");
+		return;
+	}
+	int i;
+	for (i=0;i<MAX_CLASS;i++) {
+		struct size_class *c = &P.c[i];
+		spinlock_init(&c->lock);
+		c->block_size = (int)sizeof(struct block) + (MIN_BUFFER << i);
+		c->capacity = CLASS_REGION / c->block_size;
+		c->base = base + (size_t)CLASS_REGION * i;
+	}
+	SOCKET_RBUFFER.end = base + sz;
+	SOCKET_RBUFFER.begin = base;
+#endif
+}
+
+static inline struct block *
+find_block(const void *ptr) {
+	size_t offset = (const char *)ptr - SOCKET_RBUFFER.begin;
+	struct size_class *c = &P.c[offset / CLASS_REGION];
+	offset %= CLASS_REGION;
+	return (struct block *)(c->base + offset / c->block_size * c->block_size);
+}
+
+static struct block *
+new_block(struct size_class *c) {
+	struct block *b;
+	spinlock_lock(&c->lock);
+	b = c->freelist;
+	if (b == NULL) {
+		// take all the released blocks
+		do {
+			b = c->released;
+		} while (!ATOM_CAS_POINTER(&c->released, b, NULL));
+	}
+	if (b) {
+		c->freelist = b->next;
+	} else if (c->top < c->capacity) {
+		b = (struct block *)(c->base + (size_t)c->top * c->block_size);
+		b->cls = (int)(c - P.c);
+		++c->top;
+	}
+	spinlock_unlock(&c->lock);
+	return b;
+}
+
+void *
+socket_rbuffer_alloc(int sz) {
+	if (SOCKET_RBUFFER.begin) {
+		int i;
+		for (i=0;i<MAX_CLASS;i++) {
+			if (sz <= (MIN_BUFFER << i)) {
+				struct block *b = new_block(&P.c[i]);
+				if (b == NULL)
+					break;
+				b->ref = 1;
+				++thread_counter()->pool;
+				return b->data;
+			}
+		}
+	}
+	++thread_counter()->malloc;
+	return skynet_malloc(sz);
+}
+
+void *
+socket_rbuffer_header(void *data) {
+	if (!socket_rbuffer_owns(data)) {
+		++thread_counter()->wrapper;
+		return NULL;
+	}
+	struct block *b = find_block(data);
+	assert(b->data == data);
+	ATOM_INC(&b->ref);
+	return b->header;
+}
+
+int
+socket_rbuffer_retain(void *ptr) {
+	if (!socket_rbuffer_owns(ptr))
+		return 0;
+	struct block *b = find_block(ptr);
+	ATOM_INC(&b->ref);
+	return 1;
+}
+
+void
+socket_rbuffer_free(void *ptr) {
+	struct block *b = find_block(ptr);
+	if (ATOM_DEC(&b->ref) > 0)
+		return;
+	struct size_class *c = &P.c[b->cls];
+	struct block *head;
+	do {
+		head = c->released;
+		b->next = head;
+	} while (!ATOM_CAS_POINTER(&c->released, head, b));
+}
+
+void *
+socket_rbuffer_realloc(void *ptr, size_t sz) {
+	struct block *b = find_block(ptr);
+	size_t left = (char *)b + P.c[b->cls].block_size - (char *)ptr;
+	void * newptr = skynet_malloc(sz);
+	memcpy(newptr, ptr, sz < left ? sz : left);
+	socket_rbuffer_free(ptr);
+	return newptr;
+}
+
+void
+socket_rbuffer_stat(struct socket_rbuffer_stat *stat) {
+	struct counter * c;
+	stat->pool = 0;
+	stat->malloc = 0;
+	stat->wrapper = 0;
+	for (c = P.counter; c; c = c->next) {
+		stat->pool += c->pool;
+		stat->malloc += c->malloc;
+		stat->wrapper += c->wrapper;
+	}
+}
@@ -0,0 +1,44 @@
+#ifndef skynet_socket_rbuffer_h
+#define skynet_socket_rbuffer_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Pooled read buffers for socket thread.
+// Each block has RBUFFER_HEADER bytes before the data for the socket message wrapper, and the block is refcounted,
+// so the data and the wrapper can be freed by skynet_free separately. It's enabled only with the malloc hook (jemalloc),
+// because skynet_free/skynet_realloc must return the pooled block to the pool.
+
+#define RBUFFER_HEADER 32
+
+struct socket_rbuffer_region {
+	char * begin;
+	char * end;
+};
+
+extern struct socket_rbuffer_region SOCKET_RBUFFER;
+
+struct socket_rbuffer_stat {
+	uint64_t pool;		// buffers from pool
+	uint64_t malloc;	// buffers by skynet_malloc
+	uint64_t wrapper;	// message wrappers by skynet_malloc
+};
+
+void socket_rbuffer_init(void);
+// returns data pointer, fallback to skynet_malloc when the pool is disabled, full, or sz is too large.
+void * socket_rbuffer_alloc(int sz);
+// returns RBUFFER_HEADER bytes before the data and retain the block, or NULL if data is not pooled.
+void * socket_rbuffer_header(void *data);
+// retain the block by any pointer in it, returns 0 if ptr is not pooled.
+int socket_rbuffer_retain(void *ptr);
+// release the block by any pointer in it
+void socket_rbuffer_free(void *ptr);
+void * socket_rbuffer_realloc(void *ptr, size_t sz);
+void socket_rbuffer_stat(struct socket_rbuffer_stat *);
+
+static inline int
+socket_rbuffer_owns(const void *ptr) {
+	return (const char *)ptr >= SOCKET_RBUFFER.begin && (const char *)ptr < SOCKET_RBUFFER.end;
+}
+
+#endif
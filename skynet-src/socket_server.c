@@ -2,11 +2,13 @@
 
 #include "socket_server.h"
 #include "socket_poll.h"
+#include "socket_rbuffer.h"
 #include "atomic.h"
 #include "spinlock.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/tcp.h>
 #include <unistd.h>
 #include <errno.h>
@@ -16,6 +18,16 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#ifdef USE_IO_URING
+#include "socket_uring.h"
+#include <poll.h>
+#endif
 
 #define MAX_INFO 128
 // MAX_SOCKET will be 2^MAX_SOCKET_P
@@ -37,7 +49,8 @@
 #define PRIORITY_HIGH 0
 #define PRIORITY_LOW 1
 
-#define HASH_ID(id) (((unsigned)id) % MAX_SOCKET)
+// socket id is local_id * shard_n + shard_index, see reserve_id
+#define HASH_ID(ss, id) ((((unsigned)id) / (ss)->shard_n) % MAX_SOCKET)
 
 #define PROTOCOL_TCP 0
 #define PROTOCOL_UDP 1
@@ -47,6 +60,12 @@
 
 #define MAX_UDP_PACKAGE 65535
 
+#ifdef IOV_MAX
+#define MAX_IOV IOV_MAX
+#else
+#define MAX_IOV 1024
+#endif
+
 // EAGAIN and EWOULDBLOCK may be not the same value.
 #if (EAGAIN != EWOULDBLOCK)
 #define AGAIN_WOULDBLOCK EAGAIN : case EWOULDBLOCK
@@ -56,6 +75,21 @@
 
 #define WARNING_SIZE (1024*1024)
 
+#ifdef USE_IO_URING
+// The low 3 bits of user_data is the request type, the others are socket id (or struct uring_send *).
+#define URING_OP_IGNORE 0
+#define URING_OP_DOORBELL 1
+#define URING_OP_ACCEPT 2
+#define URING_OP_RECV 3
+#define URING_OP_POLL 4
+#define URING_OP_SEND 5
+#define URING_OP_MASK 7
+#define URING_DATA(id, op) ((uint64_t)(uint32_t)(id) << 3 | (op))
+#define URING_ID(data) ((int)((data) >> 3))
+#define URING_ARMED(op) (1 << (op))
+#define URING_IOV 64
+#endif
+
 struct write_buffer {
 	struct write_buffer * next;
 	void *buffer;
@@ -92,22 +126,57 @@ struct socket {
 	int dw_offset;
 	const void * dw_buffer;
 	size_t dw_size;
+#ifdef USE_IO_URING
+	uint8_t uring_armed;	// URING_ARMED(op) of the requests in flight
+	bool uring_dirty;	// in the dirty list of socket server
+	bool uring_pollout;
+	unsigned uring_poll;	// events of the armed poll
+	struct uring_send * uring_send;	// the tcp send in flight
+#endif
 };
 
+#ifdef USE_IO_URING
+// The write buffers taken from the lists of socket, sent by one IORING_OP_SENDMSG.
+struct uring_send {
+	int id;
+	bool closed;	// the socket is closed, free it when the send completes
+	struct write_buffer * head;
+	struct msghdr msg;
+	struct iovec iov[URING_IOV];
+};
+#endif
+
+struct request_node;
+
 struct socket_server {
 	int recvctrl_fd;
 	int sendctrl_fd;
 	int checkctrl;
+	int doorbell;
+	struct request_node * ctrl_head;	// pushed by other threads, lifo
+	struct request_node * ctrl_list;	// taken by poll thread, fifo
 	poll_fd event_fd;
 	int alloc_id;
+	int shard_index;
+	int shard_n;
+	int accept_shard;
+	struct socket_server **group;
 	int event_n;
 	int event_index;
 	struct socket_object_interface soi;
 	struct event ev[MAX_EVENT];
+#ifdef USE_IO_URING
+	struct uring * uring;	// NULL when epoll is used
+	bool doorbell_armed;
+	uint64_t doorbell_value;
+	int dirty_n;
+	int dirty_cap;
+	int * dirty;	// id of the sockets need to (re)arm the requests or to send
+	struct io_uring_cqe cqe[MAX_EVENT];
+#endif
 	struct socket slot[MAX_SOCKET];
 	char buffer[MAX_INFO];
 	uint8_t udpbuffer[MAX_UDP_PACKAGE];
-	fd_set rfds;
 };
 
 struct request_open {
@@ -185,10 +254,10 @@ struct request_udp {
 	T Set opt
 	U Create UDP socket
 	C set udp address
+	W Send the rest of direct write (io_uring)
  */
 
 struct request_package {
-	uint8_t header[8];	// 6 bytes dummy
 	union {
 		char buffer[256];
 		struct request_open open;
@@ -202,7 +271,17 @@ struct request_package {
 		struct request_udp udp;
 		struct request_setudp set_udp;
 	} u;
-	uint8_t dummy[256];
+};
+
+// Requests are queued in memory, the ctrl fd (eventfd or pipe) is only a doorbell to wake up the poll thread.
+struct request_node {
+	struct request_node * next;
+	uint8_t type;
+	uint8_t len;
+	union {
+		char buffer[1];
+		uintptr_t align;
+	} u;
 };
 
 union sockaddr_all {
@@ -297,7 +376,10 @@ reserve_id(struct socket_server *ss) {
 		if (id < 0) {
 			id = ATOM_AND(&(ss->alloc_id), 0x7fffffff);
 		}
-		struct socket *s = &ss->slot[HASH_ID(id)];
+		if (ss->shard_n > 1) {
+			id = (id % (0x7fffffff / ss->shard_n)) * ss->shard_n + ss->shard_index;
+		}
+		struct socket *s = &ss->slot[HASH_ID(ss, id)];
 		if (s->type == SOCKET_TYPE_INVALID) {
 			if (ATOM_CAS(&s->type, SOCKET_TYPE_INVALID, SOCKET_TYPE_RESERVE)) {
 				s->id = id;
@@ -321,25 +403,36 @@ clear_wb_list(struct wb_list *list) {
 	list->tail = NULL;
 }
 
-struct socket_server * 
-socket_server_create() {
-	int i;
+// epoll or kqueue
+static struct socket_server *
+socket_server_create_poll() {
 	int fd[2];
 	poll_fd efd = sp_create();
 	if (sp_invalid(efd)) {
 		fprintf(stderr, "socket-server: create event pool failed.\n");
 		return NULL;
 	}
+#ifdef __linux__
+	fd[0] = fd[1] = eventfd(0, EFD_NONBLOCK);
+	if (fd[0] < 0) {
+		sp_release(efd);
+		fprintf(stderr, "socket-server: create eventfd failed.\n");
+		return NULL;
+	}
+#else
 	if (pipe(fd)) {
 		sp_release(efd);
 		fprintf(stderr, "socket-server: create socket pair failed.\n");
 		return NULL;
 	}
+	sp_nonblocking(fd[0]);
+#endif
 	if (sp_add(efd, fd[0], NULL)) {
 		// add recvctrl_fd to event poll
 		fprintf(stderr, "socket-server: can't add server fd to event pool.\n");
 		close(fd[0]);
-		close(fd[1]);
+		if (fd[1] != fd[0])
+			close(fd[1]);
 		sp_release(efd);
 		return NULL;
 	}
@@ -348,7 +441,62 @@ socket_server_create() {
 	ss->event_fd = efd;
 	ss->recvctrl_fd = fd[0];
 	ss->sendctrl_fd = fd[1];
+#ifdef USE_IO_URING
+	ss->uring = NULL;
+#endif
+	return ss;
+}
+
+static int SOCKET_URING = 0;
+
+#ifdef USE_IO_URING
+
+static struct socket_server *
+uring_create() {
+	struct uring * u = uring_new();
+	if (u == NULL)
+		return NULL;
+	// the doorbell is read by the ring, so it's blocking
+	int fd = eventfd(0, 0);
+	if (fd < 0) {
+		uring_free(u);
+		return NULL;
+	}
+	struct socket_server *ss = MALLOC(sizeof(*ss));
+	ss->event_fd = -1;
+	ss->recvctrl_fd = fd;
+	ss->sendctrl_fd = fd;
+	ss->uring = u;
+	ss->doorbell_armed = false;
+	ss->dirty_n = 0;
+	ss->dirty_cap = 0;
+	ss->dirty = NULL;
+	return ss;
+}
+
+#endif
+
+struct socket_server * 
+socket_server_create() {
+	int i;
+	struct socket_server *ss = NULL;
+#ifdef USE_IO_URING
+	if (SOCKET_URING) {
+		ss = uring_create();
+		if (ss == NULL) {
+			fprintf(stderr, "socket-server: create io_uring failed, use epoll instead.\n");
+		}
+	}
+#endif
+	if (ss == NULL) {
+		ss = socket_server_create_poll();
+		if (ss == NULL)
+			return NULL;
+	}
 	ss->checkctrl = 1;
+	ss->doorbell = 0;
+	ss->ctrl_head = NULL;
+	ss->ctrl_list = NULL;
 
 	for (i=0;i<MAX_SOCKET;i++) {
 		struct socket *s = &ss->slot[i];
@@ -357,15 +505,35 @@ socket_server_create() {
 		clear_wb_list(&s->low);
 	}
 	ss->alloc_id = 0;
+	ss->shard_index = 0;
+	ss->shard_n = 1;
+	ss->accept_shard = 0;
+	ss->group = NULL;
 	ss->event_n = 0;
 	ss->event_index = 0;
 	memset(&ss->soi, 0, sizeof(ss->soi));
-	FD_ZERO(&ss->rfds);
-	assert(ss->recvctrl_fd < FD_SETSIZE);
 
 	return ss;
 }
 
+int
+socket_server_iouring(int enable) {
+	SOCKET_URING = 0;
+#ifdef USE_IO_URING
+	if (enable) {
+		// probe the kernel
+		struct uring *u = uring_new();
+		if (u) {
+			uring_free(u);
+			SOCKET_URING = 1;
+		} else {
+			fprintf(stderr, "socket-server: io_uring is not supported, use epoll instead.\n");
+		}
+	}
+#endif
+	return SOCKET_URING;
+}
+
 static void
 free_wb_list(struct socket_server *ss, struct wb_list *list) {
 	struct write_buffer *wb = list->head;
@@ -385,6 +553,89 @@ free_buffer(struct socket_server *ss, const void * buffer, int sz) {
 	so.free_func((void *)buffer);
 }
 
+#ifdef USE_IO_URING
+
+// the requests of socket are (re)armed before waiting for the completions, see uring_arm
+static void
+uring_mark(struct socket_server *ss, struct socket *s) {
+	if (s->uring_dirty)
+		return;
+	s->uring_dirty = true;
+	if (ss->dirty_n >= ss->dirty_cap) {
+		ss->dirty_cap = ss->dirty_cap ? ss->dirty_cap * 2 : 64;
+		ss->dirty = skynet_realloc(ss->dirty, ss->dirty_cap * sizeof(int));
+	}
+	ss->dirty[ss->dirty_n++] = s->id;
+}
+
+static void
+uring_cancel(struct uring *u, uint64_t user_data) {
+	struct io_uring_sqe *sqe = uring_sqe(u);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = user_data;
+	sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+	sqe->user_data = URING_OP_IGNORE;
+}
+
+static void
+uring_del(struct socket_server *ss, struct socket *s) {
+	struct uring *u = ss->uring;
+	int op;
+	for (op = URING_OP_ACCEPT; op <= URING_OP_POLL; op++) {
+		if (s->uring_armed & URING_ARMED(op)) {
+			uring_cancel(u, URING_DATA(s->id, op));
+		}
+	}
+	s->uring_armed = 0;
+	if (s->uring_send) {
+		// the write buffers may be still in use by the kernel, free them when it completes
+		s->uring_send->closed = true;
+		uring_cancel(u, (uintptr_t)s->uring_send | URING_OP_SEND);
+		s->uring_send = NULL;
+	}
+	// the queued requests refer to the fd, submit them before it's closed (and reused)
+	uring_submit(u);
+}
+
+#endif
+
+static int
+socket_poll_add(struct socket_server *ss, struct socket *s, int fd) {
+#ifdef USE_IO_URING
+	if (ss->uring) {
+		uring_mark(ss, s);
+		return 0;
+	}
+#endif
+	return sp_add(ss->event_fd, fd, s);
+}
+
+static void
+socket_poll_del(struct socket_server *ss, struct socket *s) {
+#ifdef USE_IO_URING
+	if (ss->uring) {
+		uring_del(ss, s);
+		return;
+	}
+#endif
+	sp_del(ss->event_fd, s->fd);
+}
+
+// only in poll thread
+static void
+socket_poll_write(struct socket_server *ss, struct socket *s, bool enable) {
+#ifdef USE_IO_URING
+	if (ss->uring) {
+		// tcp sends by IORING_OP_SENDMSG, others wait for POLLOUT
+		s->uring_pollout = enable;
+		uring_mark(ss, s);
+		return;
+	}
+#endif
+	sp_write(ss->event_fd, s->fd, s, enable);
+}
+
 static void
 force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
 	result->id = s->id;
@@ -398,7 +649,7 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 	free_wb_list(ss,&s->high);
 	free_wb_list(ss,&s->low);
 	if (s->type != SOCKET_TYPE_PACCEPT && s->type != SOCKET_TYPE_PLISTEN) {
-		sp_del(ss->event_fd, s->fd);
+		socket_poll_del(ss, s);
 	}
 	socket_lock(l);
 	if (s->type != SOCKET_TYPE_BIND) {
@@ -426,8 +677,29 @@ socket_server_release(struct socket_server *ss) {
 			force_close(ss, s, &l, &dummy);
 		}
 	}
-	close(ss->sendctrl_fd);
+	struct request_node *req = ss->ctrl_list;
+	while (req) {
+		struct request_node *next = req->next;
+		FREE(req);
+		req = next;
+	}
+	req = ss->ctrl_head;
+	while (req) {
+		struct request_node *next = req->next;
+		FREE(req);
+		req = next;
+	}
+	if (ss->sendctrl_fd != ss->recvctrl_fd)
+		close(ss->sendctrl_fd);
 	close(ss->recvctrl_fd);
+#ifdef USE_IO_URING
+	if (ss->uring) {
+		uring_free(ss->uring);
+		FREE(ss->dirty);
+		FREE(ss);
+		return;
+	}
+#endif
 	sp_release(ss->event_fd);
 	FREE(ss);
 }
@@ -440,11 +712,18 @@ check_wb_list(struct wb_list *s) {
 
 static struct socket *
 new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque, bool add) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	assert(s->type == SOCKET_TYPE_RESERVE);
+#ifdef USE_IO_URING
+	s->uring_armed = 0;
+	s->uring_dirty = false;
+	s->uring_pollout = false;
+	s->uring_poll = 0;
+	s->uring_send = NULL;
+#endif
 
 	if (add) {
-		if (sp_add(ss->event_fd, fd, s)) {
+		if (socket_poll_add(ss, s, fd)) {
 			s->type = SOCKET_TYPE_INVALID;
 			return NULL;
 		}
@@ -530,23 +809,33 @@ open_socket(struct socket_server *ss, struct request_open * request, struct sock
 		return SOCKET_OPEN;
 	} else {
 		ns->type = SOCKET_TYPE_CONNECTING;
-		sp_write(ss->event_fd, ns->fd, ns, true);
+		socket_poll_write(ss, ns, true);
 	}
 
 	freeaddrinfo( ai_list );
 	return -1;
 _failed:
 	freeaddrinfo( ai_list );
-	ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+	ss->slot[HASH_ID(ss, id)].type = SOCKET_TYPE_INVALID;
 	return SOCKET_ERR;
 }
 
+// gather up to MAX_IOV write buffers into one writev
 static int
 send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
+	struct iovec iov[MAX_IOV];
 	while (list->head) {
 		struct write_buffer * tmp = list->head;
+		int n = 0;
+		while (tmp && n < MAX_IOV) {
+			iov[n].iov_base = tmp->ptr;
+			iov[n].iov_len = tmp->sz;
+			++n;
+			tmp = tmp->next;
+		}
+		ssize_t sz;
 		for (;;) {
-			ssize_t sz = write(s->fd, tmp->ptr, tmp->sz);
+			sz = writev(s->fd, iov, n);
 			if (sz < 0) {
 				switch(errno) {
 				case EINTR:
@@ -557,16 +846,23 @@ send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 				force_close(ss,s,l,result);
 				return SOCKET_CLOSE;
 			}
-			s->wb_size -= sz;
-			if (sz != tmp->sz) {
-				tmp->ptr += sz;
-				tmp->sz -= sz;
+			break;
+		}
+		s->wb_size -= sz;
+		ssize_t left = sz;
+		int i;
+		// free the buffers written, and the last one may be written partly
+		for (i=0;i<n;i++) {
+			tmp = list->head;
+			if (left < tmp->sz) {
+				tmp->ptr += left;
+				tmp->sz -= left;
 				return -1;
 			}
-			break;
+			left -= tmp->sz;
+			list->head = tmp->next;
+			write_buffer_free(ss,tmp);
 		}
-		list->head = tmp->next;
-		write_buffer_free(ss,tmp);
 	}
 	list->tail = NULL;
 
@@ -703,7 +999,7 @@ send_buffer_(struct socket_server *ss, struct socket *s, struct socket_lock *l,
 		} 
 		// step 4
 		assert(send_buffer_empty(s) && s->wb_size == 0);
-		sp_write(ss->event_fd, s->fd, s, false);			
+		socket_poll_write(ss, s, false);
 
 		if (s->type == SOCKET_TYPE_HALFCLOSE) {
 				force_close(ss, s, l, result);
@@ -722,10 +1018,9 @@ send_buffer_(struct socket_server *ss, struct socket *s, struct socket_lock *l,
 	return -1;
 }
 
-static int
-send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
-	if (!socket_trylock(l))
-		return -1;	// blocked by direct write, send later.
+// call with lock
+static void
+take_direct_write(struct socket_server *ss, struct socket *s) {
 	if (s->dw_buffer) {
 		// add direct write buffer before high.head
 		struct write_buffer * buf = MALLOC(SIZEOF_TCPBUFFER);
@@ -744,12 +1039,167 @@ send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 		}
 		s->dw_buffer = NULL;
 	}
+}
+
+static int
+send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
+	if (!socket_trylock(l))
+		return -1;	// blocked by direct write, send later.
+	take_direct_write(ss, s);
 	int r = send_buffer_(ss,s,l,result);
 	socket_unlock(l);
 
 	return r;
 }
 
+#ifdef USE_IO_URING
+
+// tcp sockets receive by multishot recv and send by IORING_OP_SENDMSG, the others use poll.
+static inline int
+uring_tcp(struct socket *s) {
+	return s->protocol == PROTOCOL_TCP && (s->type == SOCKET_TYPE_CONNECTED || s->type == SOCKET_TYPE_HALFCLOSE);
+}
+
+static void
+uring_send_submit(struct uring *u, int fd, struct uring_send *us) {
+	int n = 0;
+	struct write_buffer *wb;
+	for (wb = us->head; wb; wb = wb->next) {
+		us->iov[n].iov_base = wb->ptr;
+		us->iov[n].iov_len = wb->sz;
+		++n;
+	}
+	memset(&us->msg, 0, sizeof(us->msg));
+	us->msg.msg_iov = us->iov;
+	us->msg.msg_iovlen = n;
+	struct io_uring_sqe *sqe = uring_sqe(u);
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)&us->msg;
+	sqe->len = 1;
+	sqe->user_data = (uintptr_t)us | URING_OP_SEND;
+}
+
+static void
+uring_send_free(struct socket_server *ss, struct uring_send *us) {
+	struct write_buffer *wb = us->head;
+	while (wb) {
+		struct write_buffer *tmp = wb;
+		wb = wb->next;
+		write_buffer_free(ss, tmp);
+	}
+	FREE(us);
+}
+
+/*
+	Take at most URING_IOV write buffers from the high list (or the low list if high is empty),
+	and send them by one IORING_OP_SENDMSG. Only one send is in flight for each socket,
+	and the sends of all the sockets are submitted together before the poll thread waits.
+ */
+static void
+uring_send(struct socket_server *ss, struct socket *s) {
+	if (s->uring_send)
+		return;
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	socket_lock(&l);
+	take_direct_write(ss, s);
+	struct wb_list *list = s->high.head ? &s->high : &s->low;
+	if (list->head == NULL) {
+		socket_unlock(&l);
+		return;
+	}
+	struct uring_send *us = MALLOC(sizeof(*us));
+	us->id = s->id;
+	us->closed = false;
+	us->head = list->head;
+	struct write_buffer *tail = list->head;
+	int n = 1;
+	while (tail->next && n < URING_IOV) {
+		tail = tail->next;
+		++n;
+	}
+	list->head = tail->next;
+	if (list->head == NULL) {
+		list->tail = NULL;
+	}
+	tail->next = NULL;
+	s->uring_send = us;
+	socket_unlock(&l);
+	uring_send_submit(ss->uring, s->fd, us);
+}
+
+static int
+uring_send_done(struct socket_server *ss, struct uring_send *us, int res, struct socket_message *result) {
+	if (us->closed) {
+		uring_send_free(ss, us);
+		return -1;
+	}
+	struct socket *s = &ss->slot[HASH_ID(ss, us->id)];
+	assert(s->id == us->id && s->uring_send == us);
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	if (res < 0) {
+		if (res == -EINTR || res == -EAGAIN) {
+			uring_send_submit(ss->uring, s->fd, us);
+			return -1;
+		}
+		s->uring_send = NULL;
+		uring_send_free(ss, us);
+		force_close(ss, s, &l, result);
+		return SOCKET_CLOSE;
+	}
+	s->wb_size -= res;
+	// free the buffers sent, and the last one may be sent partly
+	while (us->head) {
+		struct write_buffer *tmp = us->head;
+		if (res < tmp->sz) {
+			tmp->ptr += res;
+			tmp->sz -= res;
+			uring_send_submit(ss->uring, s->fd, us);
+			return -1;
+		}
+		res -= tmp->sz;
+		us->head = tmp->next;
+		write_buffer_free(ss, tmp);
+	}
+	socket_lock(&l);
+	s->uring_send = NULL;
+	socket_unlock(&l);
+	FREE(us);
+	uring_send(ss, s);
+	if (s->uring_send == NULL) {
+		// all the buffers are sent
+		if (s->type == SOCKET_TYPE_HALFCLOSE) {
+			force_close(ss, s, &l, result);
+			return SOCKET_CLOSE;
+		}
+		if (s->warn_size > 0) {
+			s->warn_size = 0;
+			result->opaque = s->opaque;
+			result->id = s->id;
+			result->ud = 0;
+			result->data = NULL;
+			return SOCKET_WARNING;
+		}
+	}
+	return -1;
+}
+
+#endif
+
+// send the buffers from the poll thread
+static int
+socket_send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
+#ifdef USE_IO_URING
+	if (ss->uring && uring_tcp(s)) {
+		uring_send(ss, s);
+		return -1;
+	}
+#endif
+	return send_buffer(ss, s, l, result);
+}
+
 static struct write_buffer *
 append_sendbuffer_(struct socket_server *ss, struct wb_list *s, struct request_send * request, int size) {
 	struct write_buffer * buf = MALLOC(size);
@@ -801,7 +1251,7 @@ append_sendbuffer_low(struct socket_server *ss,struct socket *s, struct request_
 static int
 send_socket(struct socket_server *ss, struct request_send * request, struct socket_message *result, int priority, const uint8_t *udp_address) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	struct send_object so;
 	send_object_init(ss, &so, request->buffer, request->sz);
 	if (s->type == SOCKET_TYPE_INVALID || s->id != id 
@@ -833,7 +1283,7 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 				return -1;
 			}
 		}
-		sp_write(ss->event_fd, s->fd, s, true);
+		socket_poll_write(ss, s, true);
 	} else {
 		if (s->protocol == PROTOCOL_TCP) {
 			if (priority == PRIORITY_LOW) {
@@ -875,20 +1325,24 @@ _failed:
 	result->id = id;
 	result->ud = 0;
 	result->data = "reach skynet socket number limit";
-	ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+	ss->slot[HASH_ID(ss, id)].type = SOCKET_TYPE_INVALID;
 
 	return SOCKET_ERR;
 }
 
 static inline int
 nomore_send_data(struct socket *s) {
+#ifdef USE_IO_URING
+	if (s->uring_send)
+		return 0;
+#endif
 	return send_buffer_empty(s) && s->dw_buffer == NULL;
 }
 
 static int
 close_socket(struct socket_server *ss, struct request_close *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	if (s->type == SOCKET_TYPE_INVALID || s->id != id) {
 		result->id = id;
 		result->opaque = request->opaque;
@@ -899,7 +1353,7 @@ close_socket(struct socket_server *ss, struct request_close *request, struct soc
 	struct socket_lock l;
 	socket_lock_init(s, &l);
 	if (!nomore_send_data(s)) {
-		int type = send_buffer(ss,s,&l,result);
+		int type = socket_send_buffer(ss,s,&l,result);
 		// type : -1 or SOCKET_WARNING or SOCKET_CLOSE, SOCKET_WARNING means nomore_send_data
 		if (type != -1 && type != SOCKET_WARNING)
 			return type;
@@ -939,7 +1393,7 @@ start_socket(struct socket_server *ss, struct request_start *request, struct soc
 	result->opaque = request->opaque;
 	result->ud = 0;
 	result->data = NULL;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = &ss->slot[HASH_ID(ss, id)];
 	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
 		result->data = "invalid socket";
 		return SOCKET_ERR;
@@ -947,7 +1401,7 @@ start_socket(struct socket_server *ss, struct request_start *request, struct soc
 	struct socket_lock l;
 	socket_lock_init(s, &l);
 	if (s->type == SOCKET_TYPE_PACCEPT || s->type == SOCKET_TYPE_PLISTEN) {
-		if (sp_add(ss->event_fd, s->fd, s)) {
+		if (socket_poll_add(ss, s, s->fd)) {
 			force_close(ss, s, &l, result);
 			result->data = strerror(errno);
 			return SOCKET_ERR;
@@ -969,7 +1423,7 @@ start_socket(struct socket_server *ss, struct request_start *request, struct soc
 static void
 setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = &ss->slot[HASH_ID(ss, id)];
 	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
 		return;
 	}
@@ -977,34 +1431,48 @@ setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 	setsockopt(s->fd, IPPROTO_TCP, request->what, &v, sizeof(v));
 }
 
+// clear the doorbell, the ctrl fd is nonblocking.
 static void
-block_readpipe(int pipefd, void *buffer, int sz) {
+read_doorbell(struct socket_server *ss) {
+	char tmp[128];
 	for (;;) {
-		int n = read(pipefd, buffer, sz);
+		int n = read(ss->recvctrl_fd, tmp, sizeof(tmp));
 		if (n<0) {
 			if (errno == EINTR)
 				continue;
-			fprintf(stderr, "socket-server : read pipe error %s.\n",strerror(errno));
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				fprintf(stderr, "socket-server : read ctrl fd error %s.\n",strerror(errno));
+			}
 			return;
 		}
-		// must atomic read from a pipe
-		assert(n == sz);
+#ifndef __linux__
+		if (n == sizeof(tmp))
+			continue;
+#endif
 		return;
 	}
 }
 
 static int
 has_cmd(struct socket_server *ss) {
-	struct timeval tv = {0,0};
-	int retval;
-
-	FD_SET(ss->recvctrl_fd, &ss->rfds);
-
-	retval = select(ss->recvctrl_fd+1, &ss->rfds, NULL, NULL, &tv);
-	if (retval == 1) {
+	if (ss->ctrl_list)
 		return 1;
-	}
-	return 0;
+	// reset doorbell before taking the requests (even if there is none), so a request pushed later will ring it again.
+	ss->doorbell = 0;
+	struct request_node *head;
+	do {
+		head = ss->ctrl_head;
+	} while (!ATOM_CAS_POINTER(&ss->ctrl_head, head, NULL));
+	// reverse to fifo
+	struct request_node *list = NULL;
+	while (head) {
+		struct request_node *next = head->next;
+		head->next = list;
+		list = head;
+		head = next;
+	}
+	ss->ctrl_list = list;
+	return list != NULL;
 }
 
 static void
@@ -1019,7 +1487,7 @@ add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 	struct socket *ns = new_fd(ss, id, udp->fd, protocol, udp->opaque, true);
 	if (ns == NULL) {
 		close(udp->fd);
-		ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+		ss->slot[HASH_ID(ss, id)].type = SOCKET_TYPE_INVALID;
 		return;
 	}
 	ns->type = SOCKET_TYPE_CONNECTED;
@@ -1029,7 +1497,7 @@ add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 static int
 set_udp_address(struct socket_server *ss, struct request_setudp *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = &ss->slot[HASH_ID(ss, id)];
 	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
 		return -1;
 	}
@@ -1054,16 +1522,7 @@ set_udp_address(struct socket_server *ss, struct request_setudp *request, struct
 
 // return type
 static int
-ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
-	int fd = ss->recvctrl_fd;
-	// the length of message is one byte, so 256+8 buffer size is enough.
-	uint8_t buffer[256];
-	uint8_t header[2];
-	block_readpipe(fd, header, sizeof(header));
-	int type = header[0];
-	int len = header[1];
-	block_readpipe(fd, buffer, len);
-	// ctrl command only exist in local fd, so don't worry about endian.
+ctrl_cmd_(struct socket_server *ss, int type, void *buffer, struct socket_message *result) {
 	switch (type) {
 	case 'S':
 		return start_socket(ss,(struct request_start *)buffer, result);
@@ -1097,6 +1556,14 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	case 'U':
 		add_udp_socket(ss, (struct request_udp *)buffer);
 		return -1;
+	case 'W': {
+		struct request_send *request = (struct request_send *)buffer;
+		struct socket *s = &ss->slot[HASH_ID(ss, request->id)];
+		if (s->type != SOCKET_TYPE_INVALID && s->id == request->id) {
+			socket_poll_write(ss, s, true);
+		}
+		return -1;
+	}
 	default:
 		fprintf(stderr, "socket-server: Unknown ctrl %c.\n",type);
 		return -1;
@@ -1105,11 +1572,20 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	return -1;
 }
 
+static int
+ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
+	struct request_node *req = ss->ctrl_list;
+	ss->ctrl_list = req->next;
+	int type = ctrl_cmd_(ss, req->type, req->u.buffer, result);
+	FREE(req);
+	return type;
+}
+
 // return -1 (ignore) when error
 static int
 forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
 	int sz = s->p.size;
-	char * buffer = MALLOC(sz);
+	char * buffer = socket_rbuffer_alloc(sz);
 	int n = (int)read(s->fd, buffer, sz);
 	if (n<0) {
 		FREE(buffer);
@@ -1228,7 +1704,7 @@ report_connect(struct socket_server *ss, struct socket *s, struct socket_lock *l
 		result->id = s->id;
 		result->ud = 0;
 		if (nomore_send_data(s)) {
-			sp_write(ss->event_fd, s->fd, s, false);
+			socket_poll_write(ss, s, false);
 		}
 		union sockaddr_all u;
 		socklen_t slen = sizeof(u);
@@ -1244,45 +1720,39 @@ report_connect(struct socket_server *ss, struct socket *s, struct socket_lock *l
 	}
 }
 
-// return 0 when failed, or -1 when file limit
+// return 0 when failed
 static int
-report_accept(struct socket_server *ss, struct socket *s, struct socket_message *result) {
-	union sockaddr_all u;
-	socklen_t len = sizeof(u);
-	int client_fd = accept(s->fd, &u.s, &len);
-	if (client_fd < 0) {
-		if (errno == EMFILE || errno == ENFILE) {
-			result->opaque = s->opaque;
-			result->id = s->id;
-			result->ud = 0;
-			result->data = strerror(errno);
-			return -1;
-		} else {
-			return 0;
-		}
-	}
-	int id = reserve_id(ss);
+accept_socket(struct socket_server *ss, struct socket *s, int client_fd, union sockaddr_all *u, struct socket_message *result) {
+	// spread accepted connections across shards, socket_server_start will add it to the poll of its own shard.
+	struct socket_server *ts = ss;
+	if (ss->shard_n > 1) {
+		ts = ss->group[ss->accept_shard];
+		if (++ss->accept_shard >= ss->shard_n)
+			ss->accept_shard = 0;
+	}
+	int id = reserve_id(ts);
 	if (id < 0) {
 		close(client_fd);
 		return 0;
 	}
 	socket_keepalive(client_fd);
 	sp_nonblocking(client_fd);
-	struct socket *ns = new_fd(ss, id, client_fd, PROTOCOL_TCP, s->opaque, false);
+	struct socket *ns = new_fd(ts, id, client_fd, PROTOCOL_TCP, s->opaque, false);
 	if (ns == NULL) {
 		close(client_fd);
 		return 0;
 	}
+	__sync_synchronize();
 	ns->type = SOCKET_TYPE_PACCEPT;
 	result->opaque = s->opaque;
 	result->id = s->id;
 	result->ud = id;
 	result->data = NULL;
 
-	void * sin_addr = (u.s.sa_family == AF_INET) ? (void*)&u.v4.sin_addr : (void *)&u.v6.sin6_addr;
-	int sin_port = ntohs((u.s.sa_family == AF_INET) ? u.v4.sin_port : u.v6.sin6_port);
+	void * sin_addr = (u->s.sa_family == AF_INET) ? (void*)&u->v4.sin_addr : (void *)&u->v6.sin6_addr;
+	int sin_port = ntohs((u->s.sa_family == AF_INET) ? u->v4.sin_port : u->v6.sin6_port);
 	char tmp[INET6_ADDRSTRLEN];
-	if (inet_ntop(u.s.sa_family, sin_addr, tmp, sizeof(tmp))) {
+	if (inet_ntop(u->s.sa_family, sin_addr, tmp, sizeof(tmp))) {
 		snprintf(ss->buffer, sizeof(ss->buffer), "%s:%d", tmp, sin_port);
 		result->data = ss->buffer;
 	}
@@ -1290,6 +1760,26 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 	return 1;
 }
 
+// return 0 when failed, or -1 when file limit
+static int
+report_accept(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	union sockaddr_all u;
+	socklen_t len = sizeof(u);
+	int client_fd = accept(s->fd, &u.s, &len);
+	if (client_fd < 0) {
+		if (errno == EMFILE || errno == ENFILE) {
+			result->opaque = s->opaque;
+			result->id = s->id;
+			result->ud = 0;
+			result->data = strerror(errno);
+			return -1;
+		} else {
+			return 0;
+		}
+	}
+	return accept_socket(ss, s, client_fd, &u, result);
+}
+
 static inline void 
 clear_closed_event(struct socket_server *ss, struct socket_message * result, int type) {
 	if (type == SOCKET_CLOSE || type == SOCKET_ERR) {
@@ -1308,6 +1798,231 @@ clear_closed_event(struct socket_server *ss, struct socket_message * result, int
 	}
 }
 
+#ifdef USE_IO_URING
+
+// (re)arm the requests of the sockets in dirty list, and start the sends
+static void
+uring_arm(struct socket_server *ss) {
+	struct uring *u = ss->uring;
+	struct io_uring_sqe *sqe;
+	if (!ss->doorbell_armed) {
+		sqe = uring_sqe(u);
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = ss->recvctrl_fd;
+		sqe->addr = (uint64_t)(uintptr_t)&ss->doorbell_value;
+		sqe->len = sizeof(ss->doorbell_value);
+		sqe->user_data = URING_OP_DOORBELL;
+		ss->doorbell_armed = true;
+	}
+	int i;
+	for (i=0;i<ss->dirty_n;i++) {
+		int id = ss->dirty[i];
+		struct socket *s = &ss->slot[HASH_ID(ss, id)];
+		if (s->id != id || !s->uring_dirty)
+			continue;
+		s->uring_dirty = false;
+		switch (s->type) {
+		case SOCKET_TYPE_LISTEN:
+			if (!(s->uring_armed & URING_ARMED(URING_OP_ACCEPT))) {
+				sqe = uring_sqe(u);
+				sqe->opcode = IORING_OP_ACCEPT;
+				sqe->fd = s->fd;
+				sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+				sqe->user_data = URING_DATA(id, URING_OP_ACCEPT);
+				s->uring_armed |= URING_ARMED(URING_OP_ACCEPT);
+			}
+			break;
+		case SOCKET_TYPE_CONNECTED:
+		case SOCKET_TYPE_HALFCLOSE:
+			if (s->protocol == PROTOCOL_TCP) {
+				if (!(s->uring_armed & URING_ARMED(URING_OP_RECV))) {
+					sqe = uring_sqe(u);
+					sqe->opcode = IORING_OP_RECV;
+					sqe->fd = s->fd;
+					sqe->ioprio = IORING_RECV_MULTISHOT;
+					sqe->flags = IOSQE_BUFFER_SELECT;
+					sqe->buf_group = URING_BUFFER_GROUP;
+					sqe->user_data = URING_DATA(id, URING_OP_RECV);
+					s->uring_armed |= URING_ARMED(URING_OP_RECV);
+				}
+				uring_send(ss, s);
+				break;
+			}
+			// udp : go through
+		case SOCKET_TYPE_CONNECTING:
+		case SOCKET_TYPE_BIND: {
+			unsigned events = POLLIN | (s->uring_pollout ? POLLOUT : 0);
+			if (!(s->uring_armed & URING_ARMED(URING_OP_POLL))) {
+				sqe = uring_sqe(u);
+				sqe->opcode = IORING_OP_POLL_ADD;
+				sqe->fd = s->fd;
+				sqe->poll32_events = events;
+				sqe->user_data = URING_DATA(id, URING_OP_POLL);
+				s->uring_armed |= URING_ARMED(URING_OP_POLL);
+			} else if (s->uring_poll != events) {
+				sqe = uring_sqe(u);
+				sqe->opcode = IORING_OP_POLL_REMOVE;
+				sqe->fd = -1;
+				sqe->addr = URING_DATA(id, URING_OP_POLL);
+				sqe->len = IORING_POLL_UPDATE_EVENTS;
+				sqe->poll32_events = events;
+				sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+				sqe->user_data = URING_OP_IGNORE;
+			}
+			s->uring_poll = events;
+			break;
+		}
+		}
+	}
+	ss->dirty_n = 0;
+}
+
+// multishot recv from the provided buffers, the data is copied out and the buffer is given back at once.
+static int
+uring_forward_tcp(struct socket_server *ss, struct io_uring_cqe *cqe, struct socket_message *result) {
+	int id = URING_ID(cqe->user_data);
+	struct socket *s = &ss->slot[HASH_ID(ss, id)];
+	int valid = s->id == id && s->type != SOCKET_TYPE_INVALID;
+	int res = cqe->res;
+	char * buffer = NULL;
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		struct uring *u = ss->uring;
+		int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		// discard recv data when halfclose
+		if (valid && res > 0 && s->type != SOCKET_TYPE_HALFCLOSE) {
+			buffer = socket_rbuffer_alloc(res);
+			memcpy(buffer, uring_buffer(u, bid), res);
+		}
+		uring_buffer_push(u, bid);
+		uring_buffer_commit(u);
+	}
+	if (!valid)
+		return -1;
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		// multishot recv is terminated (error or out of buffer), rearm it
+		s->uring_armed &= ~URING_ARMED(URING_OP_RECV);
+		uring_mark(ss, s);
+	}
+	if (res > 0) {
+		if (buffer == NULL)
+			return -1;
+		result->opaque = s->opaque;
+		result->id = s->id;
+		result->ud = res;
+		result->data = buffer;
+		return SOCKET_DATA;
+	}
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	if (res == 0) {
+		force_close(ss, s, &l, result);
+		return SOCKET_CLOSE;
+	}
+	switch (-res) {
+	case ENOBUFS:
+	case EINTR:
+	case AGAIN_WOULDBLOCK:
+		return -1;
+	}
+	// close when error
+	force_close(ss, s, &l, result);
+	result->data = strerror(-res);
+	return SOCKET_ERR;
+}
+
+static int
+uring_report_accept(struct socket_server *ss, struct io_uring_cqe *cqe, struct socket_message *result) {
+	int id = URING_ID(cqe->user_data);
+	struct socket *s = &ss->slot[HASH_ID(ss, id)];
+	int res = cqe->res;
+	if (s->id != id || s->type != SOCKET_TYPE_LISTEN) {
+		if (res >= 0)
+			close(res);
+		return -1;
+	}
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		s->uring_armed &= ~URING_ARMED(URING_OP_ACCEPT);
+		uring_mark(ss, s);
+	}
+	if (res < 0) {
+		if (res == -EMFILE || res == -ENFILE) {
+			result->opaque = s->opaque;
+			result->id = s->id;
+			result->ud = 0;
+			result->data = strerror(-res);
+			return SOCKET_ERR;
+		}
+		return -1;
+	}
+	union sockaddr_all u;
+	socklen_t len = sizeof(u);
+	if (getpeername(res, &u.s, &len) != 0) {
+		memset(&u, 0, sizeof(u));
+	}
+	return accept_socket(ss, s, res, &u, result) ? SOCKET_ACCEPT : -1;
+}
+
+// the completions except poll
+static int
+uring_dispatch(struct socket_server *ss, struct io_uring_cqe *cqe, struct socket_message *result) {
+	switch (cqe->user_data & URING_OP_MASK) {
+	case URING_OP_DOORBELL:
+		// dispatch ctrl requests at beginning
+		ss->doorbell_armed = false;
+		ss->checkctrl = 1;
+		return -1;
+	case URING_OP_ACCEPT:
+		return uring_report_accept(ss, cqe, result);
+	case URING_OP_RECV:
+		return uring_forward_tcp(ss, cqe, result);
+	case URING_OP_SEND:
+		return uring_send_done(ss, (struct uring_send *)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_OP_MASK), cqe->res, result);
+	}
+	return -1;
+}
+
+// submit the queued requests and wait for the completions, the completions of poll are translated into ss->ev
+static int
+uring_wait_event(struct socket_server *ss) {
+	int n;
+	do {
+		uring_arm(ss);
+		n = uring_wait(ss->uring, ss->cqe, MAX_EVENT, true);
+	} while (n == 0);
+	int i;
+	for (i=0;i<n;i++) {
+		struct io_uring_cqe *cqe = &ss->cqe[i];
+		struct event *e = &ss->ev[i];
+		e->s = NULL;
+		if ((cqe->user_data & URING_OP_MASK) != URING_OP_POLL)
+			continue;
+		int id = URING_ID(cqe->user_data);
+		struct socket *s = &ss->slot[HASH_ID(ss, id)];
+		if (s->id != id || s->type == SOCKET_TYPE_INVALID)
+			continue;
+		// the poll is one shot, rearm it after the event is dispatched
+		s->uring_armed &= ~URING_ARMED(URING_OP_POLL);
+		uring_mark(ss, s);
+		int res = cqe->res;
+		e->s = s;
+		e->read = res > 0 && (res & (POLLIN | POLLHUP)) != 0;
+		e->write = res > 0 && (res & POLLOUT) != 0;
+		e->error = res < 0 || (res & POLLERR) != 0;
+	}
+	return n;
+}
+
+#endif
+
+static inline int
+socket_poll_wait(struct socket_server *ss) {
+#ifdef USE_IO_URING
+	if (ss->uring)
+		return uring_wait_event(ss);
+#endif
+	return sp_wait(ss->event_fd, ss->ev, MAX_EVENT);
+}
+
 // return type
 int 
 socket_server_poll(struct socket_server *ss, struct socket_message * result, int * more) {
@@ -1325,7 +2040,7 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 			}
 		}
 		if (ss->event_index == ss->event_n) {
-			ss->event_n = sp_wait(ss->event_fd, ss->ev, MAX_EVENT);
+			ss->event_n = socket_poll_wait(ss);
 			ss->checkctrl = 1;
 			if (more) {
 				*more = 0;
@@ -1341,8 +2056,23 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		}
 		struct event *e = &ss->ev[ss->event_index++];
 		struct socket *s = e->s;
+#ifdef USE_IO_URING
+		if (ss->uring) {
+			struct io_uring_cqe *cqe = &ss->cqe[ss->event_index-1];
+			if ((cqe->user_data & URING_OP_MASK) != URING_OP_POLL) {
+				int type = uring_dispatch(ss, cqe, result);
+				if (type == -1)
+					continue;
+				return type;
+			}
+			if (s == NULL)
+				continue;	// the socket is closed
+		}
+#endif
 		if (s == NULL) {
-			// dispatch pipe message at beginning
+			// doorbell, dispatch ctrl requests at beginning
+			read_doorbell(ss);
+			ss->checkctrl = 1;
 			continue;
 		}
 		struct socket_lock l;
@@ -1414,22 +2144,43 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 }
 
 static void
-send_request(struct socket_server *ss, struct request_package *request, char type, int len) {
-	request->header[6] = (uint8_t)type;
-	request->header[7] = (uint8_t)len;
+ring_doorbell(struct socket_server *ss) {
+#ifdef __linux__
+	uint64_t v = 1;
+#else
+	uint8_t v = 0;
+#endif
 	for (;;) {
-		ssize_t n = write(ss->sendctrl_fd, &request->header[6], len+2);
+		ssize_t n = write(ss->sendctrl_fd, &v, sizeof(v));
 		if (n<0) {
-			if (errno != EINTR) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
 				fprintf(stderr, "socket-server : send ctrl command error %s.\n", strerror(errno));
 			}
-			continue;
 		}
-		assert(n == len+2);
 		return;
 	}
 }
 
+static void
+send_request(struct socket_server *ss, struct request_package *request, char type, int len) {
+	assert(len < 256);
+	struct request_node *req = MALLOC(offsetof(struct request_node, u) + (len > 0 ? len : 1));
+	req->type = (uint8_t)type;
+	req->len = (uint8_t)len;
+	memcpy(req->u.buffer, request->u.buffer, len);
+	struct request_node *head;
+	do {
+		head = ss->ctrl_head;
+		req->next = head;
+	} while (!ATOM_CAS_POINTER(&ss->ctrl_head, head, req));
+	// only the first request after the poll thread takes the queue need to wake it up
+	if (ss->doorbell == 0 && ATOM_CAS(&ss->doorbell, 0, 1)) {
+		ring_doorbell(ss);
+	}
+}
+
 static int
 open_request(struct socket_server *ss, struct request_package *req, uintptr_t opaque, const char *addr, int port) {
 	int len = strlen(addr);
@@ -1467,7 +2218,7 @@ can_direct_write(struct socket *s, int id) {
 // return -1 when error, 0 when success
 int 
 socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		free_buffer(ss, buffer, sz);
 		return -1;
@@ -1505,6 +2256,16 @@ socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz
 			s->dw_size = sz;
 			s->dw_offset = n;
 
+#ifdef USE_IO_URING
+			if (ss->uring) {
+				// only the poll thread can touch the ring
+				socket_unlock(&l);
+				struct request_package request;
+				request.u.send.id = id;
+				send_request(ss, &request, 'W', sizeof(request.u.send));
+				return 0;
+			}
+#endif
 			sp_write(ss->event_fd, s->fd, s, true);
 
 			socket_unlock(&l);
@@ -1525,7 +2286,7 @@ socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz
 // return -1 when error, 0 when success
 int 
 socket_server_send_lowpriority(struct socket_server *ss, int id, const void * buffer, int sz) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		free_buffer(ss, buffer, sz);
 		return -1;
@@ -1682,6 +2443,20 @@ socket_server_userobject(struct socket_server *ss, struct socket_object_interfac
 	ss->soi = *soi;
 }
 
+uint64_t
+socket_server_pollsyscall(void) {
+	return SP_SYSCALL;
+}
+
+void
+socket_server_shard(struct socket_server *ss, struct socket_server **group, int index, int n) {
+	assert(index >= 0 && index < n);
+	ss->group = group;
+	ss->shard_index = index;
+	ss->shard_n = n;
+	ss->accept_shard = index;
+}
+
 // UDP
 
 int 
@@ -1720,7 +2495,7 @@ socket_server_udp(struct socket_server *ss, uintptr_t opaque, const char * addr,
 
 int 
 socket_server_udp_send(struct socket_server *ss, int id, const struct socket_udp_address *addr, const void *buffer, int sz) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		free_buffer(ss, buffer, sz);
 		return -1;
@@ -1776,7 +2551,7 @@ socket_server_udp_send(struct socket_server *ss, int id, const struct socket_udp
 
 int
 socket_server_udp_connect(struct socket_server *ss, int id, const char * addr, int port) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		return -1;
 	}
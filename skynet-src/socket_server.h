@@ -64,4 +64,15 @@ struct socket_object_interface {
 // if you send package sz == -1, use soi.
 void socket_server_userobject(struct socket_server *, struct socket_object_interface *soi);
 
+// shard sockets across n socket servers (n poll threads), call it before any socket is created.
+// socket id % n is the index of the server owns the socket, accepted connections are spread round robin.
+void socket_server_shard(struct socket_server *, struct socket_server **group, int index, int n);
+
+// the number of syscalls of poll backend (epoll_wait/epoll_ctl, kevent or io_uring_enter), only counted with SOCKET_POLL_STAT
+uint64_t socket_server_pollsyscall(void);
+
+// use io_uring (build with USE_IO_URING, linux 6.0+) for the socket servers created after it, call it before socket_server_create.
+// return 0 if io_uring is not supported (epoll is used).
+int socket_server_iouring(int enable);
+
 #endif
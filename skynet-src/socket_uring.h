@@ -0,0 +1,261 @@
+#ifndef socket_uring_h
+#define socket_uring_h
+
+// io_uring primitives for socket_server (build with -DUSE_IO_URING, linux only).
+// Only the poll thread of the socket server touches the ring, so there is no lock here.
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define URING_ENTRIES 1024
+#define URING_CQ_ENTRIES 8192
+// provided buffers for multishot recv
+#define URING_BUFFER_GROUP 0
+#define URING_BUFFER_N 512
+#define URING_BUFFER_SIZE 8192
+
+struct uring {
+	int fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned sq_entries;
+	unsigned sq_local;	// sqes queued but not published to the kernel yet
+	void * sq_ptr;
+	void * cq_ptr;
+	size_t sq_sz;
+	size_t cq_sz;
+	size_t sqe_sz;
+	struct io_uring_buf_ring *br;
+	char * buffer;
+	uint16_t br_tail;
+};
+
+static inline int
+uring_enter(struct uring *u, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	SP_SYSCALL_COUNT;
+	return (int)syscall(__NR_io_uring_enter, u->fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void
+uring_free(struct uring *u) {
+	if (u->br)
+		munmap(u->br, URING_BUFFER_N * sizeof(struct io_uring_buf));
+	if (u->buffer)
+		munmap(u->buffer, URING_BUFFER_N * URING_BUFFER_SIZE);
+	if (u->sqes)
+		munmap(u->sqes, u->sqe_sz);
+	if (u->cq_ptr && u->cq_ptr != u->sq_ptr)
+		munmap(u->cq_ptr, u->cq_sz);
+	if (u->sq_ptr)
+		munmap(u->sq_ptr, u->sq_sz);
+	close(u->fd);
+	skynet_free(u);
+}
+
+static inline void
+uring_buffer_push(struct uring *u, int bid) {
+	struct io_uring_buf *buf = &u->br->bufs[u->br_tail & (URING_BUFFER_N - 1)];
+	buf->addr = (uint64_t)(uintptr_t)(u->buffer + bid * URING_BUFFER_SIZE);
+	buf->len = URING_BUFFER_SIZE;
+	buf->bid = (uint16_t)bid;
+	++u->br_tail;
+}
+
+// give the buffers back to the kernel
+static inline void
+uring_buffer_commit(struct uring *u) {
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+static inline char *
+uring_buffer(struct uring *u, int bid) {
+	return u->buffer + bid * URING_BUFFER_SIZE;
+}
+
+static bool
+uring_init_buffer(struct uring *u) {
+	void * br = mmap(NULL, URING_BUFFER_N * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (br == MAP_FAILED)
+		return false;
+	u->br = br;
+	void * buffer = mmap(NULL, URING_BUFFER_N * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffer == MAP_FAILED)
+		return false;
+	u->buffer = buffer;
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)br;
+	reg.ring_entries = URING_BUFFER_N;
+	reg.bgid = URING_BUFFER_GROUP;
+	if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+		return false;
+	int i;
+	for (i=0;i<URING_BUFFER_N;i++) {
+		uring_buffer_push(u, i);
+	}
+	uring_buffer_commit(u);
+	return true;
+}
+
+// multishot accept/recv are in linux 6.0, the same version as IORING_OP_SEND_ZC
+static bool
+uring_probe(struct uring *u) {
+	size_t sz = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = skynet_malloc(sz);
+	memset(probe, 0, sz);
+	bool ok = false;
+	if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PROBE, probe, 256) == 0 && probe->last_op >= IORING_OP_SEND_ZC) {
+		static const int ops[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_READ,
+			IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE, IORING_OP_ASYNC_CANCEL };
+		int i;
+		ok = true;
+		for (i=0;i<sizeof(ops)/sizeof(ops[0]);i++) {
+			if (!(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+				ok = false;
+		}
+	}
+	skynet_free(probe);
+	return ok;
+}
+
+// return NULL if the kernel doesn't support it (or io_uring is disabled)
+static struct uring *
+uring_new() {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = URING_CQ_ENTRIES;
+	int fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (fd < 0)
+		return NULL;
+	struct uring *u = skynet_malloc(sizeof(*u));
+	memset(u, 0, sizeof(*u));
+	u->fd = fd;
+	// the completions of multishot requests can't be dropped
+	if (!(p.features & IORING_FEAT_NODROP) || !uring_probe(u)) {
+		uring_free(u);
+		return NULL;
+	}
+	u->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_sz > u->sq_sz)
+			u->sq_sz = u->cq_sz;
+		u->cq_sz = u->sq_sz;
+	}
+	u->sq_ptr = mmap(NULL, u->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (u->sq_ptr == MAP_FAILED) {
+		u->sq_ptr = NULL;
+		uring_free(u);
+		return NULL;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_ptr = u->sq_ptr;
+	} else {
+		u->cq_ptr = mmap(NULL, u->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (u->cq_ptr == MAP_FAILED) {
+			u->cq_ptr = NULL;
+			uring_free(u);
+			return NULL;
+		}
+	}
+	u->sqe_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqe_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		uring_free(u);
+		return NULL;
+	}
+	char * sq = u->sq_ptr;
+	char * cq = u->cq_ptr;
+	u->sq_head = (unsigned *)(sq + p.sq_off.head);
+	u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *)(sq + p.sq_off.array);
+	u->cq_head = (unsigned *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	u->sq_entries = p.sq_entries;
+	u->sq_local = *u->sq_tail;
+	if (!uring_init_buffer(u)) {
+		uring_free(u);
+		return NULL;
+	}
+	return u;
+}
+
+// publish the queued sqes, return the number of sqes to submit
+static inline unsigned
+uring_flush(struct uring *u) {
+	__atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+	return u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+}
+
+// submit all the queued sqes without waiting
+static void
+uring_submit(struct uring *u) {
+	unsigned n;
+	while ((n = uring_flush(u)) > 0) {
+		if (uring_enter(u, n, 0, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			return;
+	}
+}
+
+static inline bool
+uring_pending(struct uring *u) {
+	return u->sq_local != *u->sq_tail;
+}
+
+static struct io_uring_sqe *
+uring_sqe(struct uring *u) {
+	if (u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+		// sq is full
+		uring_submit(u);
+	}
+	unsigned index = u->sq_local & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[index] = index;
+	++u->sq_local;
+	return sqe;
+}
+
+// take the completions, at most max. It waits for one at least if wait is true.
+static int
+uring_wait(struct uring *u, struct io_uring_cqe *cqe, int max, bool wait) {
+	unsigned head = *u->cq_head;
+	unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	unsigned submit = uring_flush(u);
+	if (head == tail && wait) {
+		if (uring_enter(u, submit, 1, IORING_ENTER_GETEVENTS) < 0) {
+			if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+				return -1;
+		}
+		tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	} else if (submit > 0) {
+		uring_enter(u, submit, 0, 0);
+	}
+	int n = 0;
+	while (head != tail && n < max) {
+		cqe[n++] = u->cqes[head & *u->cq_mask];
+		++head;
+	}
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+#endif
@@ -0,0 +1,147 @@
+-- Cluster test : the node calls itself through cluster (loopback), set cluster_channel in config to use more channels,
+-- cluster_large_limit to limit the size of large messages in reassembly, and cluster_compress to compress the messages.
+-- It checks the order of pushes, large requests, and a slow target doesn't stall the others,
+-- then prints the throughput of pipelined calls to TARGET services (spread over the channels by address).
+
+local skynet = require "skynet"
+local cluster = require "skynet.cluster"
+local socket = require "skynet.socket"
+require "skynet.manager"	-- import skynet.abort
+
+local mode = ...
+
+if mode == "slave" then
+
+local count = 0
+local last = 0
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, cmd, ...)
+		if cmd == "push" then
+			local seq = ...
+			assert(seq == last + 1, "push out of order")
+			last = seq
+			count = count + 1
+		elseif cmd == "count" then
+			skynet.ret(skynet.pack(count))
+		elseif cmd == "echo" then
+			skynet.ret(skynet.pack(...))
+		elseif cmd == "sleep" then
+			skynet.sleep(...)
+			skynet.ret(skynet.pack(true))
+		end
+	end)
+end)
+
+else
+
+local N = 100000
+local WINDOW = 100	-- pipelined calls
+local PAYLOAD = string.rep("x", 32)
+local TARGET = 8
+
+local function peak_rss()
+	local f = io.open "/proc/self/status"
+	if f == nil then
+		return 0
+	end
+	local s = f:read "a"
+	f:close()
+	return tonumber(s:match "VmHWM:%s*(%d+)") or 0
+end
+
+local function pipeline(n, f)
+	local done = 0
+	local co = coroutine.running()
+	for i = 1, WINDOW do
+		skynet.fork(function()
+			for j = 1, n // WINDOW do
+				f(j)
+			end
+			done = done + 1
+			if done == WINDOW then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+end
+
+skynet.start(function()
+	cluster.reload { self = "127.0.0.1:2528" }
+	cluster.open "self"
+	local slave = skynet.newservice(SERVICE_NAME, "slave")
+	cluster.register("slave", slave)
+	assert(cluster.query("self", "slave") == slave)
+
+	-- the connections closed at once, the agents exit (they may fail to forward)
+	for i = 1, 100 do
+		socket.close(socket.open("127.0.0.1", 2528))
+	end
+	assert(cluster.query("self", "slave") == slave)
+	local channel = tonumber(skynet.getenv "cluster_channel") or 1
+
+	-- pushes to the same address keep the order
+	for i = 1, N do
+		cluster.send("self", slave, "push", i)
+	end
+	assert(cluster.call("self", slave, "count") == N)
+
+	-- large request and response
+	local large = string.rep("L", 1024 * 1024)
+	assert(cluster.call("self", slave, "echo", large) == large)
+	local limit = tonumber(skynet.getenv "cluster_large_limit")
+	if limit then
+		local ok, err = pcall(cluster.call, "self", slave, "echo", string.rep("X", limit + 1))
+		print("request larger than cluster_large_limit :", ok, err)
+		assert(not ok)
+		assert(cluster.call("self", slave, "echo", large) == large)
+	else
+		large = string.rep("L", 32 * 1024 * 1024)
+		local rss = peak_rss()
+		local t = skynet.hpc()
+		assert(cluster.call("self", slave, "echo", large) == large)
+		print(string.format("echo %d bytes : %.1f ms, peak rss +%d K", #large, (skynet.hpc() - t) / 1000000, peak_rss() - rss))
+	end
+
+	-- repetitive records, compressed if cluster_compress is set
+	local record = {}
+	for i = 1, 1000 do
+		record[i] = { id = i, name = "player" .. i, hp = 100, pos = { x = i, y = i } }
+	end
+	local r = cluster.call("self", slave, "echo", record)
+	assert(#r == #record and r[1000].name == "player1000")
+	r = cluster.call("self", slave, "echo", string.rep("compress", 100))
+	assert(r == string.rep("compress", 100))
+	local stat = skynet.call(cluster.sender("self", slave), "debug", "INFO")
+	print(string.format("cluster_compress = %s : send %d/%d bytes %d us, recv %d/%d bytes %d us",
+		skynet.getenv "cluster_compress", stat.send_wire, stat.send_raw, stat.send_time, stat.recv_wire, stat.recv_raw, stat.recv_time))
+	if skynet.getenv "cluster_compress" then
+		assert(stat.compress > 0 and stat.send_wire < stat.send_raw and stat.recv_wire < stat.recv_raw)
+	end
+
+	-- slow target
+	local slow = skynet.newservice(SERVICE_NAME, "slave")
+	skynet.fork(cluster.call, "self", slow, "sleep", 200)
+	local t = skynet.now()
+	pipeline(WINDOW * 10, function(i)
+		assert(cluster.call("self", slave, "echo", i) == i)
+	end)
+	t = skynet.now() - t
+	print(string.format("calls during a slow call : %d ms", t * 10))
+	assert(t < 200)
+
+	local target = {}
+	for i = 1, TARGET do
+		target[i] = skynet.newservice(SERVICE_NAME, "slave")
+	end
+	t = skynet.hpc()
+	pipeline(N, function(i)
+		assert(cluster.call("self", target[i % TARGET + 1], "echo", i, PAYLOAD) == i)
+	end)
+	t = (skynet.hpc() - t) / 1000000000
+	print(string.format("cluster_channel = %d : %d calls, %.3f s, %.0f calls/s", channel, N, t, N / t))
+	skynet.abort()
+end)
+
+end
@@ -0,0 +1,199 @@
+-- Gate test : clients send small frames (and a large one) through the gate service (service-src/service_gate.c),
+-- this service is the watchdog and the broker of the gate, it checks all the frames are received,
+-- and counts the messages in per frame mode and batch mode (see netpack.frames).
+-- Then the same stream is sent through the lua gate (service/gate.lua) to check netpack.filter.
+
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local netpack = require "skynet.netpack"
+require "skynet.manager"	-- import skynet.launch, skynet.abort
+
+local PORT = 8004	-- the port of each test is different, because the listen socket of last test is closed asynchronously
+local CONNECTION = 16
+local FRAMES = 20000	-- per connection
+local PAYLOAD = 30
+local LARGE = 1024 * 1024	-- a large frame at the end of stream, if the header supports it
+local CHUNK = 1000	-- write size, not aligned with frames
+
+local batch
+local result
+
+local function varint(s)
+	local n = #s
+	local tmp = {}
+	while n >= 0x80 do
+		tmp[#tmp+1] = string.char(n & 0x7f | 0x80)
+		n = n >> 7
+	end
+	tmp[#tmp+1] = string.char(n)
+	return table.concat(tmp) .. s
+end
+
+local ENCODE = {
+	S = function(s) return string.pack(">s2", s) end,
+	L = function(s) return string.pack(">s4", s) end,
+	le16 = function(s) return string.pack("<s2", s) end,
+	le32 = function(s) return string.pack("<s4", s) end,
+	varint = varint,
+}
+
+local function large_frame(header)
+	return header ~= "S" and header ~= "le16"
+end
+
+local function stream(header, frames)
+	local encode = ENCODE[header]
+	local tmp = {}
+	for i = 1, frames do
+		local payload = string.pack(">I4", i) .. string.rep("x", PAYLOAD - 4)
+		tmp[i] = encode(payload)
+	end
+	if large_frame(header) then
+		tmp[#tmp+1] = encode(string.rep("L", LARGE))
+	end
+	return table.concat(tmp)
+end
+
+local function frame(s)
+	if #s == LARGE then
+		assert(s == string.rep("L", LARGE))
+		result.large = result.large + 1
+		return
+	end
+	local seq = string.unpack(">I4", s)
+	result.frames = result.frames + 1
+	result.sum = result.sum + seq
+	assert(#s == PAYLOAD)
+end
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(...) return table.concat({...}, " ") end,
+	unpack = skynet.tostring,
+	dispatch = function(_, gate, msg)
+		local id, cmd = msg:match "^(%d+) (%a+)"
+		if cmd == "open" then
+			skynet.send(gate, "text", "start", id)
+		elseif cmd == "data" then
+			error("Unexpected data to watchdog : " .. msg)
+		end
+	end,
+}
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = function(msg, sz)
+		if batch then
+			return netpack.frames(msg, sz)
+		else
+			return skynet.tostring(msg, sz)
+		end
+	end,
+	dispatch = function(_, _, ...)
+		result.messages = result.messages + 1
+		for i = 1, select("#", ...) do
+			frame((select(i, ...)))
+		end
+	end,
+}
+
+local function send_stream(data)
+	PORT = PORT + 1
+	local ids = {}
+	for i = 1, CONNECTION do
+		ids[i] = assert(socket.open("127.0.0.1", PORT))
+	end
+	for i = 1, CONNECTION do
+		local id = ids[i]
+		for offset = 1, #data, CHUNK do
+			socket.write(id, data:sub(offset, offset + CHUNK - 1))
+		end
+	end
+	return ids
+end
+
+local function wait_result(header, frames)
+	local expect = CONNECTION * frames
+	local large = large_frame(header) and CONNECTION or 0
+	while result.frames < expect or result.large < large do
+		skynet.sleep(1)
+	end
+	assert(result.frames == expect)
+	assert(result.large == large)
+	assert(result.sum == CONNECTION * frames * (frames + 1) // 2)
+end
+
+local function test(header, mode)
+	batch = mode == "batch"
+	result = { frames = 0, large = 0, messages = 0, sum = 0 }
+	netpack.header(header)
+	local self = skynet.address(skynet.self())
+	local gate = skynet.launch("gate", string.format("%s %s 127.0.0.1:%d 0 %d %s", header, self, PORT + 1, CONNECTION, mode))
+	skynet.send(gate, "text", "broker", self)
+	local data = stream(header, FRAMES)
+	local t = skynet.hpc()
+	local ids = send_stream(data)
+	wait_result(header, FRAMES)
+	t = (skynet.hpc() - t) / 1000000
+	print(string.format("%-6s %-5s : %d frames, %d large, %d messages, %.3f messages per frame, %.1f ms",
+		header, mode, result.frames, result.large, result.messages, result.messages / result.frames, t))
+	for i = 1, CONNECTION do
+		socket.close(ids[i])
+	end
+	skynet.kill(gate)
+end
+
+local function test_netpack(header)
+	local frames = FRAMES // 10
+	result = { frames = 0, large = 0, messages = 0, sum = 0 }
+	local gate = skynet.newservice "gate"
+	skynet.call(gate, "lua", "open", { address = "127.0.0.1", port = PORT + 1, maxclient = CONNECTION, header = header })
+	local data = stream(header, frames)
+	local ids = send_stream(data)
+	wait_result(header, frames)
+	print(string.format("netpack %-6s : %d frames, %d large", header, result.frames, result.large))
+	for i = 1, CONNECTION do
+		socket.close(ids[i])
+	end
+	skynet.kill(gate)
+end
+
+-- the frame larger than the max size of header should close the connection
+local function test_invalid(header, launch)
+	local gate = launch(header .. ":1000")
+	PORT = PORT + 1
+	local id = assert(socket.open("127.0.0.1", PORT))
+	socket.write(id, ENCODE[header](string.rep("x", 1001)))
+	assert(socket.read(id) == false)
+	socket.close(id)
+	skynet.kill(gate)
+	print(string.format("invalid frame %s : closed", header))
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, gate, cmd, subcmd, fd, msg)
+		assert(cmd == "socket")
+		if subcmd == "open" then
+			skynet.call(gate, "lua", "accept", fd)
+		elseif subcmd == "data" then
+			frame(msg)
+		end
+	end)
+	test("S", "frame")
+	test("S", "batch")
+	test("le32", "frame")
+	test("varint", "batch")
+	test_netpack "varint"
+	test_netpack "le16"
+	test_invalid("L", function(header)
+		return skynet.launch("gate", string.format("%s %s 127.0.0.1:%d 0 %d", header, skynet.address(skynet.self()), PORT + 1, CONNECTION))
+	end)
+	test_invalid("varint", function(header)
+		local gate = skynet.newservice "gate"
+		skynet.call(gate, "lua", "open", { address = "127.0.0.1", port = PORT + 1, maxclient = CONNECTION, header = header })
+		return gate
+	end)
+	skynet.abort()
+end)
@@ -0,0 +1,65 @@
+-- Handle lookup benchmark : every worker thread runs a service that sends messages in a tight loop,
+-- each send calls skynet_handle_grab once.
+-- Build with CFLAGS += -DUSE_RWLOCK_HANDLE to compare with the rwlock version.
+
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.abort, skynet.kill
+
+local mode = ...
+
+if mode == "sink" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function() end)
+end)
+
+elseif mode == "client" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, target, n)
+		local send = skynet.send
+		local start = skynet.now()
+		for i = 1, n do
+			send(target, "lua")
+		end
+		skynet.ret(skynet.pack(skynet.now() - start))
+	end)
+end)
+
+else
+
+local thread = tonumber(skynet.getenv "thread")
+local n = 1000000
+
+local function bench(name, target, clients)
+	local start = skynet.now()
+	local co = {}
+	for _, c in ipairs(clients) do
+		skynet.fork(function()
+			skynet.call(c, "lua", target, n)
+			co[#co+1] = true
+		end)
+	end
+	while #co < #clients do
+		skynet.sleep(1)
+	end
+	local ti = skynet.now() - start
+	print(string.format("%s : clients = %d lookups = %d time = %.2fs : %.0f lookup/s",
+		name, #clients, n * #clients, ti / 100, n * #clients * 100 / math.max(ti,1)))
+end
+
+skynet.start(function()
+	local clients = {}
+	for i = 1, thread do
+		clients[i] = skynet.newservice(SERVICE_NAME, "client")
+	end
+	-- handle miss, skynet_send fails after the lookup
+	local dead = skynet.newservice(SERVICE_NAME, "sink")
+	skynet.kill(dead)
+	bench("miss", dead, clients)
+	-- handle hit, the message is pushed into sink
+	bench("hit", skynet.newservice(SERVICE_NAME, "sink"), clients)
+	skynet.abort()
+end)
+
+end
@@ -0,0 +1,135 @@
+-- Harbor link throughput : run two nodes, node 1 is the master (standalone) and node 2 registers a global service.
+-- Node 1 sends small messages to it (one way), and calls it with a window of pipelined requests,
+-- then prints messages per second and socket writes per message (from /proc/self/io).
+-- Set harbor_compress (in both configs) to compress the repetitive records, the link stats are printed after them.
+-- At last, it sends to unknown names : the messages to a name are queued (NAME_QUEUE_MAX) until it's registered,
+-- and the pending messages of all the unknown names are bounded (NAME_PENDING_MAX).
+--	node 1 config : harbor = 1, address = "127.0.0.1:2526", master = "127.0.0.1:2013", standalone = "0.0.0.0:2013"
+--	node 2 config : harbor = 2, address = "127.0.0.1:2527", master = "127.0.0.1:2013"
+
+local skynet = require "skynet"
+local harbor = require "skynet.harbor"
+require "skynet.manager"	-- import skynet.register, skynet.abort
+
+local N = 200000
+local WINDOW = 100	-- pipelined calls
+local PAYLOAD = string.rep("x", 32)
+local NAME_QUEUE_MAX = 1024	-- see service_harbor.c
+local NAME_PENDING_MAX = 64 * 1024
+
+local function syscw()
+	local f = io.open "/proc/self/io"
+	if f == nil then
+		return 0
+	end
+	local s = f:read "a"
+	f:close()
+	return tonumber(s:match "syscw: (%d+)")
+end
+
+local function bench(name, n, f)
+	local w = syscw()
+	local t = skynet.hpc()
+	f()
+	t = (skynet.hpc() - t) / 1000000000
+	w = syscw() - w
+	print(string.format("%-8s : %d messages, %.3f s, %.0f messages/s, %.3f writes per message", name, n, t, n / t, w / n))
+end
+
+local function node2()
+	local count = 0
+	skynet.dispatch("lua", function(_, _, cmd, ...)
+		if cmd == "send" then
+			count = count + 1
+		elseif cmd == "ping" then
+			skynet.ret(skynet.pack(...))
+		elseif cmd == "count" then
+			skynet.ret(skynet.pack(count))
+			count = 0
+		elseif cmd == "register" then
+			skynet.register(...)
+			skynet.ret()
+		elseif cmd == "exit" then
+			skynet.abort()
+		end
+	end)
+	skynet.register "HARBORLOAD"
+	print("HARBORLOAD registered, start node 1")
+end
+
+local function node1()
+	print("wait for harbor 2")
+	harbor.connect(2)
+	local addr = harbor.queryname "HARBORLOAD"
+	print("HARBORLOAD =", skynet.address(addr))
+	bench("send", N, function()
+		for i = 1, N do
+			skynet.send(addr, "lua", "send", i, PAYLOAD)
+		end
+		assert(skynet.call(addr, "lua", "count") == N)
+	end)
+	bench("call", N, function()
+		local n = N // WINDOW
+		local done = 0
+		local co = coroutine.running()
+		for i = 1, WINDOW do
+			skynet.fork(function()
+				for j = 1, n do
+					local r = skynet.call(addr, "lua", "ping", j, PAYLOAD)
+					assert(r == j)
+				end
+				done = done + 1
+				if done == WINDOW then
+					skynet.wakeup(co)
+				end
+			end)
+		end
+		skynet.wait(co)
+	end)
+	-- repetitive records, and a large one sent alone
+	local record = {}
+	for i = 1, 16 do
+		record[i] = { id = i, name = "player" .. i, hp = 100, pos = { x = i, y = i } }
+	end
+	bench("record", N // 10, function()
+		for i = 1, N // 10 do
+			skynet.send(addr, "lua", "send", i, record)
+		end
+		assert(skynet.call(addr, "lua", "count") == N // 10)
+	end)
+	local large = string.rep("skynet harbor ", 100000)
+	assert(skynet.call(addr, "lua", "ping", large) == large)
+	print("harbor_compress =", skynet.getenv "harbor_compress")
+	print(skynet.call(".cslave", "debug", "INFO"))
+	-- messages to the name before it's registered
+	for i = 1, NAME_QUEUE_MAX * 2 do
+		skynet.send("LATENAME", "lua", "send", i)
+	end
+	skynet.call(addr, "lua", "register", "LATENAME")
+	assert(harbor.queryname "LATENAME" == addr)
+	skynet.sleep(10)
+	local n = skynet.call(addr, "lua", "count")
+	print(string.format("late name : %d messages sent, %d received", NAME_QUEUE_MAX * 2, n))
+	assert(n == NAME_QUEUE_MAX)
+	-- unique unknown names
+	n = NAME_PENDING_MAX * 2
+	bench("unknown", n, function()
+		for i = 1, n do
+			skynet.send("UNKNOWN" .. i, "lua", "send", i)
+		end
+	end)
+	local ok = pcall(skynet.call, "UNKNOWN", "lua", "ping")
+	print("call unknown name when the pending queue is full :", ok and "succ" or "fail")
+	assert(not ok)
+	skynet.send(addr, "lua", "exit")
+	skynet.sleep(10)
+	skynet.abort()
+end
+
+skynet.start(function()
+	if tonumber(skynet.getenv "harbor") == 2 then
+		node2()
+	else
+		node1()
+	end
+end)
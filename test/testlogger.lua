@@ -0,0 +1,66 @@
+-- logger : many services write log lines at the same time, compare the synchronous logger with
+-- the asynchronous one (config logbuffer = 65536). It prints the time of the services to finish the lines,
+-- and the time of the lines written to the log file (config logger).
+
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.abort
+
+local mode, n = ...
+
+local SERVICE = 8
+local LINE = 20000
+
+if mode == "writer" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		local self = skynet.self()
+		for i = 1, LINE do
+			skynet.error("log line", i, "from", self, "some payload 0123456789abcdef")
+		end
+		skynet.error(string.rep("long line ", 10000))
+		skynet.ret()
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local writers = {}
+	for i = 1, SERVICE do
+		writers[i] = skynet.newservice(SERVICE_NAME, "writer")
+	end
+	local t = skynet.hpc()
+	local n = SERVICE
+	local co = coroutine.running()
+	for i = 1, SERVICE do
+		skynet.fork(function()
+			skynet.call(writers[i], "lua")
+			n = n - 1
+			if n == 0 then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	local twrite = (skynet.hpc() - t) / 1000000
+	local tflush = 0
+	local logger = skynet.getenv "logger"
+	if logger then
+		-- wait the last line in the log file
+		local mark = "testlogger end " .. skynet.now()
+		skynet.error(mark)
+		repeat
+			skynet.sleep(1)
+			local f = io.open(logger)
+			local found = f:read "a":find(mark, 1, true)
+			f:close()
+		until found
+		tflush = (skynet.hpc() - t) / 1000000
+	end
+	print(string.format("logbuffer %s : %d services write %d lines in %.2f ms, in the log file in %.2f ms",
+		skynet.getenv "logbuffer", SERVICE, SERVICE * LINE, twrite, tflush))
+	skynet.abort()
+end)
+
+end
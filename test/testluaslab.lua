@@ -0,0 +1,69 @@
+-- lua_slab : a table churn workload in several services, run it with lua_slab = true and without it.
+-- It prints the time of the workload, and the memory of lua vm.
+
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.abort
+local memory = require "skynet.memory"
+
+local mode = ...
+
+local SERVICE = 4
+local N = 200000
+local LIVE = 10000
+
+if mode == "churn" then
+
+local function churn()
+	local live = {}
+	for i = 1, N do
+		local obj = { id = i, pos = { x = i, y = -i }, name = "obj" .. (i % 1000) }
+		if i % 4 == 0 then
+			obj.tags = { "a", "b", i }
+		end
+		obj.f = function() return obj.id end
+		live[i % LIVE + 1] = obj
+	end
+	return #live
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		local t = skynet.hpc()
+		churn()
+		t = (skynet.hpc() - t) / 1000000
+		local lua = collectgarbage "count"
+		skynet.ret(skynet.pack(t, lua, memory.current()))
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local services = {}
+	for i = 1, SERVICE do
+		services[i] = skynet.newservice(SERVICE_NAME, "churn")
+	end
+	local t = skynet.hpc()
+	local n = SERVICE
+	local co = coroutine.running()
+	local cost, lua, cmem = 0, 0, 0
+	for i = 1, SERVICE do
+		skynet.fork(function()
+			local c, l, m = skynet.call(services[i], "lua")
+			cost = cost + c
+			lua = lua + l
+			cmem = cmem + m
+			n = n - 1
+			if n == 0 then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	t = (skynet.hpc() - t) / 1000000
+	print(string.format("lua_slab %s : %d services %.2f ms (%.2f ms each), lua %.0f KB, skynet_malloc %.0f KB (average)",
+		skynet.getenv "lua_slab" or "false", SERVICE, t, cost / SERVICE, lua / SERVICE, cmem / SERVICE / 1024))
+	skynet.abort()
+end)
+
+end
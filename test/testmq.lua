@@ -0,0 +1,89 @@
+-- Message queue benchmark : 1, 4 and 16 producers push messages into one service.
+-- Build with CFLAGS += -DUSE_SPINLOCK_MQ (see Makefile) to compare with the spinlock queue.
+-- At last, the producers push one message and yield, so the queue of consumer is drained and refilled by
+-- different threads all the time (a worker may take the queue back after another worker drained it).
+
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.abort
+
+local mode = ...
+
+if mode == "consumer" then
+
+local count = 0
+local expect
+local waiting
+
+local CMD = {}
+
+function CMD.push()
+	count = count + 1
+	if count == expect and waiting then
+		skynet.wakeup(waiting)
+	end
+end
+
+function CMD.wait(n)
+	expect = n
+	if count < n then
+		waiting = coroutine.running()
+		skynet.wait()
+	end
+	skynet.ret()
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd, ...)
+		local f = CMD[cmd]
+		f(...)
+	end)
+end)
+
+elseif mode == "producer" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, consumer, n, flap)
+		for i = 1, n do
+			skynet.send(consumer, "lua", "push")
+			if flap then
+				skynet.yield()
+			end
+		end
+	end)
+end)
+
+else
+
+local total = 1600000
+
+local function bench(consumer, producers, flap)
+	local n = (flap and total // 8 or total) // #producers
+	local start = skynet.now()
+	for _, p in ipairs(producers) do
+		skynet.send(p, "lua", consumer, n, flap)
+	end
+	skynet.call(consumer, "lua", "wait", n * #producers)
+	local ti = skynet.now() - start
+	print(string.format("%sproducer = %d messages = %d time = %.2fs : %.0f msg/s", flap and "(yield) " or "",
+		#producers, n * #producers, ti / 100, n * #producers * 100 / math.max(ti, 1)))
+end
+
+skynet.start(function()
+	for _, np in ipairs { 1, 4, 16 } do
+		local consumer = skynet.newservice(SERVICE_NAME, "consumer")
+		local producers = {}
+		for i = 1, np do
+			producers[i] = skynet.newservice(SERVICE_NAME, "producer")
+		end
+		bench(consumer, producers)
+	end
+	local consumer = skynet.newservice(SERVICE_NAME, "consumer")
+	local producers = {}
+	for i = 1, 16 do
+		producers[i] = skynet.newservice(SERVICE_NAME, "producer")
+	end
+	bench(consumer, producers, true)
+	skynet.abort()
+end)
+
+end
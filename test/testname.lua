@@ -0,0 +1,47 @@
+-- Name registry stress test : create and retire 100k named services,
+-- while 100k other names stay registered.
+
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.launch, skynet.name, skynet.kill, skynet.abort
+
+local N = 100000
+local BATCH = 10000	-- each service holds a file descriptor, don't keep too many at once
+
+skynet.start(function()
+	local self = skynet.self()
+	for i = 1, N do
+		skynet.name(".test_keep" .. i, self)
+	end
+	local t_register, t_find, t_retire = 0, 0, 0
+	for b = 0, N - 1, BATCH do
+		local handles = {}
+		local t = skynet.now()
+		for i = b + 1, b + BATCH do
+			-- logger is the lightest service, write to /dev/null
+			local h = assert(skynet.launch("logger", "/dev/null"))
+			skynet.name(".test_a" .. i, h)
+			skynet.name(".test_b" .. i, h)
+			handles[i] = h
+		end
+		local t1 = skynet.now()
+		for i = b + 1, b + BATCH do
+			assert(skynet.localname(".test_a" .. i) == handles[i])
+			assert(skynet.localname(".test_b" .. i) == handles[i])
+		end
+		local t2 = skynet.now()
+		for i = b + 1, b + BATCH do
+			skynet.kill(skynet.address(handles[i]))
+		end
+		local t3 = skynet.now()
+		for i = b + 1, b + BATCH do
+			assert(skynet.localname(".test_a" .. i) == nil)
+		end
+		t_register = t_register + t1 - t
+		t_find = t_find + t2 - t1
+		t_retire = t_retire + t3 - t2
+	end
+	assert(skynet.localname(".test_keep" .. N) == self)
+	print(string.format("services = %d names = %d : register %.2fs findname %.2fs retire %.2fs",
+		N, N * 3, t_register / 100, t_find / 100, t_retire / 100))
+	skynet.abort()
+end)
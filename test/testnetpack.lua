@@ -0,0 +1,85 @@
+-- netpack benchmark : simulate a gateserver with 100k connections, every frame is fragmented in 3 socket messages,
+-- so there are 100k uncomplete frames in netpack when filter is called. Then each socket message has 2.5 frames
+-- to fill the package queue.
+
+local skynet = require "skynet"
+local netpack = require "skynet.netpack"
+local socketdriver = require "skynet.socketdriver"
+require "skynet.manager"	-- import skynet.abort
+
+local CONNECTION = 100000
+local ROUND = 3
+local PAYLOAD = 30
+local SKYNET_SOCKET_TYPE_DATA = 1
+
+local function pointer(p)
+	return tonumber(tostring(p):match "0x(%x+)", 16)
+end
+
+-- fake a socket message (struct skynet_socket_message) of data
+local function socket_message(fd, data)
+	local buffer, sz = socketdriver.str2p(data)
+	return socketdriver.str2p(string.pack("!iiij", SKYNET_SOCKET_TYPE_DATA, fd, sz, pointer(buffer)))
+end
+
+local function frame(seq)
+	return string.pack(">s2", string.pack(">I4", seq) .. string.rep("x", PAYLOAD - 4))
+end
+
+-- split the stream of each connection to pieces
+local function messages(pieces)
+	local msgs = {}
+	for _, p in ipairs(pieces) do
+		for fd = 1, CONNECTION do
+			local msg, sz = socket_message(fd, p)
+			msgs[#msgs+1] = msg
+			msgs[#msgs+1] = sz
+		end
+	end
+	return msgs
+end
+
+local function run(name, pieces, frames)
+	local msgs = messages(pieces)
+	local queue
+	local n = 0
+	local function data(msg, sz)
+		n = n + 1
+		skynet.trash(msg, sz)
+	end
+	local t = skynet.hpc()
+	for i = 1, #msgs, 2 do
+		local msg, sz = msgs[i], msgs[i+1]
+		local q, type, fd, buffer, size = netpack.filter(queue, msg, sz)
+		queue = q
+		if type == "data" then
+			data(buffer, size)
+		elseif type == "more" then
+			for fd, buffer, size in netpack.pop, queue do
+				data(buffer, size)
+			end
+		end
+	end
+	t = (skynet.hpc() - t) / 1000000
+	for i = 1, #msgs, 2 do
+		skynet.trash(msgs[i], msgs[i+1])
+	end
+	assert(n == CONNECTION * frames, n)
+	print(string.format("%-10s : %d connections, %d socket messages, %d frames, %.1f ms, %.0f ns per message",
+		name, CONNECTION, #msgs // 2, n, t, t * 1000000 / (#msgs // 2)))
+	netpack.clear(queue)
+end
+
+skynet.start(function()
+	-- header, header + part of payload, the rest
+	local s = frame(1)
+	local fragment = { s:sub(1,1), s:sub(2, 16), s:sub(17) }
+	for i = 1, ROUND do
+		run("fragment", fragment, 1)
+	end
+	-- 5 frames in 2 socket messages
+	s = frame(1) .. frame(2) .. frame(3) .. frame(4) .. frame(5)
+	local half = #s // 2
+	run("more", { s:sub(1, half), s:sub(half+1) }, 5)
+	skynet.abort()
+end)
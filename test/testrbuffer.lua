@@ -0,0 +1,78 @@
+-- Socket receive benchmark : send 64M bytes in 1K packages through loopback connections,
+-- and report the allocations per packet and the socket thread cpu time per GB received.
+-- The read buffer pool is enabled only with jemalloc (the malloc hook), compare it with a NOUSE_JEMALLOC build.
+
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local driver = require "skynet.socketdriver"
+require "skynet.manager"	-- import skynet.abort
+
+local PORT = 8004
+local CONNECTION = 16
+local TOTAL = 64 * 1024 * 1024
+local CHUNK = 1024
+
+local function receive(id, expect, result, co)
+	socket.start(id)
+	local n = 0
+	while n < expect do
+		local str = socket.read(id)
+		if not str then
+			break
+		end
+		n = n + #str
+	end
+	socket.close(id)
+	result.bytes = result.bytes + n
+	result.done = result.done + 1
+	if result.done == CONNECTION then
+		skynet.wakeup(co)
+	end
+end
+
+local function send(id, n, chunk)
+	for i = 1, n do
+		socket.write(id, chunk)
+		if i % 4 == 0 then
+			-- let the receiver run
+			skynet.yield()
+		end
+	end
+end
+
+skynet.start(function()
+	local co = coroutine.running()
+	local expect = TOTAL // CONNECTION
+	local result = { bytes = 0, done = 0 }
+	local listen = socket.listen("127.0.0.1", PORT)
+	socket.start(listen, function(id)
+		skynet.fork(receive, id, expect, result, co)
+	end)
+	local ids = {}
+	for i = 1, CONNECTION do
+		ids[i] = assert(socket.open("127.0.0.1", PORT))
+	end
+	local chunk = string.rep("x", CHUNK)
+	local s0 = driver.stat()
+	local start = skynet.hpc()
+	for i = 1, CONNECTION do
+		skynet.fork(send, ids[i], expect // CHUNK, chunk)
+	end
+	skynet.wait()
+	local ti = (skynet.hpc() - start) / 1000000
+	local s1 = driver.stat()
+	local pool = s1.rbuffer_pool - s0.rbuffer_pool
+	local malloc = s1.rbuffer_malloc - s0.rbuffer_malloc
+	local wrapper = s1.rbuffer_wrapper - s0.rbuffer_wrapper
+	local packets = pool + malloc
+	local gb = result.bytes / (1024 * 1024 * 1024)
+	print(string.format("received %d bytes in %d packets, %.1f ms", result.bytes, packets, ti))
+	print(string.format("pooled %d, malloc %d, wrapper malloc %d, allocations per packet %.3f",
+		pool, malloc, wrapper, (malloc + wrapper) / packets))
+	print(string.format("socket thread cpu %.1f ms per GB", (s1.cputime - s0.cputime) / 1000 / gb))
+	for i = 1, CONNECTION do
+		socket.close(ids[i])
+	end
+	socket.close(listen)
+	skynet.abort()
+end)
@@ -0,0 +1,69 @@
+-- Dispatch throughput benchmark.
+-- Run it with thread = 4, 8, 16, 32, 64 and worksteal = true/false in config to compare the scheduler.
+
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.abort
+
+local mode = ...
+
+if mode == "slave" then
+
+local peer
+local count = 0
+
+local CMD = {}
+
+function CMD.peer(addr)
+	peer = addr
+end
+
+function CMD.ping()
+	count = count + 1
+	skynet.send(peer, "lua", "ping")
+end
+
+function CMD.count()
+	skynet.ret(skynet.pack(count))
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd, ...)
+		local f = CMD[cmd]
+		f(...)
+	end)
+end)
+
+else
+
+local thread = tonumber(skynet.getenv "thread")
+local worksteal = skynet.getenv "worksteal"
+local pair = thread * 4
+local inflight = 16
+local duration = 500	-- 1/100 sec
+
+skynet.start(function()
+	local slaves = {}
+	for i = 1, pair do
+		local a = skynet.newservice(SERVICE_NAME, "slave")
+		local b = skynet.newservice(SERVICE_NAME, "slave")
+		skynet.send(a, "lua", "peer", b)
+		skynet.send(b, "lua", "peer", a)
+		table.insert(slaves, a)
+		table.insert(slaves, b)
+	end
+	for i = 1, pair * 2, 2 do
+		for j = 1, inflight do
+			skynet.send(slaves[i], "lua", "ping")
+		end
+	end
+	skynet.sleep(duration)
+	local total = 0
+	for _, addr in ipairs(slaves) do
+		total = total + skynet.call(addr, "lua", "count")
+	end
+	print(string.format("thread = %d worksteal = %s services = %d : %.0f msg/s",
+		thread, worksteal, pair * 2, total * 100 / duration))
+	skynet.abort()
+end)
+
+end
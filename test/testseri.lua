@@ -0,0 +1,101 @@
+-- skynet.pack/unpack : check the round trip of the payloads, and compare the encoding of skynet.packfast
+-- (with table hash size hints and short string references) with skynet.pack (the old encoding) on typical RPC payloads.
+
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.abort
+
+local N = 20000
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local function record(i)
+	return {
+		id = 1000 + i,
+		name = "player" .. i,
+		level = i % 100,
+		hp = 1000,
+		mp = 500,
+		pos = { x = i * 1.5, y = i * 2.5, z = 0 },
+		tags = { "vip", "guild" },
+		online = true,
+	}
+end
+
+local payload = {}
+
+payload.call = { "login", 12345, "token-0123456789", true }
+payload.record = { "update", record(1) }
+payload.list = { "query", {} }
+for i = 1, 100 do
+	payload.list[2][i] = record(i)
+end
+payload.map = { "bag", {} }
+for i = 1, 100 do
+	payload.map[2]["item" .. i] = { count = i, bind = i % 2 == 0, expire = 86400 * i }
+end
+
+local function check(pack)
+	for name, p in pairs(payload) do
+		local r = table.pack(skynet.unpack(pack(table.unpack(p))))
+		for i = 1, #p do
+			assert(equal(p[i], r[i]), name)
+		end
+	end
+	-- more distinct strings than the references
+	local keys = {}
+	for i = 1, 1000 do
+		keys["key" .. i] = "value" .. (i % 300)
+	end
+	local r = skynet.unpack(pack(keys, keys))
+	assert(equal(r, keys))
+	-- __pairs
+	local proxy = setmetatable({}, { __pairs = function() return next, { aa = "aa", bb = { aa = "bb" } } end })
+	local a, b = skynet.unpack(pack({ aa = "bb" }, proxy, "aa", "bb"))
+	assert(equal(a, { aa = "bb" }) and equal(b, { aa = "aa", bb = { aa = "bb" } }))
+	assert(select("#", skynet.unpack(pack(nil, "x", nil))) == 3)
+end
+
+local function bench(name, pack, p)
+	local msg, sz = pack(table.unpack(p))
+	local N = N // (sz // 100 + 1)
+	local t = skynet.hpc()
+	for i = 1, N do
+		skynet.trash(pack(table.unpack(p)))
+	end
+	local tpack = (skynet.hpc() - t) / N
+	t = skynet.hpc()
+	for i = 1, N do
+		skynet.unpack(msg, sz)
+	end
+	local tunpack = (skynet.hpc() - t) / N
+	skynet.trash(msg, sz)
+	return sz, tpack, tunpack
+end
+
+skynet.start(function()
+	check(skynet.pack)
+	check(skynet.packfast)
+	for _, name in ipairs { "call", "record", "list", "map" } do
+		local p = payload[name]
+		local sz1, pack1, unpack1 = bench(name, skynet.pack, p)
+		local sz2, pack2, unpack2 = bench(name, skynet.packfast, p)
+		print(string.format("%-6s : compat %6d bytes pack %8.0f ns unpack %8.0f ns | new %6d bytes pack %8.0f ns unpack %8.0f ns",
+			name, sz1, pack1, unpack1, sz2, pack2, unpack2))
+	end
+	skynet.abort()
+end)
@@ -0,0 +1,160 @@
+-- sharedpack : check the proxy of a shared object, and compare the fan out of a large snapshot
+-- to the reader services by sharedpack with skynet.pack/unpack (each reader reads two fields).
+
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.abort
+local sharedpack = require "skynet.sharedpack"
+
+local mode = ...
+
+local READER = 8
+local PLAYER = 20000
+
+if mode == "reader" then
+
+local function report(obj)
+	local player = obj.players[PLAYER // 2]
+	return { obj.version, player.name, collectgarbage "count" }
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd, ...)
+		if cmd == "gc" then
+			collectgarbage()
+			skynet.ret()
+		elseif cmd == "plain" then
+			skynet.ret(skynet.pack(report(...)))
+		elseif cmd == "shared" then
+			skynet.ret(skynet.pack(report(sharedpack.open(...))))
+		elseif cmd == "check" then
+			local obj = sharedpack.open(...)
+			local msg, sz = skynet.pack(obj.list[2], #obj.list, obj[1])
+			obj = nil
+			collectgarbage()
+			skynet.ret(msg, sz)
+		end
+	end)
+end)
+
+else
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local function check(readers)
+	local t = {
+		"one", "two",
+		list = { 1, 2.5, "three", false, { x = 1 } },
+		[-1] = "negative",
+		[100] = "sparse",
+		[1<<40] = "large",
+		[""] = "empty",
+		name = "sharedpack",
+		nested = { a = { b = { c = "deep" } } },
+	}
+	for i = 1, 100 do
+		t["key" .. i] = i
+	end
+	local obj = sharedpack.new(t)
+	assert(equal(sharedpack.copy(obj), t))
+	assert(#obj == 2 and obj[1] == "one" and obj[3] == nil)
+	assert(obj[100] == "sparse" and obj[100.0] == "sparse" and obj[-1] == "negative" and obj[1<<40] == "large")
+	assert(obj[""] == "empty" and obj.key50 == 50 and obj.nokey == nil and obj[1.5] == nil and obj[true] == nil)
+	assert(obj.nested.a.b.c == "deep")
+	assert(obj.nested == obj.nested)	-- cached
+	local n = 0
+	for i, v in ipairs(obj.list) do
+		assert(i == 5 or v == t.list[i])
+		n = n + 1
+	end
+	assert(n == 5 and obj.list[5].x == 1)
+	assert(not pcall(function() obj.name = "x" end))
+	assert(not pcall(sharedpack.new, { [{}] = 1 }))
+	assert(not pcall(sharedpack.new, { f = print }))
+
+	-- the references are released by the readers
+	local _, ref = sharedpack.size(obj)
+	for _, reader in ipairs(readers) do
+		local v, len, first = skynet.call(reader, "lua", "check", sharedpack.share(obj))
+		assert(v == 2.5 and len == 5 and first == "one")
+	end
+	assert(select(2, sharedpack.size(obj)) == ref)
+	sharedpack.release(sharedpack.share(obj.list))
+	assert(select(2, sharedpack.size(obj)) == ref)
+	local list = obj.list
+	obj = nil
+	collectgarbage()
+	assert(list[5].x == 1 and select(2, sharedpack.size(list)) < ref)
+end
+
+local function snapshot()
+	local s = { version = 42, players = {} }
+	for i = 1, PLAYER do
+		s.players[i] = {
+			id = 1000 + i,
+			name = "player" .. i,
+			level = i % 100,
+			pos = { x = i * 1.5, y = i * 2.5 },
+			items = { i, i + 1, i + 2 },
+		}
+	end
+	return s
+end
+
+local function fanout(readers, name, f)
+	collectgarbage()
+	local mem = collectgarbage "count"
+	local reader_mem = 0
+	for _, reader in ipairs(readers) do
+		skynet.call(reader, "lua", "gc")
+	end
+	local t = skynet.hpc()
+	for _, reader in ipairs(readers) do
+		local r = f(reader)
+		assert(r[1] == 42 and r[2] == "player" .. PLAYER // 2)
+		reader_mem = reader_mem + r[3]
+	end
+	t = (skynet.hpc() - t) / 1000000
+	print(string.format("%-10s : %d readers %8.2f ms, sender %8.0f KB, reader %8.0f KB (average)",
+		name, #readers, t, collectgarbage "count" - mem, reader_mem / #readers))
+end
+
+skynet.start(function()
+	local readers = {}
+	for i = 1, READER do
+		readers[i] = skynet.newservice(SERVICE_NAME, "reader")
+	end
+	check(readers)
+
+	local s = snapshot()
+	local msg, sz = skynet.pack(s)
+	skynet.trash(msg, sz)
+	local t = skynet.hpc()
+	local obj = sharedpack.new(s)
+	t = (skynet.hpc() - t) / 1000000
+	print(string.format("snapshot %d bytes by skynet.pack, %d bytes by sharedpack (%.2f ms)", sz, sharedpack.size(obj), t))
+
+	fanout(readers, "pack", function(reader)
+		return skynet.call(reader, "lua", "plain", s)
+	end)
+	fanout(readers, "sharedpack", function(reader)
+		return skynet.call(reader, "lua", "shared", sharedpack.share(obj))
+	end)
+	skynet.abort()
+end)
+
+end
@@ -0,0 +1,133 @@
+-- Socket load test : clients ping-pong small packages with echo services through loopback.
+-- Run it with socket_thread = 1, 2, 4 ... in config to compare the throughput.
+-- It reports the syscalls of poll backend (counted only with SOCKET_POLL_STAT, see Makefile) and
+-- read/write syscalls (from /proc/self/io, linux only) per round trip.
+-- With USE_IO_URING, run it again with io_uring = false in config to compare io_uring with epoll.
+
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"	-- import skynet.abort
+local driver = require "skynet.socketdriver"
+
+local mode = ...
+
+local PORT = 8002
+local PACKAGE = string.rep("x", 64)
+
+if mode == "echo" then
+
+local function echo(id)
+	socket.start(id)
+	while true do
+		local str = socket.read(id)
+		if str then
+			socket.write(id, str)
+		else
+			socket.close(id)
+			return
+		end
+	end
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, id)
+		skynet.fork(echo, id)
+	end)
+end)
+
+elseif mode == "client" then
+
+local function pingpong(id, stop, result)
+	local sz = #PACKAGE
+	while skynet.now() < stop do
+		socket.write(id, PACKAGE)
+		if not socket.read(id, sz) then
+			break
+		end
+		result.n = result.n + 1
+	end
+	socket.close(id)
+	result.done = result.done + 1
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, conn, ti)
+		local result = { n = 0, done = 0 }
+		local ids = {}
+		for i = 1, conn do
+			ids[i] = assert(socket.open("127.0.0.1", PORT))
+		end
+		local stop = skynet.now() + ti
+		for i = 1, conn do
+			skynet.fork(pingpong, ids[i], stop, result)
+		end
+		while result.done < conn do
+			skynet.sleep(10)
+		end
+		skynet.ret(skynet.pack(result.n))
+	end)
+end)
+
+else
+
+local ECHO = 4
+local CLIENT = 4
+local CONNECTION = 64	-- per client
+local TIME = 300	-- 3s
+
+local function syscall()
+	local r, w = 0, 0
+	local f = io.open "/proc/self/io"
+	if f then
+		local s = f:read "a"
+		f:close()
+		r = tonumber(s:match "syscr: (%d+)")
+		w = tonumber(s:match "syscw: (%d+)")
+	end
+	return driver.stat().poll_syscall, r, w
+end
+
+skynet.start(function()
+	local echo = {}
+	for i = 1, ECHO do
+		echo[i] = skynet.newservice(SERVICE_NAME, "echo")
+	end
+	local n = 0
+	local listen = socket.listen("127.0.0.1", PORT)
+	socket.start(listen, function(id)
+		n = n + 1
+		skynet.send(echo[n % ECHO + 1], "lua", id)
+	end)
+
+	local client = {}
+	for i = 1, CLIENT do
+		client[i] = skynet.newservice(SERVICE_NAME, "client")
+	end
+	local total = 0
+	local done = 0
+	local co = coroutine.running()
+	local poll0, r0, w0 = syscall()
+	for i = 1, CLIENT do
+		skynet.fork(function()
+			total = total + skynet.call(client[i], "lua", CONNECTION, TIME)
+			done = done + 1
+			if done == CLIENT then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait()
+	local poll1, r1, w1 = syscall()
+	local ti = TIME / 100
+	print(string.format("backend=%s socket_thread=%s connections=%d round trips=%d %.0f/s",
+		driver.stat().uring and "io_uring" or "epoll",
+		skynet.getenv "socket_thread" or 1, CLIENT * CONNECTION, total, total / ti))
+	total = math.max(total, 1)
+	local poll = poll1 == 0 and "n/a" or string.format("%.2f", (poll1 - poll0) / total)
+	print(string.format("syscalls per round trip : poll %s read %.2f write %.2f",
+		poll, (r1 - r0) / total, (w1 - w0) / total))
+	socket.close(listen)
+	skynet.abort()
+end)
+
+end
@@ -19,8 +19,27 @@ local function test()
 	end
 end
 
+local function test_cancel()
+	-- timers expire in the same tick are batched into one message
+	local fired = 0
+	local sessions = {}
+	for i=1,1000 do
+		sessions[i] = skynet.timeout(10, function() fired = fired + 1 end)
+	end
+	local canceled = 0
+	for i=1,1000,2 do
+		if skynet.canceltimeout(sessions[i]) then
+			canceled = canceled + 1
+		end
+	end
+	skynet.sleep(20)
+	print("test cancel", canceled, fired)
+	assert(canceled == 500 and fired == 500)
+end
+
 skynet.start(function()
 	test()
+	test_cancel()
 
 	skynet.fork(wakeup, coroutine.running())
 	skynet.timeout(300, function() timeout "Hello World" end)
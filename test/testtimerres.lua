@@ -0,0 +1,37 @@
+local skynet = require "skynet"
+require "skynet.manager"
+
+-- measure the lateness of millisecond sleeps, run with timer_tick = 1000 in config for high resolution mode
+
+local N = 1000
+
+local function percentile(t, p)
+	return t[math.max(1, math.ceil(#t * p))]
+end
+
+local function bench(ms)
+	local late = {}
+	for i=1,N do
+		local t = skynet.hpc()
+		skynet.msleep(ms)
+		late[i] = (skynet.hpc() - t) / 1000000 - ms
+	end
+	table.sort(late)
+	print(string.format("msleep(%d) x %d late(ms): p50 %.3f p90 %.3f p99 %.3f max %.3f",
+		ms, N, percentile(late, 0.5), percentile(late, 0.9), percentile(late, 0.99), late[N]))
+end
+
+skynet.start(function()
+	local fired
+	skynet.mtimeout(5, function() fired = true end)
+	skynet.msleep(20)
+	assert(fired)
+	-- the longest timeout must not overflow to an expired one in high resolution mode
+	local overflow
+	skynet.timeout(0x7fffffff, function() overflow = true end)
+	skynet.msleep(20)
+	assert(not overflow)
+	bench(1)
+	bench(5)
+	skynet.abort()
+end)
@@ -0,0 +1,56 @@
+-- LOGON : the cost of the message trace on a busy service, and the trace with sampling.
+-- It needs logpath in config, decode the trace by tools/tracedump.lua .
+
+local skynet = require "skynet"
+local core = require "skynet.core"
+require "skynet.manager"	-- import skynet.abort
+
+local mode = ...
+
+local N = 50000
+
+if mode == "echo" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, ...)
+		skynet.ret(skynet.pack(...))
+	end)
+end)
+
+else
+
+local payload = { cmd = "move", x = 100, y = 200, path = string.rep("abcdefgh", 16) }
+
+local function bench(echo, name)
+	local t = skynet.hpc()
+	for i = 1, N do
+		skynet.call(echo, "lua", payload, i)
+	end
+	t = (skynet.hpc() - t) / N
+	print(string.format("%-16s : %6.0f ns per call", name, t))
+end
+
+local function tracesize(echo)
+	local f = io.open(string.format("%s/%08x.log", skynet.getenv "logpath", echo), "rb")
+	local sz = f:seek "end"
+	f:close()
+	return sz
+end
+
+skynet.start(function()
+	assert(skynet.getenv "logpath", "Need logpath in config")
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+	local address = skynet.address(echo)
+	bench(echo, "trace off")
+	core.command("LOGON", address)
+	bench(echo, "trace on")
+	core.command("LOGOFF", address)
+	local sz = tracesize(echo)
+	core.command("LOGON", address .. " 100")
+	bench(echo, "trace 1/100")
+	core.command("LOGOFF", address)
+	print(string.format("trace file %d bytes for %d messages, %d bytes for sampled", sz, N, tracesize(echo) - sz))
+	skynet.abort()
+end)
+
+end
@@ -0,0 +1,77 @@
+-- Write buffer flush benchmark : each connection sends 10k small packages with socket.lwrite,
+-- they are queued in the write buffer list and flushed by the socket thread.
+-- It reports write syscalls per byte from /proc/self/io (linux only).
+
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+require "skynet.manager"	-- import skynet.abort
+
+local PORT = 8003
+local CONNECTION = 8
+local PACKAGE = 10000
+local PACKAGE_SIZE = 32
+
+local function syscw()
+	local f = io.open "/proc/self/io"
+	if not f then
+		return
+	end
+	local s = f:read "a"
+	f:close()
+	return tonumber(s:match "syscw: (%d+)"), tonumber(s:match "wchar: (%d+)")
+end
+
+local function receive(id, expect, result, co)
+	socket.start(id)
+	local n = 0
+	while n < expect do
+		local str = socket.read(id)
+		if not str then
+			break
+		end
+		n = n + #str
+	end
+	socket.close(id)
+	result.bytes = result.bytes + n
+	result.done = result.done + 1
+	if result.done == CONNECTION then
+		skynet.wakeup(co)
+	end
+end
+
+skynet.start(function()
+	local co = coroutine.running()
+	local expect = PACKAGE * PACKAGE_SIZE
+	local result = { bytes = 0, done = 0 }
+	local listen = socket.listen("127.0.0.1", PORT)
+	socket.start(listen, function(id)
+		skynet.fork(receive, id, expect, result, co)
+	end)
+	local ids = {}
+	for i = 1, CONNECTION do
+		ids[i] = assert(socket.open("127.0.0.1", PORT))
+	end
+	local pkg = string.rep("x", PACKAGE_SIZE)
+	local call0, byte0 = syscw()
+	local start = skynet.hpc()
+	for i = 1, CONNECTION do
+		local id = ids[i]
+		for j = 1, PACKAGE do
+			socket.lwrite(id, pkg)
+		end
+	end
+	skynet.wait()
+	local ti = (skynet.hpc() - start) / 1000000
+	local call1, byte1 = syscw()
+	print(string.format("%d connections x %d packages x %d bytes : %.1f ms", CONNECTION, PACKAGE, PACKAGE_SIZE, ti))
+	if call0 then
+		local calls = call1 - call0
+		local bytes = byte1 - byte0
+		print(string.format("write syscalls %d, bytes %d, syscalls per KB %.3f", calls, bytes, calls * 1024 / bytes))
+	end
+	for i = 1, CONNECTION do
+		socket.close(ids[i])
+	end
+	socket.close(listen)
+	skynet.abort()
+end)
@@ -0,0 +1,69 @@
+-- Decode the message trace of a service (see skynet-src/skynet_log.c), the output is the same as the text log of the old versions.
+-- usage : 3rd/lua/lua tools/tracedump.lua logpath/0000000a.log [max bytes of payload to print]
+
+local filename, limit = ...
+if filename == nil then
+	print "usage : lua tracedump.lua tracefile [limit]"
+	return
+end
+limit = tonumber(limit)
+
+local PTYPE_SOCKET = 6
+local TRACE_SOCKET_INLINE = 1
+local TRACE_CLOSE = 2
+
+local HEADER = "c8I4I4I4I4I8"
+local RECORD = "I4i4I4I4BBH"
+local RECORD_SIZE = string.packsize(RECORD)
+
+local f = assert(io.open(filename, "rb"))
+local data = f:read "a"
+f:close()
+
+local function hex(s)
+	if limit and #s > limit then
+		return (s:sub(1, limit):gsub(".", function(c) return string.format("%02x", c:byte()) end)) .. "..."
+	end
+	return (s:gsub(".", function(c) return string.format("%02x", c:byte()) end))
+end
+
+local pos = 1
+local starttime = 0
+while pos <= #data do
+	if data:sub(pos, pos + 7) == "SKYTRACE" then
+		-- the file is appended by each LOGON
+		local _, version, handle, start, sample, opentime
+		_, version, handle, start, sample, opentime, pos = string.unpack(HEADER, data, pos)
+		assert(version == 1, "Unsupported version")
+		starttime = start
+		local sample_info = sample > 1 and string.format(" (:%08x sample 1/%d)", handle, sample) or ""
+		io.write(string.format("open time: %u%s %s", opentime & 0xffffffff, sample_info,
+			os.date("%c\n", starttime + opentime // 100)))
+	else
+		if pos + RECORD_SIZE - 1 > #data then
+			io.write "incomplete record\n"
+			break
+		end
+		local source, session, time, sz, type, flags, _, next = string.unpack(RECORD, data, pos)
+		if next + sz - 1 > #data then
+			io.write "incomplete record\n"
+			break
+		end
+		local payload = data:sub(next, next + sz - 1)
+		pos = next + sz
+		if flags & TRACE_CLOSE ~= 0 then
+			io.write(string.format("close time: %u\n", time))
+		elseif type == PTYPE_SOCKET then
+			local stype, id, ud, p = string.unpack("i4i4i4", payload)
+			local content = payload:sub(p)
+			if flags & TRACE_SOCKET_INLINE ~= 0 then
+				content = "[" .. content .. "]"
+			else
+				content = hex(content)
+			end
+			io.write(string.format("[socket] %d %d %d %s\n", stype, id, ud, content))
+		else
+			io.write(string.format(":%08x %d %d %u %s\n", source, type, session, time, hex(payload)))
+		end
+	end
+end